@@ -0,0 +1,161 @@
+#include "batch_payload.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+static const int64_t pow10_table[BATCH_PAYLOAD_MAX_DECIMALS + 1] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000
+};
+
+int batch_payload_keys_init(BatchPayloadKeys* keys, int pin_count) {
+    keys->text = calloc(pin_count, BATCH_PAYLOAD_KEY_MAX);
+    keys->len = calloc(pin_count, sizeof(uint8_t));
+    if (keys->text == NULL || keys->len == NULL) {
+        fprintf(stderr, "BatchPayload: failed to allocate %d keys\n", pin_count);
+        batch_payload_keys_free(keys);
+        return -1;
+    }
+    keys->pin_count = pin_count;
+    return 0;
+}
+
+int batch_payload_keys_set(BatchPayloadKeys* keys, int pin, const char* name) {
+    int len;
+
+    if (pin < 0 || pin >= keys->pin_count) {
+        return -1;
+    }
+    len = snprintf(keys->text[pin], BATCH_PAYLOAD_KEY_MAX, "\"%s\":", name);
+    if (len < 0 || len >= BATCH_PAYLOAD_KEY_MAX) {
+        fprintf(stderr, "BatchPayload: datastream name %s is too long\n", name);
+        keys->len[pin] = 0;
+        return -1;
+    }
+    keys->len[pin] = (uint8_t)len;
+    return 0;
+}
+
+void batch_payload_keys_free(BatchPayloadKeys* keys) {
+    free(keys->text);
+    free(keys->len);
+    keys->text = NULL;
+    keys->len = NULL;
+    keys->pin_count = 0;
+}
+
+void batch_payload_begin(BatchPayload* payload, const BatchPayloadKeys* keys, int decimals) {
+    if (decimals < 0) {
+        decimals = 0;
+    } else if (decimals > BATCH_PAYLOAD_MAX_DECIMALS) {
+        decimals = BATCH_PAYLOAD_MAX_DECIMALS;
+    }
+    payload->keys = keys;
+    payload->decimals = decimals;
+    payload->buf[0] = '{';
+    payload->len = 1;
+    payload->fields = 0;
+    payload->overflow = 0;
+}
+
+// Writes the digits of 'value' backwards ending at 'end'; returns the start
+static char* write_digits(char* end, uint64_t value) {
+    do {
+        *--end = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    return end;
+}
+
+// Formats 'value' rounded to 'decimals' places without trailing zeros
+static int format_number(char* out, double value, int decimals) {
+    char digits[32];
+    char* end = digits + sizeof(digits);
+    char* p = end;
+    int64_t scale = pow10_table[decimals];
+    double scaled = fabs(value) * scale;
+    uint64_t fixed;
+    int fraction_len = decimals;
+    int len = 0;
+
+    if (scaled >= 9e15) {
+        // Past exact integer range: not a real reading, just keep it valid JSON
+        return snprintf(out, 32, "%.9g", value);
+    }
+    fixed = (uint64_t)llround(scaled);
+    uint64_t fraction = fixed % scale;
+    uint64_t whole = fixed / scale;
+
+    // Drop trailing zeros of the fraction
+    while (fraction_len > 0 && fraction % 10 == 0) {
+        fraction /= 10;
+        fraction_len--;
+    }
+    if (fraction_len > 0) {
+        for (int i = 0; i < fraction_len; i++) {
+            *--p = (char)('0' + fraction % 10);
+            fraction /= 10;
+        }
+        *--p = '.';
+    }
+    p = write_digits(p, whole);
+    if (value < 0 && fixed != 0) {
+        *--p = '-';
+    }
+    len = (int)(end - p);
+    memcpy(out, p, len);
+    return len;
+}
+
+static int add_field(BatchPayload* payload, int pin, const char* value, int value_len) {
+    const BatchPayloadKeys* keys = payload->keys;
+    int key_len;
+    int need;
+
+    if (pin < 0 || pin >= keys->pin_count || keys->len[pin] == 0) {
+        return -1;
+    }
+    key_len = keys->len[pin];
+    // Separator, key, value, and room for the closing brace and NUL
+    need = (payload->fields > 0) + key_len + value_len + 2;
+    if (payload->len + need > BATCH_PAYLOAD_MAX) {
+        payload->overflow = 1;
+        return -1;
+    }
+    if (payload->fields > 0) {
+        payload->buf[payload->len++] = ',';
+    }
+    memcpy(payload->buf + payload->len, keys->text[pin], key_len);
+    payload->len += key_len;
+    memcpy(payload->buf + payload->len, value, value_len);
+    payload->len += value_len;
+    payload->fields++;
+    return 0;
+}
+
+int batch_payload_add_int(BatchPayload* payload, int pin, int value) {
+    char digits[16];
+    char* end = digits + sizeof(digits);
+    char* p = write_digits(end, value < 0 ? -(uint64_t)(int64_t)value : (uint64_t)value);
+
+    if (value < 0) {
+        *--p = '-';
+    }
+    return add_field(payload, pin, p, (int)(end - p));
+}
+
+int batch_payload_add_number(BatchPayload* payload, int pin, double value) {
+    char text[32];
+
+    if (!isfinite(value)) {
+        return -1;
+    }
+    return add_field(payload, pin, text, format_number(text, value, payload->decimals));
+}
+
+const char* batch_payload_end(BatchPayload* payload, int* len) {
+    payload->buf[payload->len] = '}';
+    payload->buf[payload->len + 1] = '\0';
+    *len = payload->len + 1;
+    return payload->buf;
+}
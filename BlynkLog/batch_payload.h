@@ -0,0 +1,42 @@
+#ifndef BATCH_PAYLOAD_H
+#define BATCH_PAYLOAD_H
+
+#include <stdint.h>
+
+#define BATCH_PAYLOAD_KEY_MAX      24    // Fits "\"V960flow\":" with room to spare
+#define BATCH_PAYLOAD_VALUE_MAX    24    // Longest number written, "%.9g" fallback included
+#define BATCH_PAYLOAD_MAX          2048  // Same as PUBLISH_QUEUE_PAYLOAD_MAX
+#define BATCH_PAYLOAD_MAX_DECIMALS 6
+
+// Datastream keys, preformatted once as "\"<name>\":" and looked up by pin
+typedef struct {
+    char (*text)[BATCH_PAYLOAD_KEY_MAX];
+    uint8_t* len;               // 0 when the pin has no key
+    int pin_count;
+} BatchPayloadKeys;
+
+int batch_payload_keys_init(BatchPayloadKeys* keys, int pin_count);
+int batch_payload_keys_set(BatchPayloadKeys* keys, int pin, const char* name);
+void batch_payload_keys_free(BatchPayloadKeys* keys);
+
+// One batch_ds JSON object, written straight into 'buf'
+typedef struct {
+    const BatchPayloadKeys* keys;
+    int decimals;               // Fraction digits kept, trailing zeros are trimmed
+    int len;
+    int fields;
+    int overflow;               // A field did not fit and was left out
+    char buf[BATCH_PAYLOAD_MAX];
+} BatchPayload;
+
+void batch_payload_begin(BatchPayload* payload, const BatchPayloadKeys* keys, int decimals);
+
+// Appends one datastream. Return -1, leaving the payload unchanged, if the pin
+// has no key, the value is not finite or the buffer is full.
+int batch_payload_add_int(BatchPayload* payload, int pin, int value);
+int batch_payload_add_number(BatchPayload* payload, int pin, double value);
+
+// Closes the object and returns the NUL terminated text; '*len' gets its length
+const char* batch_payload_end(BatchPayload* payload, int* len);
+
+#endif // BATCH_PAYLOAD_H
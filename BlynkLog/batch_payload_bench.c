@@ -0,0 +1,147 @@
+// Compares building one batch_ds payload through a json-c object tree, the
+// way msgarrvd() used to, against the preformatted BatchPayload builder.
+//
+//   batch_payload_bench [-n iterations]
+//
+// Each batch holds BLYNK_BATCH_ROW_LIMIT rows of five datastreams. Reports
+// the time, heap allocations and payload bytes per batch.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include <json-c/json.h>
+#include "batch_payload.h"
+#include "bench_alloc.h"
+
+#define DEFAULT_ITERATIONS 200000
+#define BENCH_ROWS 8            // BLYNK_BATCH_ROW_LIMIT
+#define BENCH_PINS_PER_ROW 5
+
+static const char* suffixes[BENCH_PINS_PER_ROW] = { "zone", "flow", "min", "psi", "gpm" };
+
+typedef struct {
+    int zone_number;
+    float total_flow;
+    float total_minutes;
+    float avg_psi;
+    float gpm;
+} BenchRow;
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// The old msgarrvd() batch: object tree, snprintf keys, json-c serialization
+static size_t build_jsonc(const BenchRow* rows) {
+    json_object* obj = json_object_new_object();
+    char name[16];
+    size_t len;
+
+    for (int r = 0; r < BENCH_ROWS; r++) {
+        snprintf(name, sizeof(name), "V%dzone", r * 5 + 1);
+        json_object_object_add(obj, name, json_object_new_int(rows[r].zone_number));
+        snprintf(name, sizeof(name), "V%dflow", r * 5 + 2);
+        json_object_object_add(obj, name, json_object_new_double(rows[r].total_flow));
+        snprintf(name, sizeof(name), "V%dmin", r * 5 + 3);
+        json_object_object_add(obj, name, json_object_new_double(rows[r].total_minutes));
+        snprintf(name, sizeof(name), "V%dpsi", r * 5 + 4);
+        json_object_object_add(obj, name, json_object_new_double(rows[r].avg_psi));
+        snprintf(name, sizeof(name), "V%dgpm", r * 5 + 5);
+        json_object_object_add(obj, name, json_object_new_double(rows[r].gpm));
+    }
+    len = strlen(json_object_to_json_string_ext(obj, JSON_C_TO_STRING_PLAIN));
+    json_object_put(obj);
+    return len;
+}
+
+static size_t build_builder(const BenchRow* rows, const BatchPayloadKeys* keys, BatchPayload* payload) {
+    int len;
+
+    batch_payload_begin(payload, keys, 2);
+    for (int r = 0; r < BENCH_ROWS; r++) {
+        int pin = r * BENCH_PINS_PER_ROW + 1;
+        batch_payload_add_int(payload, pin, rows[r].zone_number);
+        batch_payload_add_number(payload, pin + 1, rows[r].total_flow);
+        batch_payload_add_number(payload, pin + 2, rows[r].total_minutes);
+        batch_payload_add_number(payload, pin + 3, rows[r].avg_psi);
+        batch_payload_add_number(payload, pin + 4, rows[r].gpm);
+    }
+    batch_payload_end(payload, &len);
+    return len;
+}
+
+int main(int argc, char* argv[]) {
+    int iterations = DEFAULT_ITERATIONS;
+    BenchRow rows[BENCH_ROWS];
+    BatchPayloadKeys keys;
+    static BatchPayload payload;
+    unsigned long long allocs;
+    double start, elapsed;
+    size_t bytes = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+            case 'n':
+                iterations = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n iterations]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (iterations < 1) {
+        iterations = 1;
+    }
+
+    // Readings in the ranges the watertable fixtures show
+    srand(1);
+    for (int r = 0; r < BENCH_ROWS; r++) {
+        rows[r].zone_number = r + 1;
+        rows[r].total_flow = 100.0f + rand() % 300000 / 100.0f;
+        rows[r].total_minutes = rand() % 25000 / 100.0f;
+        rows[r].avg_psi = 40.0f + rand() % 1000 / 100.0f;
+        rows[r].gpm = 5.0f + rand() % 1500 / 100.0f;
+    }
+
+    if (batch_payload_keys_init(&keys, BENCH_ROWS * BENCH_PINS_PER_ROW + 1) != 0) {
+        return 1;
+    }
+    for (int pin = 1; pin <= BENCH_ROWS * BENCH_PINS_PER_ROW; pin++) {
+        char name[16];
+        snprintf(name, sizeof(name), "V%d%s", pin, suffixes[(pin - 1) % BENCH_PINS_PER_ROW]);
+        batch_payload_keys_set(&keys, pin, name);
+    }
+
+    printf("%d rows x %d datastreams per batch, %d iterations\n", BENCH_ROWS, BENCH_PINS_PER_ROW, iterations);
+
+    build_jsonc(rows);
+    allocs = bench_alloc_count();
+    start = now_ns();
+    for (int i = 0; i < iterations; i++) {
+        bytes = build_jsonc(rows);
+    }
+    elapsed = now_ns() - start;
+    allocs = bench_alloc_count() - allocs;
+    printf("  json-c   %8.0f ns/batch %9.0f batches/s %6.1f allocs/batch %5zu bytes\n", elapsed / iterations,
+           iterations * 1e9 / elapsed, (double)allocs / iterations, bytes);
+
+    build_builder(rows, &keys, &payload);
+    allocs = bench_alloc_count();
+    start = now_ns();
+    for (int i = 0; i < iterations; i++) {
+        bytes = build_builder(rows, &keys, &payload);
+    }
+    elapsed = now_ns() - start;
+    allocs = bench_alloc_count() - allocs;
+    printf("  builder  %8.0f ns/batch %9.0f batches/s %6.1f allocs/batch %5zu bytes\n", elapsed / iterations,
+           iterations * 1e9 / elapsed, (double)allocs / iterations, bytes);
+    printf("  %s\n", payload.buf);
+
+    batch_payload_keys_free(&keys);
+    return 0;
+}
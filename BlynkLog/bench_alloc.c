@@ -0,0 +1,40 @@
+#include "bench_alloc.h"
+
+// glibc's own entry points, so the wrappers below can count and forward
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t nmemb, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void  __libc_free(void* ptr);
+
+static unsigned long long alloc_count = 0;
+
+void* malloc(size_t size) {
+    alloc_count++;
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t nmemb, size_t size) {
+    alloc_count++;
+    return __libc_calloc(nmemb, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+    alloc_count++;
+    return __libc_realloc(ptr, size);
+}
+
+void free(void* ptr) {
+    __libc_free(ptr);
+}
+
+unsigned long long bench_alloc_count(void) {
+    return alloc_count;
+}
+
+void* bench_alloc_uncounted(size_t size) {
+    return __libc_malloc(size);
+}
+
+void bench_free_uncounted(void* ptr) {
+    __libc_free(ptr);
+}
@@ -0,0 +1,14 @@
+#ifndef BENCH_ALLOC_H
+#define BENCH_ALLOC_H
+
+#include <stddef.h>
+
+// Heap allocation counting for the benchmark tools. Linking bench_alloc.c
+// wraps malloc/calloc/realloc for the whole program.
+unsigned long long bench_alloc_count(void);
+
+// Allocate/free without being counted, for the benchmark's own buffers
+void* bench_alloc_uncounted(size_t size);
+void bench_free_uncounted(void* ptr);
+
+#endif // BENCH_ALLOC_H
@@ -10,7 +10,6 @@
 // Device name now comes from config file
 // #define BLYNK_DEVICE_NAME "device"
 
-#define BLYNK_PROTOTYPE_ROW_LIMIT 16 // Set to BLYNK_TABLE_ROW_COUNT to send all rows
 #define BLYNK_BATCH_ROW_LIMIT 8      // Max rows per Blynk batch message
 
 // New definitions for Blynk V0 and mwp_data_service
@@ -20,6 +19,12 @@
 
 // Placeholder for the topic where mwp_data_service publishes the watertable JSON
 #define MWP_WATERTABLE_JSON_TOPIC "mwp/json/data/log/dataservice/query_results" // <<< USER: Please confirm/update this topic
+// Same results in the binary encoding, published when a query asks for it
+#define MWP_WATERTABLE_BINARY_TOPIC MWP_WATERTABLE_JSON_TOPIC "/bin"
+
+// Local topic for the request latency histograms, next to mwp_data_service's own
+#define BLYNKLOG_METRICS_TOPIC "mwp/json/data/log/blynklog/metrics"
+#define BLYNKLOG_RECONNECT_METRICS_TOPIC "mwp/json/data/log/blynklog/reconnect"
 
 /* Define IP Address for MQTT for both
  * a Production Server and a Development Server
@@ -37,26 +42,65 @@
 #include <string.h>
 #include <unistd.h>
 #include <getopt.h>
+#include <signal.h>
 #include <math.h>
 #include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <pthread.h>
 #include <json-c/json.h>
 #include "MQTTClient.h"
 #include "config.h"
+#include "watertable.h"
+#include "publish_queue.h"
+#include "delta_cache.h"
+#include "offline_store.h"
+#include "batch_payload.h"
+#include "query_debouncer.h"
+#include "window_cache.h"
+#include "latency_trace.h"
+#include "reconnect.h"
 
 // Moved to file scope
 static MQTTClient client = NULL;
-static volatile int blynkClient_initialized_and_connected = 0; // volatile as it can be changed by callback
-static MQTTClient blynkClient = NULL; // Moved to file scope for access in msgarrvd
+// Collapses TimeWindow menu scrolling into one mwp_data_service query
+static QueryDebouncer time_window_debouncer;
+// Last cells received per timeWindowMap entry, replayed when a window is picked again
+static WindowCache time_window_cache;
+// Per-stage latency of TimeWindow selections, from the dashboard to Blynk
+static LatencyTrace request_latency;
+
+// Connections that drop are brought back by their own thread, with backoff
+static ReconnectState main_reconnect;
+static pthread_t reconnect_thread;
+static pthread_mutex_t reconnect_thread_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t reconnect_thread_cond;
+static int reconnect_thread_running = 0;
+static int reconnect_thread_woken = 0;  // A loss arrived while the thread was busy
+// Longest the reconnect thread sleeps, so a device it has not seen fail yet is still checked
+#define RECONNECT_IDLE_WAKE_US 1000000LL
+
+// Called from connection loss callbacks so the first attempt is not missed
+static void wake_reconnect_thread(void)
+{
+    pthread_mutex_lock(&reconnect_thread_lock);
+    reconnect_thread_woken = 1;
+    if (reconnect_thread_running) {
+        pthread_cond_signal(&reconnect_thread_cond);
+    }
+    pthread_mutex_unlock(&reconnect_thread_lock);
+}
 
 int verbose = FALSE;
 int disc_finished = 0;
 int subscribed = 0;
-int finished = 0;
+volatile sig_atomic_t finished = 0;
 
-// Global flag for connection loss detection, to be set by connlost callback
-volatile int connection_lost_flag = 0;
-// Reconnect delay in seconds
-#define RECONNECT_DELAY_SECONDS 5
+// Bounds each connect attempt, since the reconnect thread tries the
+// connections one after another
+#define CONNECT_TIMEOUT_SECONDS 10
+// How often verbose mode prints the publish queue counters
+#define PUBLISH_STATS_INTERVAL_SECONDS 60
 
 // Time Window Mapping
 typedef struct {
@@ -84,54 +128,141 @@ typedef struct {
     int   data_valid;     // Flag to indicate if data was successfully populated from JSON for this row
 } BlynkDataRow;
 
-#define BLYNK_TABLE_ROW_COUNT 31
-static BlynkDataRow blynk_display_table[BLYNK_TABLE_ROW_COUNT];
-
-// Maps a specific Controller/Zone from the JSON to a row in blynk_display_table
+// Watertable controller/zone -> cell lookup for watertable_extract(), compiled
+// at startup from the row maps of every device config. Devices that show the
+// same controller/zone share its cell.
+static WatertableIndex watertable_index;
+static int watertable_cell_count = 0;
+
+// Virtual pins of one display row: V<row*5+1>zone, flow, min, psi and gpm
+#define BLYNK_PINS_PER_ROW 5
+static const char* blynk_pin_suffix[BLYNK_PINS_PER_ROW] = { "zone", "flow", "min", "psi", "gpm" };
+
+// Messages are cut at BLYNK_BATCH_ROW_LIMIT rows, so however many rows the
+// row map has, a full batch must fit the payload buffer and a queue slot
+#if BLYNK_BATCH_ROW_LIMIT * BLYNK_PINS_PER_ROW * (BATCH_PAYLOAD_KEY_MAX + BATCH_PAYLOAD_VALUE_MAX) + 2 > BATCH_PAYLOAD_MAX
+#error "BLYNK_BATCH_ROW_LIMIT rows of datastreams do not fit in BATCH_PAYLOAD_MAX"
+#endif
+#if BATCH_PAYLOAD_MAX > PUBLISH_QUEUE_PAYLOAD_MAX
+#error "BATCH_PAYLOAD_MAX exceeds PUBLISH_QUEUE_PAYLOAD_MAX"
+#endif
+
+// Fraction digits sent for flow, minutes, PSI and GPM
+#define BLYNK_VALUE_DECIMALS 2
+
+// Datastream keys preformatted at startup, and the batch being built in msgarrvd().
+// Shared by all devices, since msgarrvd() builds their batches one at a time.
+static BatchPayloadKeys blynk_batch_keys;
+static BatchPayload blynk_batch;
+
+// One Blynk device served by this process, set up from one config file. The
+// watertable is parsed once per message and fanned out to every device.
 typedef struct {
-    const char* controller_json_key; // Key for the controller in JSON (e.g., "0", "1")
-    const char* zone_json_key;       // Key for the zone within controller in JSON (e.g., "0", "1", "16")
-    int         display_zone_number; // The actual zone number to store and eventually display
-} ControllerZoneSource;
-
-// Predefined map of 31 data sources from JSON to rows in our blynk_display_table
-static const ControllerZoneSource json_to_blynk_map[BLYNK_TABLE_ROW_COUNT] = {
-    // Controller 0 (1 row)
-    { "0", "0", 0 },  // C0, Z0 -> displays Zone 0
-    // Controller 1 (16 rows)
-    { "1", "1", 1 },  // C1, Z1 -> displays Zone 1
-    { "1", "2", 2 },  // C1, Z2 -> displays Zone 2
-    { "1", "3", 3 },
-    { "1", "4", 4 },
-    { "1", "5", 5 },
-    { "1", "6", 6 },
-    { "1", "7", 7 },
-    { "1", "8", 8 },
-    { "1", "9", 9 },
-    { "1", "10", 10 },
-    { "1", "11", 11 },
-    { "1", "12", 12 },
-    { "1", "13", 13 },
-    { "1", "14", 14 },
-    { "1", "15", 15 },
-    { "1", "16", 16 },
-    // Controller 2 (13 rows)
-    { "2", "1", 1 },  // C2, Z1 -> displays Zone 1
-    { "2", "2", 2 },
-    { "2", "3", 3 },
-    { "2", "4", 4 },
-    { "2", "5", 5 },
-    { "2", "6", 6 },
-    { "2", "7", 7 },
-    { "2", "8", 8 },
-    { "2", "9", 9 },
-    { "2", "10", 10 },
-    { "2", "11", 11 },
-    { "2", "12", 12 },
-    { "2", "13", 13 },
-    // Controller 3 (1 row)
-    { "3", "1", 1 }   // C3, Z1 -> displays Zone 1
-};
+    char* config_file;
+    Config config;
+    MQTTClient client;
+    volatile int connected;     // volatile as it can be changed by callback
+    ReconnectState reconnect;   // Backoff and outage metrics of the Blynk client
+    // Held while client is used or replaced, since the publish sender thread shares it
+    pthread_mutex_t lock;
+    // Held while the table is refilled or queued, by msgarrvd() and the main loop
+    pthread_mutex_t table_lock;
+    BlynkDataRow* table;        // One per display row the config selects
+    int* row_cells;             // Watertable cell each of those rows shows
+    int row_count;
+    unsigned long generation;       // Bumped each time msgarrvd() refills the table
+    unsigned long sent_generation;  // Generation last queued for Blynk
+    DeltaCache delta;           // Last value sent per virtual pin, so unchanged datastreams are not republished
+    char summary_prefix[256];   // {"template_id":..,"device_name":..,"data":[ of the flow summary
+    int summary_prefix_len;
+    OfflineStore offline;       // Newest value per virtual pin not yet handed to the sender
+    PublishQueue queue;         // Blynk rate limits apply per device, so each has its own sender
+} BlynkDevice;
+
+#define BLYNK_MAX_DEVICES 16
+static BlynkDevice blynk_devices[BLYNK_MAX_DEVICES];
+static int blynk_device_count = 0;
+
+// Gives every display row of every device a watertable cell and allocates the
+// device tables. Call once all devices are added.
+static int build_watertable_index(void)
+{
+    watertable_index_init(&watertable_index);
+    watertable_cell_count = 0;
+    for (int d = 0; d < blynk_device_count; d++) {
+        BlynkDevice* device = &blynk_devices[d];
+        const Config* config = &device->config;
+
+        device->row_count = config->data_filter.rows_count;
+        device->table = calloc(device->row_count > 0 ? device->row_count : 1, sizeof(BlynkDataRow));
+        device->row_cells = calloc(device->row_count > 0 ? device->row_count : 1, sizeof(int));
+        if (device->table == NULL || device->row_cells == NULL) {
+            fprintf(stderr, "%s: Failed to allocate %d display rows\n", device->config_file, device->row_count);
+            return -1;
+        }
+        for (int r = 0; r < device->row_count; r++) {
+            const ConfigRow* row = &config->row_map.rows[config->data_filter.rows[r]];
+            int cell = watertable_index.cell[row->controller][row->zone];
+            if (cell < 0) {
+                cell = watertable_cell_count++;
+                watertable_index_add(&watertable_index, row->controller, row->zone, cell);
+            }
+            device->row_cells[r] = cell;
+        }
+    }
+    if (watertable_cell_count == 0) {
+        fprintf(stderr, "No device config selects any display rows\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Datastream keys for the most display rows any device has
+static int build_batch_keys(void)
+{
+    char name[16];
+    int row_count = 0;
+
+    for (int d = 0; d < blynk_device_count; d++) {
+        if (blynk_devices[d].row_count > row_count) {
+            row_count = blynk_devices[d].row_count;
+        }
+    }
+    if (batch_payload_keys_init(&blynk_batch_keys, row_count * BLYNK_PINS_PER_ROW + 1) != 0) {
+        return -1;
+    }
+    for (int pin = 1; pin <= row_count * BLYNK_PINS_PER_ROW; pin++) {
+        snprintf(name, sizeof(name), "V%d%s", pin, blynk_pin_suffix[(pin - 1) % BLYNK_PINS_PER_ROW]);
+        batch_payload_keys_set(&blynk_batch_keys, pin, name);
+    }
+    return 0;
+}
+
+// Adds the datastreams of 'row' that changed since they were last sent.
+// Returns how many were added.
+static int add_changed_datastreams(BlynkDevice* device, BatchPayload* payload, int row_index, const BlynkDataRow* row)
+{
+    const double values[BLYNK_PINS_PER_ROW] = {
+        row->zone_number, row->total_flow, row->total_minutes, row->avg_psi, row->gpm
+    };
+    int added = 0;
+
+    for (int k = 0; k < BLYNK_PINS_PER_ROW; k++) {
+        int pin = row_index * BLYNK_PINS_PER_ROW + k + 1;
+        int rc;
+        if (!delta_cache_update(&device->delta, pin, values[k])) {
+            continue;
+        }
+        rc = (k == 0) ? batch_payload_add_int(payload, pin, row->zone_number)
+                      : batch_payload_add_number(payload, pin, values[k]);
+        if (rc != 0) {
+            delta_cache_request_full(&device->delta); // Recorded as sent but left out
+            continue;
+        }
+        added++;
+    }
+    return added;
+}
 
 MQTTClient_deliveryToken deliveredtoken;
 
@@ -146,234 +277,381 @@ void delivered(void *context, MQTTClient_deliveryToken dt)
    copy and paste the same code into multiple programs. 
 */
 
-int msgarrvd(void *context, char *topicName, int topicLen, MQTTClient_message *message)
+// Fills 'device's display table from the extracted cells, walking only the
+// map rows its config filter allows (precomputed in main)
+static void fill_device_table(BlynkDevice* device, const WatertableCell* cells)
 {
-    // Check if the message is for the blynkLog functionality (time window selection from Blynk)
-    // This function is the callback for the *main client* that connects to the local broker.
-    // The blynk_msgarrvd is for the blynkClient.
-    // For now, this main client's msgarrvd will handle the incoming JSON for the table.
+    const Config* config = &device->config;
 
-    printf("Main client message arrived on topic: %s\n", topicName);
+    // Reset the entire display table to a known zero state first.
+    memset(device->table, 0, device->row_count * sizeof(BlynkDataRow));
 
-    // Check if this is the message from mwp_data_service with the watertable JSON
-    if (strcmp(topicName, MWP_WATERTABLE_JSON_TOPIC) == 0)
-    {
-        printf("Received watertable JSON data. Processing...\n");
+    int display_row_index = 0; // Use a separate index for the display table
 
-        // The payload from MQTT is not guaranteed to be null-terminated.
-        // Copy to a new buffer and null-terminate it before parsing.
-        char *payload_copy = malloc(message->payloadlen + 1);
-        if (payload_copy == NULL) {
-            fprintf(stderr, "Fatal: failed to allocate memory for payload copy\n");
-            MQTTClient_freeMessage(&message);
-            MQTTClient_free(topicName);
-            return 1;
-        }
-        memcpy(payload_copy, message->payload, message->payloadlen);
-        payload_copy[message->payloadlen] = '\0';
+    for (int r = 0; r < device->row_count; r++) {
+        const ConfigRow* source = &config->row_map.rows[config->data_filter.rows[r]];
 
-        json_object *parsed_json = json_tokener_parse(payload_copy);
-        
-        // Free the copy now that it has been parsed.
-        free(payload_copy);
+        // If we are here, the source is allowed. We will populate display_row_index.
+        BlynkDataRow* target_row = &device->table[display_row_index];
 
-        if (parsed_json == NULL)
-        {
-            fprintf(stderr, "Failed to parse watertable JSON string\n");
-            MQTTClient_freeMessage(&message);
-            MQTTClient_free(topicName);
-            return 1;
+        const WatertableCell* cell = &cells[device->row_cells[r]];
+        if (!cell->present) {
+            if (verbose) fprintf(stdout, "Data for allowed source C:%d Z:%d not present in received JSON. Skipping.\n",
+                    source->controller, source->zone);
+            continue;
         }
 
-        json_object *details_obj;
-        if (!json_object_object_get_ex(parsed_json, "details", &details_obj)) {
-            fprintf(stderr, "JSON parsing error: 'details' key missing\n");
-            json_object_put(parsed_json); // Free the root json object
-            MQTTClient_freeMessage(&message);
-            MQTTClient_free(topicName);
-            return 1;
-        }
-        if (json_object_get_type(details_obj) != json_type_object) {
-            fprintf(stderr, "JSON parsing error: 'details' is not an object\n");
-            json_object_put(parsed_json);
-            MQTTClient_freeMessage(&message);
-            MQTTClient_free(topicName);
-            return 1;
-        }
+        // Pre-set the zone number for display from the map
+        target_row->zone_number = source->display_zone;
 
-        // Get the configuration from the context
-        Config* config = (Config*)context;
+        target_row->total_flow = (float)cell->total_flow;
+        target_row->total_minutes = (cell->total_seconds > 0) ? (float)(cell->total_seconds / 60.0) : 0.0f;
+        target_row->avg_psi = (float)cell->avg_psi;
+        target_row->gpm = (float)cell->gpm;
+        target_row->data_valid = 1; // Mark data as successfully populated for this row
 
-        // Reset the entire display table to a known zero state first.
-        for (int i = 0; i < BLYNK_TABLE_ROW_COUNT; i++) {
-            memset(&blynk_display_table[i], 0, sizeof(BlynkDataRow));
+        if (verbose) {
+            printf("%s: Populated Blynk Table Row %d (from C:%d, Z:%d, DispZ:%d): Flow=%.2f, Mins=%.2f, PSI=%.2f, GPM=%.2f\n",
+                   device->config_file, display_row_index, source->controller, source->zone,
+                   target_row->zone_number, target_row->total_flow, target_row->total_minutes,
+                   target_row->avg_psi, target_row->gpm);
         }
 
-        int display_row_index = 0; // Use a separate index for the display table
+        display_row_index++; // IMPORTANT: only increment when a row is actually added
+    }
+}
 
-        // Iterate through the 31 mapped rows and populate blynk_display_table
-        for (int i = 0; i < BLYNK_TABLE_ROW_COUNT && display_row_index < BLYNK_PROTOTYPE_ROW_LIMIT; i++) {
-            const ControllerZoneSource* source = &json_to_blynk_map[i];
-            
-            // Check if this controller is in our filter list
-            int controller_num = atoi(source->controller_json_key);
-            int zone_num = atoi(source->zone_json_key);
-            int controller_allowed = 0;
-            int zone_allowed = 0;
+// Queues the batch built in blynk_batch on 'device's own sender
+static void queue_device_batch(BlynkDevice* device, uint32_t request_id)
+{
+    const Config* config = &device->config;
+    int payload_len;
+    const char *payload_str = batch_payload_end(&blynk_batch, &payload_len);
 
-            // Check if controller is in filter list
-            for (int j = 0; j < config->data_filter.controllers_count; j++) {
-                if (config->data_filter.controllers[j] == controller_num) {
-                    controller_allowed = 1;
-                    break;
-                }
-            }
+    if (verbose) {
+        printf("%s: Queueing for Blynk topic '%s': %s\n", device->config_file, config->blynk.topic, payload_str);
+    }
+    // The sender thread paces and publishes it; this callback must not block
+    int rc = publish_queue_push(&device->queue, config->blynk.topic, payload_str, payload_len, request_id);
+    if (rc != 0) {
+        // Either way the cache now claims values Blynk will never get
+        delta_cache_request_full(&device->delta);
+    }
+    if (rc < 0) {
+        fprintf(stderr, "%s: Failed to queue batch data for Blynk topic %s\n", device->config_file, config->blynk.topic);
+    } else if (request_id != 0) {
+        latency_trace_queued(&request_latency, request_id);
+    }
+}
 
-            // Check if zone is in filter list
-            for (int j = 0; j < config->data_filter.zones_count; j++) {
-                if (config->data_filter.zones[j] == zone_num) {
-                    zone_allowed = 1;
-                    break;
-                }
-            }
+// Queues 'device's changed datastreams as batch_ds messages on its own sender
+static void send_device_table(BlynkDevice* device, uint32_t request_id)
+{
+    if (delta_cache_begin(&device->delta, time(NULL)) && verbose) {
+        printf("%s: Full refresh of Blynk datastreams.\n", device->config_file);
+    }
+    int total_rows_to_process = device->row_count;
+    int row_index = 0;
 
-            // Skip if either controller or zone is not in filter list
-            if (!controller_allowed || !zone_allowed) {
-                continue;
-            }
+    while (row_index < total_rows_to_process) {
+        int items_added_to_this_payload = 0;
 
-            // If we are here, the source is allowed. We will populate display_row_index.
-            BlynkDataRow* target_row = &blynk_display_table[display_row_index];
+        batch_payload_begin(&blynk_batch, &blynk_batch_keys, BLYNK_VALUE_DECIMALS);
 
-            json_object *controller_obj;
-            if (!json_object_object_get_ex(details_obj, source->controller_json_key, &controller_obj) || 
-                json_object_get_type(controller_obj) != json_type_object) {
-                // This might be verbose, but useful for debugging config vs. data issues
-                if (verbose) fprintf(stdout, "Data for allowed source C:%s not present in received JSON. Skipping.\n", source->controller_json_key);
-                continue;
+        // Inner loop: build one batch payload with up to BLYNK_BATCH_ROW_LIMIT changed rows
+        for (int batch_item_count = 0; batch_item_count < BLYNK_BATCH_ROW_LIMIT && row_index < total_rows_to_process; row_index++) {
+            if (device->table[row_index].data_valid &&
+                add_changed_datastreams(device, &blynk_batch, row_index, &device->table[row_index]) > 0) {
+                items_added_to_this_payload++;
+                batch_item_count++; // Increment count of items in this specific batch
             }
+        }
 
-            json_object *zone_obj;
-            if (!json_object_object_get_ex(controller_obj, source->zone_json_key, &zone_obj) || 
-                json_object_get_type(zone_obj) != json_type_object) {
-                if (verbose) fprintf(stdout, "Data for allowed source C:%s Z:%s not present in received JSON. Skipping.\n", 
-                        source->controller_json_key, source->zone_json_key);
-                continue;
-            }
+        if (items_added_to_this_payload > 0) {
+            queue_device_batch(device, request_id);
+        }
+    }
+}
 
-            // Pre-set the zone number for display from the map
-            target_row->zone_number = source->display_zone_number;
+// Keeps the datastreams of 'device's table in its offline store, replacing
+// whatever they held from earlier updates
+static void stash_device_table(BlynkDevice* device)
+{
+    for (int row_index = 0; row_index < device->row_count; row_index++) {
+        const BlynkDataRow* row = &device->table[row_index];
+        if (!row->data_valid) {
+            continue;
+        }
+        const double values[BLYNK_PINS_PER_ROW] = {
+            row->zone_number, row->total_flow, row->total_minutes, row->avg_psi, row->gpm
+        };
+        for (int k = 0; k < BLYNK_PINS_PER_ROW; k++) {
+            offline_store_put(&device->offline, row_index * BLYNK_PINS_PER_ROW + k + 1, values[k]);
+        }
+    }
+}
 
-            // Extract data fields from the zone_obj
-            json_object *temp_obj;
-            double total_flow = 0.0, total_seconds = 0.0, avg_psi = 0.0, gpm = 0.0;
+// Delta cache slot of row 'row_index's summary flow, past the datastream pins
+static int summary_slot(const BlynkDevice* device, int row_index)
+{
+    return device->row_count * BLYNK_PINS_PER_ROW + 1 + row_index;
+}
 
-            if (json_object_object_get_ex(zone_obj, "totalFlow", &temp_obj) && json_object_get_type(temp_obj) == json_type_double) {
-                total_flow = json_object_get_double(temp_obj);
-            }
-            if (json_object_object_get_ex(zone_obj, "totalSeconds", &temp_obj) && json_object_get_type(temp_obj) == json_type_double) {
-                total_seconds = json_object_get_double(temp_obj);
-            }
-            if (json_object_object_get_ex(zone_obj, "avgPSI", &temp_obj) && json_object_get_type(temp_obj) == json_type_double) {
-                avg_psi = json_object_get_double(temp_obj);
-            }
-            if (json_object_object_get_ex(zone_obj, "gpm", &temp_obj) && json_object_get_type(temp_obj) == json_type_double) {
-                gpm = json_object_get_double(temp_obj);
-            }
+// Appends 'text' to 'out' as a JSON string. Returns the new length, or -1 if
+// it did not fit.
+static int append_json_string(char* out, int len, int size, const char* text)
+{
+    if (len + 1 >= size) {
+        return -1;
+    }
+    out[len++] = '"';
+    for (const unsigned char* c = (const unsigned char*)text; *c != '\0'; c++) {
+        int n = (*c == '"' || *c == '\\') ? snprintf(out + len, size - len, "\\%c", *c)
+              : (*c < 0x20)               ? snprintf(out + len, size - len, "\\u%04x", *c)
+                                          : snprintf(out + len, size - len, "%c", *c);
+        if (n < 0 || n >= size - len) {
+            return -1;
+        }
+        len += n;
+    }
+    if (len + 1 >= size) {
+        return -1;
+    }
+    out[len++] = '"';
+    out[len] = '\0';
+    return len;
+}
 
-            target_row->total_flow = (float)total_flow;
-            target_row->total_minutes = (total_seconds > 0) ? (float)(total_seconds / 60.0) : 0.0f;
-            target_row->avg_psi = (float)avg_psi;
-            target_row->gpm = (float)gpm;
-            target_row->data_valid = 1; // Mark data as successfully populated for this row
-   
-            if (verbose) {
-                printf("Populated Blynk Table Row %d (from C:%s, Z:%s, DispZ:%d): Flow=%.2f, Mins=%.2f, PSI=%.2f, GPM=%.2f\n",
-                       display_row_index, source->controller_json_key, source->zone_json_key, target_row->zone_number,
-                       target_row->total_flow, target_row->total_minutes, target_row->avg_psi, target_row->gpm);
-            }
+// Formats the part of 'device's flow summary that never changes
+static int build_summary_prefix(BlynkDevice* device)
+{
+    char* out = device->summary_prefix;
+    int size = sizeof(device->summary_prefix);
+    int len = snprintf(out, size, "{\"template_id\":");
+
+    len = append_json_string(out, len, size, device->config.blynk.template_id);
+    if (len >= 0 && len + (int)sizeof(",\"device_name\":") <= size) {
+        len += snprintf(out + len, size - len, ",\"device_name\":");
+        len = append_json_string(out, len, size, device->config.blynk.device_name);
+    } else {
+        len = -1;
+    }
+    if (len >= 0 && len + (int)sizeof(",\"data\":[") <= size) {
+        len += snprintf(out + len, size - len, ",\"data\":[");
+    } else {
+        len = -1;
+    }
+    if (len < 0) {
+        fprintf(stderr, "%s: Blynk template_id and device_name are too long\n", device->config_file);
+        return -1;
+    }
+    device->summary_prefix_len = len;
+    return 0;
+}
+
+// Queues one summary message of 'len' bytes from 'payload'
+static void queue_summary(BlynkDevice* device, char* payload, int len, uint32_t request_id)
+{
+    int rc;
 
-            display_row_index++; // IMPORTANT: only increment when a row is actually added
+    memcpy(payload + len, "]}", 3);
+    len += 2;
+    if (verbose) {
+        printf("%s: Queueing flow summary for Blynk topic '%s': %s\n", device->config_file, device->config.blynk.topic, payload);
+    }
+    // Queued behind any table batches so the rate limit covers both
+    rc = publish_queue_push(&device->queue, device->config.blynk.topic, payload, len, request_id);
+    if (rc != 0) {
+        delta_cache_request_full(&device->delta); // Either way the cache claims flows Blynk never got
+    }
+    if (rc < 0) {
+        fprintf(stderr, "%s: Failed to queue Blynk flow summary\n", device->config_file);
+    } else if (request_id != 0) {
+        latency_trace_queued(&request_latency, request_id);
+    }
+}
+
+// Queues the total flow of each of 'device's rows that changed, on pin
+// base_offset + row, as {"template_id":..,"device_name":..,"data":[{"pin":..,
+// "value":..},..]}. Rows are split across as many messages as it takes to
+// keep each within a publish queue slot. Call after delta_cache_begin().
+static void send_flow_summary(BlynkDevice* device, uint32_t request_id)
+{
+    char payload[PUBLISH_QUEUE_PAYLOAD_MAX];
+    char item[64];
+    int len = device->summary_prefix_len;
+    int rows = 0;
+
+    memcpy(payload, device->summary_prefix, len);
+    for (int row_index = 0; row_index < device->row_count; row_index++) {
+        const BlynkDataRow* row = &device->table[row_index];
+        int item_len;
+
+        if (!row->data_valid || !isfinite(row->total_flow) ||
+            !delta_cache_update(&device->delta, summary_slot(device, row_index), row->total_flow)) {
+            continue;
+        }
+        // 4 significant digits, as json-c was set to print the summary
+        item_len = snprintf(item, sizeof(item), "%s{\"pin\":%d,\"value\":%.4g}", rows > 0 ? "," : "",
+                            device->config.pin_config.base_offset + row_index, row->total_flow);
+        // Room for the closing "]}" and NUL
+        if (rows > 0 && len + item_len + 3 > (int)sizeof(payload)) {
+            queue_summary(device, payload, len, request_id);
+            len = device->summary_prefix_len;
+            rows = 0;
+            item_len = snprintf(item, sizeof(item), "{\"pin\":%d,\"value\":%.4g}",
+                                device->config.pin_config.base_offset + row_index, row->total_flow);
         }
+        memcpy(payload + len, item, item_len);
+        len += item_len;
+        rows++;
+    }
+    if (rows > 0) {
+        queue_summary(device, payload, len, request_id);
+    }
+}
 
-        json_object_put(parsed_json); // Free the root json object
-        printf("Finished processing watertable JSON data.\n");
+// Queues what piled up in 'device's offline store, the newest value of each
+// datastream once, in batches of BLYNK_BATCH_ROW_LIMIT rows' worth so the
+// sender's rate limit spreads them out. A full refresh that is due sends the
+// current table along with them. Call with fan_out_lock and table_lock held.
+static void flush_offline_store(BlynkDevice* device, uint32_t request_id)
+{
+    double value;
+    int pin = 0;
 
-        // Now, send data from blynk_display_table to Blynk using batch_ds via a loop
-        if (blynkClient_initialized_and_connected && blynkClient != NULL) {
-            int total_rows_to_process = (BLYNK_PROTOTYPE_ROW_LIMIT < BLYNK_TABLE_ROW_COUNT) ? BLYNK_PROTOTYPE_ROW_LIMIT : BLYNK_TABLE_ROW_COUNT;
-            int row_index = 0;
-            
-            while (row_index < total_rows_to_process) {
-                json_object *blynk_payload_obj = json_object_new_object();
-                if (blynk_payload_obj == NULL) {
-                    fprintf(stderr, "Failed to create JSON object for Blynk batch_ds payload.\n");
-                    break; // Exit the sending loop
+    if (delta_cache_begin(&device->delta, time(NULL))) {
+        if (verbose) printf("%s: Full refresh of Blynk datastreams.\n", device->config_file);
+        stash_device_table(device);
+    }
+    if (offline_store_count(&device->offline) > 0) {
+        printf("%s: Sending %d datastreams held while Blynk was unreachable.\n",
+               device->config_file, offline_store_count(&device->offline));
+    }
+    while (pin >= 0) {
+        int items_added_to_this_payload = 0;
+
+        batch_payload_begin(&blynk_batch, &blynk_batch_keys, BLYNK_VALUE_DECIMALS);
+        while (items_added_to_this_payload < BLYNK_BATCH_ROW_LIMIT * BLYNK_PINS_PER_ROW &&
+               (pin = offline_store_take(&device->offline, pin, &value)) >= 0) {
+            if (delta_cache_update(&device->delta, pin, value)) {
+                int rc = ((pin - 1) % BLYNK_PINS_PER_ROW == 0) ? batch_payload_add_int(&blynk_batch, pin, (int)value)
+                                                              : batch_payload_add_number(&blynk_batch, pin, value);
+                if (rc != 0) {
+                    delta_cache_request_full(&device->delta); // Recorded as sent but left out
+                } else {
+                    items_added_to_this_payload++;
                 }
+            }
+            pin++;
+        }
+        if (items_added_to_this_payload > 0) {
+            queue_device_batch(device, request_id);
+        }
+    }
+    if (device->sent_generation != device->generation) {
+        send_flow_summary(device, request_id);
+        device->sent_generation = device->generation;
+    }
+}
 
-                int items_added_to_this_payload = 0;
-                char ds_name_buffer[16];
-
-                // Inner loop: build one batch payload with up to BLYNK_BATCH_ROW_LIMIT valid rows
-                for (int batch_item_count = 0; batch_item_count < BLYNK_BATCH_ROW_LIMIT && row_index < total_rows_to_process; row_index++) {
-                    if (blynk_display_table[row_index].data_valid) {
-                        // Zone
-                        snprintf(ds_name_buffer, sizeof(ds_name_buffer), "V%dzone", row_index * 5 + 1);
-                        json_object_object_add(blynk_payload_obj, ds_name_buffer, json_object_new_int(blynk_display_table[row_index].zone_number));
-                        // Flow
-                        snprintf(ds_name_buffer, sizeof(ds_name_buffer), "V%dflow", row_index * 5 + 2);
-                        json_object_object_add(blynk_payload_obj, ds_name_buffer, json_object_new_double(blynk_display_table[row_index].total_flow));
-                        // Minutes
-                        snprintf(ds_name_buffer, sizeof(ds_name_buffer), "V%dmin", row_index * 5 + 3);
-                        json_object_object_add(blynk_payload_obj, ds_name_buffer, json_object_new_double(blynk_display_table[row_index].total_minutes));
-                        // PSI
-                        snprintf(ds_name_buffer, sizeof(ds_name_buffer), "V%dpsi", row_index * 5 + 4);
-                        json_object_object_add(blynk_payload_obj, ds_name_buffer, json_object_new_double(blynk_display_table[row_index].avg_psi));
-                        // GPM
-                        snprintf(ds_name_buffer, sizeof(ds_name_buffer), "V%dgpm", row_index * 5 + 5);
-                        json_object_object_add(blynk_payload_obj, ds_name_buffer, json_object_new_double(blynk_display_table[row_index].gpm));
-                        
-                        items_added_to_this_payload++;
-                        batch_item_count++; // Increment count of items in this specific batch
-                    }
-                }
+static void publish_device_table(BlynkDevice* device, uint32_t request_id);
 
-                if (items_added_to_this_payload > 0) {
-                    const char *json_payload_str = json_object_to_json_string_ext(blynk_payload_obj, JSON_C_TO_STRING_PLAIN);
-                    if (json_payload_str == NULL) {
-                        fprintf(stderr, "Failed to convert Blynk batch_ds payload to JSON string.\n");
-                    } else {
-                        MQTTClient_message pubmsg = MQTTClient_message_initializer;
-                        MQTTClient_deliveryToken token;
-                        pubmsg.payload = (void*)json_payload_str;
-                        pubmsg.payloadlen = strlen(json_payload_str);
-                        pubmsg.qos = QOS;
-                        pubmsg.retained = 0;
-
-                        if (verbose) {
-                            printf("Publishing to Blynk topic '%s': %s\n", config->blynk.topic, json_payload_str);
-                        }
-                        int rc_blynk_pub = MQTTClient_publishMessage(blynkClient, config->blynk.topic, &pubmsg, &token);
-
-                        if (rc_blynk_pub != MQTTCLIENT_SUCCESS) {
-                            fprintf(stderr, "Failed to publish batch data to Blynk topic %s, rc %d\n", config->blynk.topic, rc_blynk_pub);
-                        } else {
-                            printf("Successfully published batch data to Blynk. Length: %d, Token: %d\n", pubmsg.payloadlen, token);
-                        }
-                    }
-                }
-                
-                json_object_put(blynk_payload_obj); // Free the payload object for this batch
+// Held while a set of cells is fanned out, since live results and cached
+// replays arrive on different threads and share blynk_batch
+static pthread_mutex_t fan_out_lock = PTHREAD_MUTEX_INITIALIZER;
 
-                // If there are more rows to process, add a small delay to avoid flooding the Blynk server
-                if (row_index < total_rows_to_process && items_added_to_this_payload > 0) {
-                    usleep(250000); // 250ms delay
-                }
+// Each device applies its own filter to the shared cells, then queues what
+// changed. Nothing is sent again until the next cells arrive. Batches are
+// tagged with 'request_id' when the cells answer a traced query, else 0.
+static void fan_out_cells(const WatertableCell* cells, uint32_t request_id)
+{
+    pthread_mutex_lock(&fan_out_lock);
+    for (int d = 0; d < blynk_device_count; d++) {
+        BlynkDevice* device = &blynk_devices[d];
+
+        pthread_mutex_lock(&device->table_lock);
+        fill_device_table(device, cells);
+        device->generation++;
+        if (!device->connected) {
+            // Only the newest value of each datastream is kept for the reconnect
+            stash_device_table(device);
+            printf("%s: Blynk client not connected. %d datastreams held until it reconnects.\n",
+                   device->config_file, offline_store_count(&device->offline));
+        } else if (offline_store_count(&device->offline) > 0) {
+            // Reconnected, but the held values have not gone out yet; these supersede them
+            stash_device_table(device);
+            flush_offline_store(device, request_id);
+        } else {
+            publish_device_table(device, request_id);
+        }
+        pthread_mutex_unlock(&device->table_lock);
+    }
+    pthread_mutex_unlock(&fan_out_lock);
+}
+
+int msgarrvd(void *context, char *topicName, int topicLen, MQTTClient_message *message)
+{
+    // Check if the message is for the blynkLog functionality (time window selection from Blynk)
+    // This function is the callback for the *main client* that connects to the local broker.
+    // The blynk_msgarrvd is for each device's Blynk client.
+    // For now, this main client's msgarrvd will handle the incoming JSON for the table.
+
+    int64_t arrived_us = latency_trace_now_us();
+
+    printf("Main client message arrived on topic: %s\n", topicName);
+
+    // Check if this is the message from mwp_data_service with the watertable, JSON or binary
+    int binary = strcmp(topicName, MWP_WATERTABLE_BINARY_TOPIC) == 0;
+    if (binary || strcmp(topicName, MWP_WATERTABLE_JSON_TOPIC) == 0)
+    {
+        // Results of a query the user has since moved past would only flash
+        // stale numbers on the dashboards before the right ones arrive. They
+        // are still worth caching when we know which window they are for.
+        // Pull just the mapped cells out of the payload in place, once for all
+        // devices. The payload is not NUL terminated, watertable_extract()
+        // works from its length. The request ID it echoes tells which query
+        // it answers.
+        WatertableCell cells[watertable_cell_count];
+        WatertableTrace echo;
+        if ((binary ? watertable_extract_binary(message->payload, message->payloadlen, &watertable_index,
+                                                cells, watertable_cell_count, &echo)
+                    : watertable_extract_traced(message->payload, message->payloadlen, &watertable_index,
+                                                cells, watertable_cell_count, &echo)) != 0)
+        {
+            fprintf(stderr, "Failed to parse watertable %s payload\n", binary ? "binary" : "JSON");
+            MQTTClient_freeMessage(&message);
+            MQTTClient_free(topicName);
+            return 1;
+        }
+        int64_t parsed_us = latency_trace_now_us();
+
+        char range[WINDOW_CACHE_RANGE_MAX];
+        int accepted = query_debouncer_accept_result(&time_window_debouncer, echo.request_id, range, sizeof(range));
+        if (!accepted && range[0] == '\0') {
+            printf("Dropping watertable JSON data for a superseded time window query.\n");
+            MQTTClient_freeMessage(&message);
+            MQTTClient_free(topicName);
+            return 1;
+        }
+
+        printf("Received watertable %s data%s%s. Processing...\n", binary ? "binary" : "JSON", range[0] ? " for " : "", range);
+
+        if (range[0] != '\0') {
+            window_cache_store(&time_window_cache, range, time(NULL), cells);
+        }
+        if (accepted) {
+            uint32_t request_id = latency_trace_result(&request_latency, &echo, arrived_us, parsed_us) ? echo.request_id : 0;
+            fan_out_cells(cells, request_id);
+            if (request_id != 0) {
+                latency_trace_fanned_out(&request_latency, request_id);
             }
         } else {
-            printf("Blynk client not connected. Cannot send batch data to Blynk.\n");
+            printf("Cached, but not shown: the %s query has been superseded.\n", range);
         }
 
+        printf("Finished processing watertable JSON data.\n");
+
     } else {
         // Existing logic for other messages on the main client (if any)
         // For now, assume this callback was primarily for the local broker interactions if needed,
@@ -398,27 +676,30 @@ void connlost(void *context, char *cause)
    // If it's crucial for this client to also trigger a global flag for reconnection by main,
    // a similar mechanism to blynkClient_connected_flag could be implemented.
    // For now, its loss is handled as per original logic (program might exit or try to proceed).
-   connection_lost_flag = 1; // Signal main loop about connection loss
+   reconnect_lost(&main_reconnect, reconnect_now_us());
+   wake_reconnect_thread();
 }
 
-// New connection lost callback for blynkClient
+// New connection lost callback for each device's Blynk client
 void blynk_connlost(void *context, char *cause)
 {
-   MQTTClient *blynk_client_handle_ptr = (MQTTClient*)context;
-   printf("\nBlynk Connection lost\n");
+   BlynkDevice *device = (BlynkDevice*)context;
+   printf("\nBlynk Connection lost (%s)\n", device->config_file);
    printf("     cause: %s\n", cause);
-   // Log a more specific message if possible, perhaps including the client ID if context allows differentiation
    //log_message("BlynkW: Connection lost. Cause: %s", cause);
-   blynkClient_initialized_and_connected = 0; // Update the global flag
-   // Note: We do not destroy or recreate the client handle here.
-   // The main loop's reconnection logic will use initialize_blynk_client() 
-   // which can attempt to recreate if the handle is NULL or use the existing one.
+   device->connected = 0;
+   // The handle is kept; the reconnect thread connects it again
+   reconnect_lost(&device->reconnect, reconnect_now_us());
+   wake_reconnect_thread();
 }
 
-// New message arrived callback for blynkClient
+// New message arrived callback for each device's Blynk client. Whichever
+// device picks a time window, the results are fanned out to all of them.
 int blynk_msgarrvd(void *context, char *topicName, int topicLen, MQTTClient_message *message)
 {
-    printf("Blynk message arrived:\n");
+    BlynkDevice *device = (BlynkDevice*)context;
+
+    printf("Blynk message arrived (%s):\n", device->config_file);
     printf("          topic: %s\n", topicName);
     // printf("         length: %d\n", topicLen); // topicLen is for topicName, not payload
     printf("     PayloadLen: %d\n", message->payloadlen);
@@ -449,32 +730,25 @@ int blynk_msgarrvd(void *context, char *topicName, int topicLen, MQTTClient_mess
             }
 
             if (selected_time_window) {
-                if (client != NULL && MQTTClient_isConnected(client)) {
-                    char json_payload[128]; // Sufficient for {"range": "somestring"}
-                    snprintf(json_payload, sizeof(json_payload), "{\"range\": \"%s\"}", selected_time_window);
-
-                    printf("Blynk selected value: %d -> %s. Publishing to mwp_data_service: %s\n", 
-                           blynk_value, selected_time_window, json_payload);
-                    
-                    MQTTClient_message pubmsg = MQTTClient_message_initializer;
-                    MQTTClient_deliveryToken token;
-                    pubmsg.payload = json_payload;
-                    pubmsg.payloadlen = strlen(json_payload);
-                    pubmsg.qos = QOS; // Assuming QOS is defined (it is)
-                    pubmsg.retained = 0;
-                    
-                    int rc = MQTTClient_publishMessage(client, MWP_DATA_SERVICE_QUERY_TOPIC, &pubmsg, &token);
-                    if (rc != MQTTCLIENT_SUCCESS) {
-                        fprintf(stderr, "Blynk_msgarrvd: Failed to publish to %s, rc %d\n", MWP_DATA_SERVICE_QUERY_TOPIC, rc);
-                        // log_message("BlynkW: Error == Failed to publish to mwp_data_service. RC: %d\n", rc);
-                    } else {
-                        printf("Blynk_msgarrvd: Successfully published to %s, token %d. Waiting for completion...\n", MWP_DATA_SERVICE_QUERY_TOPIC, token);
-                        // Optional: Wait for completion, but be mindful of blocking the callback
-                        // MQTTClient_waitForCompletion(client, token, TIMEOUT/2); // Shorter timeout than main publish
-                    }
+                latency_trace_selected(&request_latency);
+
+                // Show what is cached for the window right away; only a stale
+                // or missing entry needs mwp_data_service
+                WatertableCell cached[watertable_cell_count];
+                WindowCacheState state = window_cache_lookup(&time_window_cache, selected_time_window, time(NULL), cached);
+                if (state != WINDOW_CACHE_MISS) {
+                    printf("Blynk selected value: %d -> %s. Publishing %s cached results.\n",
+                           blynk_value, selected_time_window, state == WINDOW_CACHE_FRESH ? "fresh" : "stale");
+                    fan_out_cells(cached, 0);
+                }
+                if (state == WINDOW_CACHE_FRESH) {
+                    query_debouncer_settle(&time_window_debouncer);
                 } else {
-                    fprintf(stderr, "Blynk_msgarrvd: Main MQTT client (for mwp_data_service) is not connected. Cannot publish.\n");
-                    // log_message("BlynkW: Main MQTT client not connected. Cannot send time window.");
+                    // Scrolling the menu sends every value on the way; only the one
+                    // the user settles on is queried
+                    printf("Blynk selected value: %d -> %s. Query to mwp_data_service after %d ms without changes.\n",
+                           blynk_value, selected_time_window, time_window_debouncer.config.debounce_ms);
+                    query_debouncer_select(&time_window_debouncer, selected_time_window);
                 }
             } else {
                 fprintf(stderr, "Blynk_msgarrvd: Unknown Blynk value received: %d. No time window mapped.\n", blynk_value);
@@ -488,104 +762,139 @@ int blynk_msgarrvd(void *context, char *topicName, int topicLen, MQTTClient_mess
     return 1; // Indicate success to the library
 }
 
-int send_blynk_data(MQTTClient blynkClient, Config* config) {
-    char topic[100];
-    json_object *batch_obj = json_object_new_object();
-    json_object *data_array = json_object_new_array();
-    int rc;
-
-    // Add metadata
-    json_object_object_add(batch_obj, "template_id", json_object_new_string(config->blynk.template_id));
-    json_object_object_add(batch_obj, "device_name", json_object_new_string(config->blynk.device_name));
+// QuerySendFn for the TimeWindow debouncer: asks mwp_data_service for 'range',
+// in the encoding the Config passed as 'context' selects. Runs on the debouncer thread.
+static int send_time_window_query(void *context, const char *range, uint32_t request_id)
+{
+    const Config *config = (const Config*)context;
 
-    // Add data rows
-    for (int i = 0; i < BLYNK_TABLE_ROW_COUNT; i++) {
-        BlynkDataRow* row = &blynk_display_table[i];
-        if (row->data_valid) {
-            json_object *row_obj = json_object_new_object();
-            
-            // Calculate pin number using base offset
-            int pin_number = config->pin_config.base_offset + i;
-            
-            json_object_object_add(row_obj, "pin", json_object_new_int(pin_number));
-            json_object_object_add(row_obj, "value", json_object_new_double(row->total_flow));
-            json_object_array_add(data_array, row_obj);
-        }
+    if (client == NULL || !MQTTClient_isConnected(client)) {
+        fprintf(stderr, "Blynk_msgarrvd: Main MQTT client (for mwp_data_service) is not connected. Cannot publish.\n");
+        // log_message("BlynkW: Main MQTT client not connected. Cannot send time window.");
+        return -1;
     }
 
-    json_object_object_add(batch_obj, "data", data_array);
+    char json_payload[160]; // Sufficient for {"range": "somestring", "requestId": 4294967295, "encoding": "binary"}
+    snprintf(json_payload, sizeof(json_payload), "{\"range\": \"%s\", \"requestId\": %u, \"encoding\": \"%s\"}",
+             range, request_id, config->binary_results ? "binary" : "json");
+    printf("Publishing to mwp_data_service: %s\n", json_payload);
 
-    // Send the batch
-    snprintf(topic, sizeof(topic), "%s", config->blynk.topic);
-    const char *payload = json_object_to_json_string(batch_obj);
-    
     MQTTClient_message pubmsg = MQTTClient_message_initializer;
-    pubmsg.payload = (void*)payload;
-    pubmsg.payloadlen = strlen(payload);
-    pubmsg.qos = QOS;
+    MQTTClient_deliveryToken token;
+    pubmsg.payload = json_payload;
+    pubmsg.payloadlen = strlen(json_payload);
+    pubmsg.qos = QOS; // Assuming QOS is defined (it is)
     pubmsg.retained = 0;
 
-    MQTTClient_deliveryToken token;
-    if ((rc = MQTTClient_publishMessage(blynkClient, topic, &pubmsg, &token)) != MQTTCLIENT_SUCCESS) {
-        fprintf(stderr, "Failed to publish Blynk data, return code %d\n", rc);
-        json_object_put(batch_obj);
-        return rc;
+    int rc = MQTTClient_publishMessage(client, MWP_DATA_SERVICE_QUERY_TOPIC, &pubmsg, &token);
+    if (rc != MQTTCLIENT_SUCCESS) {
+        fprintf(stderr, "Blynk_msgarrvd: Failed to publish to %s, rc %d\n", MWP_DATA_SERVICE_QUERY_TOPIC, rc);
+        // log_message("BlynkW: Error == Failed to publish to mwp_data_service. RC: %d\n", rc);
+        return -1;
     }
+    printf("Blynk_msgarrvd: Successfully published to %s, token %d.\n", MWP_DATA_SERVICE_QUERY_TOPIC, token);
+    latency_trace_sent(&request_latency, request_id);
+    return 0;
+}
 
-    // Wait for delivery
-    rc = MQTTClient_waitForCompletion(blynkClient, token, TIMEOUT);
-    if (rc != MQTTCLIENT_SUCCESS) {
-        fprintf(stderr, "Failed to deliver Blynk data, return code %d\n", rc);
-        json_object_put(batch_obj);
-        return rc;
+// PublishFn for a device's publish queue: hands one message to its Blynk
+// client. Runs on the sender thread, so the client is only touched under its lock.
+// A non-zero 'tag' is the traced query request the message belongs to.
+static PublishResult blynk_publish(void *context, const char *topic, const void *payload, int len, uint32_t tag)
+{
+    BlynkDevice *device = (BlynkDevice*)context;
+    MQTTClient_message pubmsg = MQTTClient_message_initializer;
+    MQTTClient_deliveryToken token;
+    int rc;
+
+    pthread_mutex_lock(&device->lock);
+    if (!device->connected || device->client == NULL) {
+        pthread_mutex_unlock(&device->lock);
+        return PUBLISH_RETRY;
     }
+    pubmsg.payload = (void*)payload;
+    pubmsg.payloadlen = len;
+    pubmsg.qos = QOS;
+    pubmsg.retained = 0;
 
-    json_object_put(batch_obj);
-    return MQTTCLIENT_SUCCESS;
-}
+    // Callbacks are set on the client, so this returns once the message is
+    // written; delivery is confirmed through delivered()
+    rc = MQTTClient_publishMessage(device->client, topic, &pubmsg, &token);
+    pthread_mutex_unlock(&device->lock);
 
-int loop(MQTTClient blynkClient, Config* config) {
-    // Send data to Blynk
-    if (blynkClient_initialized_and_connected) {
-        if (send_blynk_data(blynkClient, config) != MQTTCLIENT_SUCCESS) {
-            fprintf(stderr, "Failed to send data to Blynk\n");
-            blynkClient_initialized_and_connected = 0;
+    if (rc != MQTTCLIENT_SUCCESS) {
+        fprintf(stderr, "%s: Failed to publish to Blynk topic %s, rc %d\n", device->config_file, topic, rc);
+        delta_cache_request_full(&device->delta); // Its values are recorded as sent
+        device->connected = 0;
+        reconnect_lost(&device->reconnect, reconnect_now_us());
+        wake_reconnect_thread();
+        if (tag != 0) {
+            latency_trace_published(&request_latency, tag); // Not coming back, so stop waiting for it
         }
+        return PUBLISH_FAILED;
+    }
+    if (verbose) {
+        printf("%s: Published to Blynk topic '%s'. Length: %d, Token: %d\n", device->config_file, topic, len, token);
+    }
+    if (tag != 0) {
+        latency_trace_published(&request_latency, tag);
     }
+    return PUBLISH_OK;
+}
 
-    return 0; // Success for this loop iteration
+// Queues 'device's table if it has been refilled since it was last queued.
+// Called from msgarrvd() on new data, and from the main loop to catch up
+// after a reconnect. Call with device->table_lock held.
+static void publish_device_table(BlynkDevice* device, uint32_t request_id)
+{
+    if (device->sent_generation == device->generation || !device->connected || device->client == NULL) {
+        return;
+    }
+    send_device_table(device, request_id);
+    send_flow_summary(device, request_id);
+    device->sent_generation = device->generation;
 }
 
-// New function to initialize and connect the Blynk MQTT client
-int initialize_blynk_client(MQTTClient* blynk_client_handle_ptr, Config* config) {
+// Connects a device's Blynk MQTT client, creating the handle the first time.
+// Paho lets a disconnected handle connect again, so it is kept across
+// outages. Call with device->lock held.
+int initialize_blynk_client(BlynkDevice* device) {
+    MQTTClient* blynk_client_handle_ptr = &device->client;
+    Config* config = &device->config;
     MQTTClient_connectOptions conn_opts = MQTTClient_connectOptions_initializer;
     int rc;
     char blynk_address[256];
 
-    // Format the Blynk MQTT address with the correct scheme
-    snprintf(blynk_address, sizeof(blynk_address), "tcp://%s", config->blynk.address);
+    if (*blynk_client_handle_ptr == NULL) {
+        // Format the Blynk MQTT address with the correct scheme
+        snprintf(blynk_address, sizeof(blynk_address), "tcp://%s", config->blynk.address);
+
+        // Create the client
+        rc = MQTTClient_create(blynk_client_handle_ptr, blynk_address, config->blynk.client_id,
+            MQTTCLIENT_PERSISTENCE_NONE, NULL);
+        if (rc != MQTTCLIENT_SUCCESS) {
+            fprintf(stderr, "%s: Failed to create Blynk client, return code %d\n", device->config_file, rc);
+            *blynk_client_handle_ptr = NULL;
+            return rc;
+        }
 
-    // Create the client
-    rc = MQTTClient_create(blynk_client_handle_ptr, blynk_address, config->blynk.client_id,
-        MQTTCLIENT_PERSISTENCE_NONE, NULL);
-    if (rc != MQTTCLIENT_SUCCESS) {
-        fprintf(stderr, "Failed to create Blynk client, return code %d\n", rc);
-        return rc;
+        // Set callbacks
+        MQTTClient_setCallbacks(*blynk_client_handle_ptr, device, blynk_connlost, blynk_msgarrvd, delivered);
+    } else if (MQTTClient_isConnected(*blynk_client_handle_ptr)) {
+        // A failed publish marks the device down before Paho notices
+        MQTTClient_disconnect(*blynk_client_handle_ptr, 0);
     }
 
     // Set up the connection options
     conn_opts.keepAliveInterval = 20;
     conn_opts.cleansession = 1;
+    conn_opts.connectTimeout = CONNECT_TIMEOUT_SECONDS;
     conn_opts.username = config->blynk.device_name;
     conn_opts.password = config->blynk.auth_token;  // Use auth token instead of template ID
 
-    // Set callbacks
-    MQTTClient_setCallbacks(*blynk_client_handle_ptr, config, blynk_connlost, blynk_msgarrvd, delivered);
-
     // Connect to the server
     if ((rc = MQTTClient_connect(*blynk_client_handle_ptr, &conn_opts)) != MQTTCLIENT_SUCCESS) {
-        fprintf(stderr, "Failed to connect to Blynk server, return code %d\n", rc);
-        MQTTClient_destroy(blynk_client_handle_ptr);
+        fprintf(stderr, "%s: Failed to connect to Blynk server, return code %d\n", device->config_file, rc);
         return rc;
     }
 
@@ -593,29 +902,413 @@ int initialize_blynk_client(MQTTClient* blynk_client_handle_ptr, Config* config)
     char topic[100];
     snprintf(topic, sizeof(topic), BLYNK_TIMEWINDOW_DOWNLINK_DS_TOPIC);
     if ((rc = MQTTClient_subscribe(*blynk_client_handle_ptr, topic, QOS)) != MQTTCLIENT_SUCCESS) {
-        fprintf(stderr, "Failed to subscribe to Blynk time window topic, return code %d\n", rc);
+        fprintf(stderr, "%s: Failed to subscribe to Blynk time window topic, return code %d\n", device->config_file, rc);
         MQTTClient_disconnect(*blynk_client_handle_ptr, 10000);
-        MQTTClient_destroy(blynk_client_handle_ptr);
         return rc;
     }
 
-    blynkClient_initialized_and_connected = 1;
+    device->connected = 1;
+    return MQTTCLIENT_SUCCESS;
+}
+
+// Sends what 'device' missed while its Blynk client was down. Batches held
+// from before the disconnect would only replay older values ahead of the
+// held ones. What they carried is recorded as sent, so drop them and resend
+// the table in full.
+static void catch_up_reconnected_device(BlynkDevice* device)
+{
+    pthread_mutex_lock(&fan_out_lock);
+    pthread_mutex_lock(&device->table_lock);
+    int discarded = publish_queue_discard(&device->queue);
+    if (discarded > 0) {
+        printf("Main: Dropped %d stale batches for %s.\n", discarded, device->config_file);
+        delta_cache_request_full(&device->delta);
+    }
+    flush_offline_store(device, 0);
+    pthread_mutex_unlock(&device->table_lock);
+    pthread_mutex_unlock(&fan_out_lock);
+}
+
+// Connects the local broker client and subscribes it to the watertable
+// topics; a clean session does not keep them. Both are taken, since the
+// service answers in whichever encoding the latest query asked for.
+static int connect_main_client(void)
+{
+    MQTTClient_connectOptions conn_opts = MQTTClient_connectOptions_initializer;
+    const char *watertable_topics[] = { MWP_WATERTABLE_JSON_TOPIC, MWP_WATERTABLE_BINARY_TOPIC };
+    int rc;
+
+    conn_opts.keepAliveInterval = 120;
+    conn_opts.cleansession = 1;
+    conn_opts.connectTimeout = CONNECT_TIMEOUT_SECONDS;
+    //conn_opts.username = mqttUser;       //only if req'd by MQTT Server
+    //conn_opts.password = mqttPassword;   //only if req'd by MQTT Server
+    if ((rc = MQTTClient_connect(client, &conn_opts)) != MQTTCLIENT_SUCCESS)
+    {
+        printf("Failed to connect main client, return code %d\n", rc);
+        //log_message("Blynk: Error == Failed to Connect. Return Code: %d\n", rc);
+        return rc;
+    }
+
+    for (int t = 0; t < 2; t++) {
+        printf("Main: Subscribing main client to watertable topic: %s (QoS: %d)\n", watertable_topics[t], QOS);
+        if ((rc = MQTTClient_subscribe(client, watertable_topics[t], QOS)) != MQTTCLIENT_SUCCESS) {
+            printf("Main: Failed to subscribe main client to %s, rc %d\n", watertable_topics[t], rc);
+            //log_message("BlynkW: Error == Failed to subscribe to %s. RC: %d\n", watertable_topics[t], rc);
+            // Depending on how critical this subscription is, you might want to exit or handle differently.
+            // For now, we'll print error and continue, but table data from mwp_data_service won't be received.
+        } else {
+            printf("Main: Successfully subscribed main client to %s\n", watertable_topics[t]);
+            //log_message("BlynkW: Subscribed to %s successfully.", watertable_topics[t]);
+        }
+    }
     return MQTTCLIENT_SUCCESS;
 }
 
+// Reconnects whichever connections are down and due, one at a time, so
+// connect timeouts never hold up the main loop or the callbacks
+static void* reconnect_thread_main(void* arg)
+{
+    pthread_mutex_lock(&reconnect_thread_lock);
+    while (reconnect_thread_running) {
+        pthread_mutex_unlock(&reconnect_thread_lock);
+
+        int64_t started_us = reconnect_now_us();
+        if (reconnect_due(&main_reconnect, started_us)) {
+            printf("Main: Local broker client not connected. Attempting to reconnect...\n");
+            if (connect_main_client() == MQTTCLIENT_SUCCESS) {
+                reconnect_succeeded(&main_reconnect, started_us, reconnect_now_us());
+                printf("Main: Local broker client reconnected successfully.\n");
+            } else {
+                reconnect_failed(&main_reconnect, reconnect_now_us());
+            }
+        }
+
+        for (int d = 0; d < blynk_device_count; d++) {
+            BlynkDevice* device = &blynk_devices[d];
+
+            started_us = reconnect_now_us();
+            if (!reconnect_due(&device->reconnect, started_us)) {
+                continue;
+            }
+            printf("Main: Blynk client for %s not connected. Attempting to connect...\n", device->config_file);
+            pthread_mutex_lock(&device->lock);
+            int rc = initialize_blynk_client(device);
+            pthread_mutex_unlock(&device->lock);
+            if (rc == MQTTCLIENT_SUCCESS) {
+                reconnect_succeeded(&device->reconnect, started_us, reconnect_now_us());
+                printf("Main: Blynk client for %s connected successfully.\n", device->config_file);
+                catch_up_reconnected_device(device);
+            } else {
+                reconnect_failed(&device->reconnect, reconnect_now_us());
+            }
+        }
+
+        // Sleep until the earliest attempt due, or a connection loss
+        int64_t next_us = reconnect_next_attempt(&main_reconnect);
+        for (int d = 0; d < blynk_device_count; d++) {
+            int64_t device_next_us = reconnect_next_attempt(&blynk_devices[d].reconnect);
+            if (device_next_us != 0 && (next_us == 0 || device_next_us < next_us)) {
+                next_us = device_next_us;
+            }
+        }
+        pthread_mutex_lock(&reconnect_thread_lock);
+        if (reconnect_thread_running && !reconnect_thread_woken) {
+            struct timespec ts;
+            if (next_us == 0 || next_us > reconnect_now_us() + RECONNECT_IDLE_WAKE_US) {
+                next_us = reconnect_now_us() + RECONNECT_IDLE_WAKE_US;
+            }
+            ts.tv_sec = next_us / 1000000LL;
+            ts.tv_nsec = (next_us % 1000000LL) * 1000;
+            pthread_cond_timedwait(&reconnect_thread_cond, &reconnect_thread_lock, &ts);
+        }
+        reconnect_thread_woken = 0;
+    }
+    pthread_mutex_unlock(&reconnect_thread_lock);
+    return NULL;
+}
+
+static int start_reconnect_thread(void)
+{
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC); // reconnect_now_us()'s clock
+    pthread_cond_init(&reconnect_thread_cond, &attr);
+    pthread_condattr_destroy(&attr);
+    reconnect_thread_running = 1;
+    if (pthread_create(&reconnect_thread, NULL, reconnect_thread_main, NULL) != 0) {
+        fprintf(stderr, "Failed to start the reconnect thread\n");
+        reconnect_thread_running = 0;
+        pthread_cond_destroy(&reconnect_thread_cond);
+        return -1;
+    }
+    return 0;
+}
+
+// Waits for an attempt under way to finish, at most CONNECT_TIMEOUT_SECONDS
+static void stop_reconnect_thread(void)
+{
+    pthread_mutex_lock(&reconnect_thread_lock);
+    if (!reconnect_thread_running) {
+        pthread_mutex_unlock(&reconnect_thread_lock);
+        return;
+    }
+    reconnect_thread_running = 0;
+    pthread_cond_signal(&reconnect_thread_cond);
+    pthread_mutex_unlock(&reconnect_thread_lock);
+    pthread_join(reconnect_thread, NULL);
+    pthread_cond_destroy(&reconnect_thread_cond);
+}
+
+// Registers every timeWindowMap entry with the window cache, using the TTLs
+// of 'config'. Windows it does not list follow the default policy.
+static int build_window_cache(const Config* config)
+{
+    window_cache_init(&time_window_cache, watertable_cell_count, config->window_cache.default_ttl_seconds);
+    for (int i = 0; i < numTimeWindowEntries; i++) {
+        const char* range = timeWindowMap[i].timeWindowString;
+        int has_ttl = 0, ttl_seconds = 0;
+        for (int j = 0; j < config->window_cache.count; j++) {
+            if (strcmp(config->window_cache.ranges[j], range) == 0) {
+                has_ttl = 1;
+                ttl_seconds = config->window_cache.ttl_seconds[j];
+            }
+        }
+        if (window_cache_add(&time_window_cache, range, has_ttl, ttl_seconds) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Loads one device config and selects its display rows
+static int add_device(const char* config_file)
+{
+    BlynkDevice* device;
+
+    if (blynk_device_count == BLYNK_MAX_DEVICES) {
+        fprintf(stderr, "Too many device configs, at most %d are supported\n", BLYNK_MAX_DEVICES);
+        return -1;
+    }
+    device = &blynk_devices[blynk_device_count];
+    memset(device, 0, sizeof(BlynkDevice));
+    if (load_config(config_file, &device->config) != 0) {
+        fprintf(stderr, "Failed to load configuration from %s\n", config_file);
+        return -1;
+    }
+    if (config_select_rows(&device->config) != 0) {
+        free_config(&device->config);
+        return -1;
+    }
+    device->config_file = strdup(config_file);
+    blynk_device_count++;
+    return 0;
+}
+
+static int is_json_file(const struct dirent* entry)
+{
+    size_t len = strlen(entry->d_name);
+    return entry->d_name[0] != '.' && len > 5 && strcmp(entry->d_name + len - 5, ".json") == 0;
+}
+
+// Adds the device config at 'path', or when it is a directory every *.json
+// in it, in name order
+static int add_devices(const char* path)
+{
+    struct stat st;
+    struct dirent** entries;
+    char config_file[512];
+    int count, rc = 0;
+
+    if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        return add_device(path);
+    }
+    count = scandir(path, &entries, is_json_file, alphasort);
+    if (count < 0) {
+        fprintf(stderr, "Failed to read config directory %s\n", path);
+        return -1;
+    }
+    if (count == 0) {
+        fprintf(stderr, "No .json configs found in %s\n", path);
+        rc = -1;
+    }
+    for (int i = 0; i < count; i++) {
+        if (rc == 0) {
+            snprintf(config_file, sizeof(config_file), "%s/%s", path, entries[i]->d_name);
+            rc = add_device(config_file);
+        }
+        free(entries[i]);
+    }
+    free(entries);
+    return rc;
+}
+
+// Sets up a loaded device's summary, delta cache and sender thread
+static int start_device(BlynkDevice* device)
+{
+    pthread_mutex_init(&device->lock, NULL);
+    pthread_mutex_init(&device->table_lock, NULL);
+    // Each row's summary flow gets a slot after the datastream pins
+    if (build_summary_prefix(device) != 0 ||
+        delta_cache_init(&device->delta, device->row_count * (BLYNK_PINS_PER_ROW + 1) + 1,
+                         device->config.delta.epsilon, device->config.delta.full_refresh_seconds) != 0 ||
+        offline_store_init(&device->offline, device->row_count * BLYNK_PINS_PER_ROW + 1) != 0) {
+        return -1;
+    }
+    // Seeded per device so devices dropped together do not retry in step
+    reconnect_init(&device->reconnect, &device->config.reconnect, (unsigned int)time(NULL) ^ (unsigned int)(device - blynk_devices));
+    // Blynk publishes go through a rate limited sender thread
+    return publish_queue_start(&device->queue, &device->config.publish, blynk_publish, device);
+}
+
+static void print_device_stats(BlynkDevice* device)
+{
+    publish_queue_print_stats(&device->queue, device->config_file, stdout);
+    printf("DeltaCache %s: checked=%llu skipped=%llu\n", device->config_file,
+           (unsigned long long)device->delta.checked, (unsigned long long)device->delta.skipped);
+    offline_store_print_stats(&device->offline, device->config_file, stdout);
+    reconnect_print_stats(&device->reconnect, device->config_file, stdout);
+}
+
+// Stops every device's sender and then its Blynk client, and only then
+// releases their tables and configuration. A TimeWindow message on any client
+// still connected fans out to every device, so none may be freed before all
+// clients are gone.
+static void free_devices(void)
+{
+    int device_count = blynk_device_count;
+    int started[BLYNK_MAX_DEVICES];
+
+    for (int d = 0; d < device_count; d++) {
+        BlynkDevice* device = &blynk_devices[d];
+
+        started[d] = device->queue.running;
+        if (started[d]) {
+            publish_queue_stop(&device->queue);
+            print_device_stats(device);
+        }
+
+        // Cleanup for the Blynk client if it exists and is connected/initialized
+        if (device->connected && device->client != NULL) {
+            printf("Main: Disconnecting and destroying Blynk client for %s before exit.\n", device->config_file);
+            MQTTClient_disconnect(device->client, 10000);
+            MQTTClient_destroy(&device->client);
+        } else if (device->client != NULL) { // If not connected but handle isn't NULL (e.g. creation failed mid-way outside init func)
+            printf("Main: Destroying non-connected Blynk client for %s before exit.\n", device->config_file);
+            MQTTClient_destroy(&device->client);
+        }
+    }
+
+    // Lets a fan-out already under way finish, and keeps later ones away
+    pthread_mutex_lock(&fan_out_lock);
+    blynk_device_count = 0;
+    pthread_mutex_unlock(&fan_out_lock);
+
+    for (int d = 0; d < device_count; d++) {
+        BlynkDevice* device = &blynk_devices[d];
+
+        // Connection-lost callbacks use it until the client is destroyed
+        if (started[d]) {
+            reconnect_destroy(&device->reconnect);
+        }
+        delta_cache_free(&device->delta);
+        offline_store_free(&device->offline);
+        free(device->table);
+        free(device->row_cells);
+        free_config(&device->config);
+        free(device->config_file);
+    }
+}
+
+static void handle_shutdown(int sig)
+{
+   finished = 1;
+}
+
+// Publishes the request latency histograms on the local broker, best effort
+static int publish_latency_metrics(void)
+{
+   char json_payload[8192];
+   size_t len = latency_trace_format_json(&request_latency, json_payload, sizeof(json_payload));
+
+   if (len == 0 || client == NULL || !MQTTClient_isConnected(client)) {
+      return -1;
+   }
+
+   MQTTClient_message pubmsg = MQTTClient_message_initializer;
+   pubmsg.payload = json_payload;
+   pubmsg.payloadlen = (int)len;
+   pubmsg.qos = 0;
+   pubmsg.retained = 0;
+   return MQTTClient_publishMessage(client, BLYNKLOG_METRICS_TOPIC, &pubmsg, NULL) == MQTTCLIENT_SUCCESS ? 0 : -1;
+}
+
+// Reconnect attempts over all connections, to tell when the metrics changed
+static uint64_t reconnect_attempts_total(void)
+{
+   uint64_t attempts = reconnect_attempts(&main_reconnect);
+
+   for (int d = 0; d < blynk_device_count; d++) {
+      attempts += reconnect_attempts(&blynk_devices[d].reconnect);
+   }
+   return attempts;
+}
+
+// Publishes {"main": {..}, "devices": [{..}, ..]} with the outage and
+// connect time histograms of each connection, best effort
+static int publish_reconnect_metrics(void)
+{
+   char json_payload[16384];
+   size_t len, n;
+
+   len = (size_t)snprintf(json_payload, sizeof(json_payload), "{\"main\":");
+   n = reconnect_format_json(&main_reconnect, json_payload + len, sizeof(json_payload) - len);
+   if (n == 0) {
+      return -1;
+   }
+   len += n;
+   for (int d = 0; d < blynk_device_count; d++) {
+      if (len + 16 >= sizeof(json_payload)) {
+         return -1;
+      }
+      len += (size_t)snprintf(json_payload + len, sizeof(json_payload) - len, d == 0 ? ",\"devices\":[" : ",");
+      n = reconnect_format_json(&blynk_devices[d].reconnect, json_payload + len, sizeof(json_payload) - len);
+      if (n == 0) {
+         return -1;
+      }
+      len += n;
+   }
+   if (len + 3 >= sizeof(json_payload)) {
+      return -1;
+   }
+   len += (size_t)snprintf(json_payload + len, sizeof(json_payload) - len, blynk_device_count > 0 ? "]}" : "}");
+
+   if (client == NULL || !MQTTClient_isConnected(client)) {
+      return -1;
+   }
+
+   MQTTClient_message pubmsg = MQTTClient_message_initializer;
+   pubmsg.payload = json_payload;
+   pubmsg.payloadlen = (int)len;
+   pubmsg.qos = 0;
+   pubmsg.retained = 0;
+   return MQTTClient_publishMessage(client, BLYNKLOG_RECONNECT_METRICS_TOPIC, &pubmsg, NULL) == MQTTCLIENT_SUCCESS ? 0 : -1;
+}
+
 int main(int argc, char *argv[])
 {
    // Set the global double-to-string format for all json-c operations in this program.
    // "%.4g" formats numbers to 4 significant digits.
    json_c_set_serialization_double_format("%.4g", 0);
    
-   MQTTClient_connectOptions conn_opts = MQTTClient_connectOptions_initializer;
    int rc;
    int opt;
    const char *mqtt_ip = NULL;
    int mqtt_port = 0;
-   const char *config_file = "blynk_config.json";  // Default config file path in project directory
-   Config config;
+   // -c may be repeated, one Blynk device per config file or per *.json in a directory
+   const char *config_paths[BLYNK_MAX_DEVICES];
+   int config_path_count = 0;
 
    while ((opt = getopt(argc, argv, "vPDc:")) != -1) {
       switch (opt) {
@@ -631,47 +1324,95 @@ int main(int argc, char *argv[])
                mqtt_port = DEV_MQTT_PORT;
                break;
          case 'c':
-               config_file = optarg;
+               if (config_path_count == BLYNK_MAX_DEVICES) {
+                  fprintf(stderr, "Too many -c options, at most %d are supported\n", BLYNK_MAX_DEVICES);
+                  return 1;
+               }
+               config_paths[config_path_count++] = optarg;
                break;
          default:
-               fprintf(stderr, "Usage: %s [-v] [-P | -D] [-c config_file]\n", argv[0]);
+               fprintf(stderr, "Usage: %s [-v] [-P | -D] [-c config_file | -c config_dir]...\n", argv[0]);
                return 1;
       }
    }
+   if (config_path_count == 0) {
+      config_paths[config_path_count++] = "blynk_config.json";  // Default config file path in project directory
+   }
 
    if (verbose) {
       printf("Verbose mode enabled\n");
    }
 
-   // Load configuration
-   if (load_config(config_file, &config) != 0) {
-      fprintf(stderr, "Failed to load configuration from %s\n", config_file);
+   // Load configuration, one device per config file
+   for (int i = 0; i < config_path_count; i++) {
+      if (add_devices(config_paths[i]) != 0) {
+         free_devices();
+         return 1;
+      }
+   }
+   if (build_watertable_index() != 0) {
+      free_devices();
       return 1;
    }
 
    if (verbose) {
-      printf("Loaded configuration:\n");
-      printf("  Blynk Address: %s\n", config.blynk.address);
-      printf("  Blynk Client ID: %s\n", config.blynk.client_id);
-      printf("  Blynk Device Name: %s\n", config.blynk.device_name);
-      printf("  Blynk Template Name: %s\n", config.blynk.template_name);
-      printf("  Blynk Template ID: %s\n", config.blynk.template_id);
-      printf("  Blynk Auth Token: %s\n", config.blynk.auth_token);
-      printf("  Blynk Topic: %s\n", config.blynk.topic);
-      printf("  Controllers: ");
-      for (int i = 0; i < config.data_filter.controllers_count; i++) {
-         printf("%d ", config.data_filter.controllers[i]);
-      }
-      printf("\n  Zones: ");
-      for (int i = 0; i < config.data_filter.zones_count; i++) {
-         printf("%d ", config.data_filter.zones[i]);
+      for (int d = 0; d < blynk_device_count; d++) {
+         Config* config = &blynk_devices[d].config;
+         printf("Loaded configuration %s:\n", blynk_devices[d].config_file);
+         printf("  Blynk Address: %s\n", config->blynk.address);
+         printf("  Blynk Client ID: %s\n", config->blynk.client_id);
+         printf("  Blynk Device Name: %s\n", config->blynk.device_name);
+         printf("  Blynk Template Name: %s\n", config->blynk.template_name);
+         printf("  Blynk Template ID: %s\n", config->blynk.template_id);
+         printf("  Blynk Auth Token: %s\n", config->blynk.auth_token);
+         printf("  Blynk Topic: %s\n", config->blynk.topic);
+         printf("  Controllers: ");
+         for (int i = 0; i < config->data_filter.controllers_count; i++) {
+            printf("%d ", config->data_filter.controllers[i]);
+         }
+         printf("\n  Zones: ");
+         for (int i = 0; i < config->data_filter.zones_count; i++) {
+            printf("%d ", config->data_filter.zones[i]);
+         }
+         printf("\n  Display rows: %d of %d\n", config->data_filter.rows_count, config->row_map.count);
+         printf("  Pin Base Offset: %d\n", config->pin_config.base_offset);
       }
-      printf("\n  Pin Base Offset: %d\n", config.pin_config.base_offset);
    }
 
    if (mqtt_ip == NULL) {
       fprintf(stderr, "Please specify either Production (-P) or Development (-D) server\n");
-      free_config(&config);
+      free_devices();
+      return 1;
+   }
+
+   if (build_batch_keys() != 0) {
+      free_devices();
+      return 1;
+   }
+
+   for (int d = 0; d < blynk_device_count; d++) {
+      if (start_device(&blynk_devices[d]) != 0) {
+         free_devices();
+         batch_payload_keys_free(&blynk_batch_keys);
+         return 1;
+      }
+   }
+
+   // Like the query settings, the cache is shared and configured by the first device
+   if (build_window_cache(&blynk_devices[0].config) != 0) {
+      free_devices();
+      batch_payload_keys_free(&blynk_batch_keys);
+      return 1;
+   }
+
+   latency_trace_init(&request_latency);
+
+   // Started before the local client, whose callbacks report query results to it
+   if (query_debouncer_start(&time_window_debouncer, &blynk_devices[0].config.query, send_time_window_query, &blynk_devices[0].config) != 0) {
+      free_devices();
+      batch_payload_keys_free(&blynk_batch_keys);
+      window_cache_free(&time_window_cache);
+      latency_trace_destroy(&request_latency);
       return 1;
    }
 
@@ -682,7 +1423,8 @@ int main(int argc, char *argv[])
    
    //log_message("Blynk: Started\n");
 
-   if ((rc = MQTTClient_create(&client, mqtt_address, config.blynk.client_id,
+   // One local connection feeds every device, so it takes the first device's client ID
+   if ((rc = MQTTClient_create(&client, mqtt_address, blynk_devices[0].config.blynk.client_id,
                                MQTTCLIENT_PERSISTENCE_NONE, NULL)) != MQTTCLIENT_SUCCESS)
    {
       printf("Failed to create client, return code %d\n", rc);
@@ -691,7 +1433,7 @@ int main(int argc, char *argv[])
       exit(EXIT_FAILURE);
    }
    
-   if ((rc = MQTTClient_setCallbacks(client, &config, connlost, msgarrvd, delivered)) != MQTTCLIENT_SUCCESS)
+   if ((rc = MQTTClient_setCallbacks(client, NULL, connlost, msgarrvd, delivered)) != MQTTCLIENT_SUCCESS)
    {
       printf("Failed to set callbacks, return code %d\n", rc);
       //log_message("Blynk: Error == Failed to Set Callbacks. Return Code: %d\n", rc);
@@ -699,44 +1441,23 @@ int main(int argc, char *argv[])
       exit(EXIT_FAILURE);
    }
    
-   conn_opts.keepAliveInterval = 120;
-   conn_opts.cleansession = 1;
-   //conn_opts.username = mqttUser;       //only if req'd by MQTT Server
-   //conn_opts.password = mqttPassword;   //only if req'd by MQTT Server
-   if ((rc = MQTTClient_connect(client, &conn_opts)) != MQTTCLIENT_SUCCESS)
+   // The local broker has to be there at startup; later losses are retried
+   reconnect_init(&main_reconnect, &blynk_devices[0].config.reconnect, (unsigned int)time(NULL));
+   int64_t connect_started_us = reconnect_now_us();
+   if (connect_main_client() != MQTTCLIENT_SUCCESS)
    {
-      printf("Failed to connect main client, return code %d\n", rc);
-      //log_message("Blynk: Error == Failed to Connect. Return Code: %d\n", rc);
-      // rc = EXIT_FAILURE; // Original code did not set rc here for exit
       MQTTClient_destroy(&client); // Ensure client is destroyed if connect fails
       exit(EXIT_FAILURE);
    }
-
-   // Subscribe the main client to the watertable JSON topic
-   printf("Main: Subscribing main client to watertable JSON topic: %s (QoS: %d)\n", MWP_WATERTABLE_JSON_TOPIC, QOS);
-   if ((rc = MQTTClient_subscribe(client, MWP_WATERTABLE_JSON_TOPIC, QOS)) != MQTTCLIENT_SUCCESS) {
-      printf("Main: Failed to subscribe main client to %s, rc %d\n", MWP_WATERTABLE_JSON_TOPIC, rc);
-      //log_message("BlynkW: Error == Failed to subscribe to %s. RC: %d\n", MWP_WATERTABLE_JSON_TOPIC, rc);
-      // Depending on how critical this subscription is, you might want to exit or handle differently.
-      // For now, we'll print error and continue, but table data from mwp_data_service won't be received.
-   } else {
-      printf("Main: Successfully subscribed main client to %s\n", MWP_WATERTABLE_JSON_TOPIC);
-      //log_message("BlynkW: Subscribed to %s successfully.", MWP_WATERTABLE_JSON_TOPIC);
-   }
-
-   // --- Blynk Client (blynkClient) Setup and Management --- 
-   // MQTTClient blynkClient = NULL; // Moved to file scope
-   int rc_loop_status; // To store return status from new loop()
-
-   // Initial attempt to connect the Blynk client
-   printf("Main: Attempting initial Blynk client connection...\n");
-   if (initialize_blynk_client(&blynkClient, &config) == MQTTCLIENT_SUCCESS) {
-      blynkClient_initialized_and_connected = 1;
-      // log_message("BlynkW: Initial Blynk client connection successful."); // Optional logging
-   } else {
-      printf("Main: Initial Blynk client connection failed. Will retry in main loop.\n");
-      // initialize_blynk_client handles cleanup of blynkClient on its own failure, so blynkClient should be NULL or safe
-      // log_message("BlynkW: Initial Blynk client connection failed."); // Optional logging
+   reconnect_succeeded(&main_reconnect, connect_started_us, reconnect_now_us());
+
+   // --- Blynk Client Setup and Management, one per device ---
+   // Each Blynk client starts out disconnected with an attempt due, so the
+   // reconnect thread makes the initial connections too, and keeps retrying
+   // any that fail with backoff while the main loop carries on
+   if (start_reconnect_thread() != 0) {
+      free_devices();
+      exit(EXIT_FAILURE);
    }
    
    // Subscribe the main client (for mwp/data/monitor/#)
@@ -744,49 +1465,56 @@ int main(int argc, char *argv[])
    // log_message("BlynkW: Subscribing to topic: %s for client: %s\n", "mwp/data/monitor/#", MONITOR_CLIENTID);
    //MQTTClient_subscribe(client, "mwp/data/monitor/#", QOS); // Assuming QOS and MONITOR_CLIENTID are defined
 
+   time_t last_stats_time = time(NULL);
+   uint64_t metrics_published = 0;
+   uint64_t reconnect_metrics_published = 0;
+
+   // Leave the loop on Ctrl-C or a stop, so the latency summary gets printed
+   signal(SIGINT, handle_shutdown);
+   signal(SIGTERM, handle_shutdown);
+
    // --- Main Application Loop ---
-   while (TRUE) // Replace TRUE with a proper shutdown condition if needed
+   while (!finished)
    {
-      // --- Handle Blynk Client State ---
-      if (!blynkClient_initialized_and_connected) {
-         printf("Main: Blynk client not connected. Attempting to reconnect in %d seconds...\n", RECONNECT_DELAY_SECONDS);
-         // log_message("BlynkW: Attempting to reconnect Blynk client."); // Optional
-         sleep(RECONNECT_DELAY_SECONDS); 
-         if (initialize_blynk_client(&blynkClient, &config) == MQTTCLIENT_SUCCESS) {
-            blynkClient_initialized_and_connected = 1;
-            printf("Main: Blynk client reconnected successfully.\n");
-            // log_message("BlynkW: Reconnected Blynk client successfully."); // Optional
-         } else {
-            printf("Main: Blynk client reconnection failed. Will retry later.\n");
-            // log_message("BlynkW: Blynk client reconnection failed."); // Optional
-            // blynkClient should be NULL or properly managed by initialize_blynk_client upon its failure.
-         }
-      }
-
-      // If Blynk client is ready, call its processing loop
-      if (blynkClient_initialized_and_connected) {
-         if (blynkClient == NULL) { // Safety check, should not happen if logic is correct
-             printf("CRITICAL ERROR in Main: blynkClient_initialized_and_connected is true, but blynkClient handle is NULL! Correcting state.\n");
-             blynkClient_initialized_and_connected = 0; 
-         } else {
-            rc_loop_status = loop(blynkClient, &config); // Call the modified loop function
-            if (rc_loop_status == -1) {
-               printf("Main: loop() reported critical MQTT error for Blynk. Client resource was destroyed by loop.\n");
-               // log_message("BlynkW: Critical error in Blynk client loop. Client destroyed by loop."); //Optional
-               blynkClient = NULL; // The handle 'blynkClient' in main is now stale. Mark it NULL.
-                                  // The resource was destroyed by loop(), do not destroy again here.
-               blynkClient_initialized_and_connected = 0; 
-            } 
-            // else if (rc_loop_status == 0) { /* Loop was successful or skipped harmlessly */ }
+      for (int d = 0; d < blynk_device_count; d++) {
+         BlynkDevice* device = &blynk_devices[d];
+
+         // Nothing is sent on a timer; this only catches up on data that
+         // arrived while the device was disconnected
+         if (device->connected) {
+            pthread_mutex_lock(&fan_out_lock);
+            pthread_mutex_lock(&device->table_lock);
+            publish_device_table(device, 0);
+            pthread_mutex_unlock(&device->table_lock);
+            pthread_mutex_unlock(&fan_out_lock);
          }
-      } else {
-         printf("Main: Skipping Blynk operations as client is not connected.\n");
       }
 
       // TODO: Add logic for the main 'client' (mwp/data/monitor/#) if it needs yielding or periodic checks.
       // For example, MQTTClient_yield() if 'client' is asynchronous or uses persistence that needs it.
       // The original code structure implies 'client' messages are handled via callbacks (msgarrvd).
 
+      // Histograms go out locally whenever another traced request has reached Blynk
+      uint64_t completed = latency_trace_completed(&request_latency);
+      if (completed != metrics_published && publish_latency_metrics() == 0) {
+         metrics_published = completed;
+      }
+      // Likewise the reconnect metrics, after any attempt
+      uint64_t attempts = reconnect_attempts_total();
+      if (attempts != reconnect_metrics_published && publish_reconnect_metrics() == 0) {
+         reconnect_metrics_published = attempts;
+      }
+
+      if (verbose && time(NULL) - last_stats_time >= PUBLISH_STATS_INTERVAL_SECONDS) {
+         for (int d = 0; d < blynk_device_count; d++) {
+            print_device_stats(&blynk_devices[d]);
+         }
+         query_debouncer_print_stats(&time_window_debouncer, stdout);
+         window_cache_print_stats(&time_window_cache, stdout);
+         reconnect_print_stats(&main_reconnect, "local broker", stdout);
+         last_stats_time = time(NULL);
+      }
+
       sleep(1); // Main application cycle delay
    }
 
@@ -795,28 +1523,35 @@ int main(int argc, char *argv[])
    // --- Cleanup before exit ---
    printf("Main: Cleaning up resources before exit...\n");
 
+   // No more connects once clients start going away
+   stop_reconnect_thread();
+   reconnect_print_stats(&main_reconnect, "local broker", stdout);
+   reconnect_destroy(&main_reconnect);
+
+   // Stop sending queries before the local client goes away
+   query_debouncer_stop(&time_window_debouncer);
+   query_debouncer_print_stats(&time_window_debouncer, stdout);
+
    // Cleanup for the first 'client' (mwp/data/monitor/#)
    if (client != NULL) { // Check if client was successfully created
       printf("Main: Unsubscribing and disconnecting main client.\n");
-      MQTTClient_unsubscribe(client, MWP_WATERTABLE_JSON_TOPIC); // Unsubscribe from the watertable topic
+      MQTTClient_unsubscribe(client, MWP_WATERTABLE_JSON_TOPIC); // Unsubscribe from the watertable topics
+      MQTTClient_unsubscribe(client, MWP_WATERTABLE_BINARY_TOPIC);
       // MQTTClient_unsubscribe(client, "mwp/data/monitor/#"); // If this was ever subscribed to
       MQTTClient_disconnect(client, 10000);
       MQTTClient_destroy(&client);
    }
 
-   // Cleanup for blynkClient if it exists and is connected/initialized
-   if (blynkClient_initialized_and_connected && blynkClient != NULL) {
-      printf("Main: Disconnecting and destroying Blynk client before exit.\n");
-      MQTTClient_disconnect(blynkClient, 10000);
-      MQTTClient_destroy(&blynkClient);
-   } else if (blynkClient != NULL) { // If not connected but handle isn't NULL (e.g. creation failed mid-way outside init func)
-      printf("Main: Destroying non-connected Blynk client before exit.\n");
-      MQTTClient_destroy(&blynkClient);
-   }
+   // Stops each sender and then its Blynk client, and cleans up configuration
+   free_devices();
+   batch_payload_keys_free(&blynk_batch_keys);
+   window_cache_free(&time_window_cache);
+
+   // Printed last, once every sender has stopped
+   latency_trace_print_summary(&request_latency, stdout);
+   latency_trace_destroy(&request_latency);
 
-   // Clean up configuration before exit
-   free_config(&config);
    printf("Main: Application exiting.\n");
    //log_message("Blynk: Exited Main Loop\n"); // Duplicate? Or different context?
    return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
@@ -1,12 +1,134 @@
 #include "config.h"
+#include "delta_cache.h"
+#include "window_cache.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <json-c/json.h>
 
+// Turns a list of numbers into a bitset sized to its largest member
+static uint64_t* compile_bits(const int* values, int count, int* words, const char* name) {
+    int max = -1;
+    uint64_t* bits;
+
+    for (int i = 0; i < count; i++) {
+        if (values[i] < 0) {
+            fprintf(stderr, "Ignoring negative %s %d in data filter\n", name, values[i]);
+        } else if (values[i] > max) {
+            max = values[i];
+        }
+    }
+    *words = max / 64 + 1;
+    bits = calloc(*words, sizeof(uint64_t));
+    if (bits == NULL) {
+        *words = 0;
+        return NULL;
+    }
+    for (int i = 0; i < count; i++) {
+        if (values[i] >= 0) {
+            bits[values[i] / 64] |= 1ULL << (values[i] % 64);
+        }
+    }
+    return bits;
+}
+
+// Rows used when a config has no "row_map": controller, first and last zone,
+// each zone displayed under its own number
+static const int default_row_map[][3] = {
+    { 0, 0, 0 },
+    { 1, 1, 16 },
+    { 2, 1, 13 },
+    { 3, 1, 1 },
+};
+
+// Reads one "row_map" entry, {"controller": c, "zone": z, "display_zone": d}
+// or {"controller": c, "zones": [first, last]}, into 'rows' if not NULL.
+// Returns how many rows it stands for, or -1 if it is invalid.
+static int parse_row_entry(json_object* entry, ConfigRow* rows) {
+    json_object *temp_obj, *zones_obj;
+    int controller, first, last, display_zone = -1;
+
+    if (!json_object_object_get_ex(entry, "controller", &temp_obj)) {
+        fprintf(stderr, "row_map entry without a 'controller'\n");
+        return -1;
+    }
+    controller = json_object_get_int(temp_obj);
+    if (json_object_object_get_ex(entry, "zones", &zones_obj) &&
+        json_object_is_type(zones_obj, json_type_array) && json_object_array_length(zones_obj) == 2) {
+        first = json_object_get_int(json_object_array_get_idx(zones_obj, 0));
+        last = json_object_get_int(json_object_array_get_idx(zones_obj, 1));
+    } else if (json_object_object_get_ex(entry, "zone", &temp_obj)) {
+        first = last = json_object_get_int(temp_obj);
+        if (json_object_object_get_ex(entry, "display_zone", &temp_obj)) {
+            display_zone = json_object_get_int(temp_obj);
+        }
+    } else {
+        fprintf(stderr, "row_map entry for controller %d needs 'zone' or 'zones': [first, last]\n", controller);
+        return -1;
+    }
+    if (controller < 0 || controller >= WATERTABLE_MAX_CONTROLLERS ||
+        first < 0 || last < first || last >= WATERTABLE_MAX_ZONES) {
+        fprintf(stderr, "row_map entry C:%d Z:%d-%d is out of range (%d controllers, %d zones)\n",
+                controller, first, last, WATERTABLE_MAX_CONTROLLERS, WATERTABLE_MAX_ZONES);
+        return -1;
+    }
+    for (int zone = first; rows != NULL && zone <= last; zone++) {
+        rows[zone - first].controller = controller;
+        rows[zone - first].zone = zone;
+        rows[zone - first].display_zone = display_zone >= 0 ? display_zone : zone;
+    }
+    return last - first + 1;
+}
+
+// Fills config->row_map from the "row_map" array, or from default_row_map
+static int load_row_map(json_object* root, Config* config) {
+    json_object* row_map_obj;
+    int count = 0, n;
+
+    if (!json_object_object_get_ex(root, "row_map", &row_map_obj)) {
+        for (size_t i = 0; i < sizeof(default_row_map) / sizeof(default_row_map[0]); i++) {
+            count += default_row_map[i][2] - default_row_map[i][1] + 1;
+        }
+        config->row_map.rows = calloc(count, sizeof(ConfigRow));
+        if (config->row_map.rows == NULL) {
+            return -1;
+        }
+        for (size_t i = 0; i < sizeof(default_row_map) / sizeof(default_row_map[0]); i++) {
+            for (int zone = default_row_map[i][1]; zone <= default_row_map[i][2]; zone++) {
+                ConfigRow* row = &config->row_map.rows[config->row_map.count++];
+                row->controller = default_row_map[i][0];
+                row->zone = zone;
+                row->display_zone = zone;
+            }
+        }
+        return 0;
+    }
+
+    if (!json_object_is_type(row_map_obj, json_type_array)) {
+        fprintf(stderr, "'row_map' must be an array\n");
+        return -1;
+    }
+    // Sized in a first pass, so the rows end up in one allocation
+    for (size_t i = 0; i < json_object_array_length(row_map_obj); i++) {
+        if ((n = parse_row_entry(json_object_array_get_idx(row_map_obj, i), NULL)) < 0) {
+            return -1;
+        }
+        count += n;
+    }
+    config->row_map.rows = calloc(count > 0 ? count : 1, sizeof(ConfigRow));
+    if (config->row_map.rows == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < json_object_array_length(row_map_obj); i++) {
+        config->row_map.count += parse_row_entry(json_object_array_get_idx(row_map_obj, i),
+                                                 &config->row_map.rows[config->row_map.count]);
+    }
+    return 0;
+}
+
 int load_config(const char* filename, Config* config) {
     json_object *root;
-    json_object *blynk_obj, *data_filter_obj, *pin_config_obj;
+    json_object *blynk_obj, *data_filter_obj, *pin_config_obj, *publish_obj, *reconnect_obj, *delta_obj, *query_obj, *window_cache_obj;
     json_object *controllers_array, *zones_array;
     json_object *temp_obj;
 
@@ -90,6 +212,18 @@ int load_config(const char* filename, Config* config) {
         config->data_filter.zones[i] = json_object_get_int(item);
     }
 
+    // Compile the lists into bitsets so lookups do not scan them
+    config->data_filter.controller_bits = compile_bits(config->data_filter.controllers,
+                                                       config->data_filter.controllers_count,
+                                                       &config->data_filter.controller_bits_words, "controller");
+    config->data_filter.zone_bits = compile_bits(config->data_filter.zones, config->data_filter.zones_count,
+                                                 &config->data_filter.zone_bits_words, "zone");
+    if (config->data_filter.controller_bits == NULL || config->data_filter.zone_bits == NULL) {
+        fprintf(stderr, "Failed to allocate data filter\n");
+        json_object_put(root);
+        return -1;
+    }
+
     // Parse pin configuration
     if (!json_object_object_get_ex(root, "pin_config", &pin_config_obj)) {
         fprintf(stderr, "Missing 'pin_config' section in config\n");
@@ -103,11 +237,137 @@ int load_config(const char* filename, Config* config) {
         return -1;
     }
     config->pin_config.base_offset = json_object_get_int(temp_obj);
+    if (json_object_object_get_ex(pin_config_obj, "max_rows", &temp_obj)) {
+        config->pin_config.max_rows = json_object_get_int(temp_obj);
+    }
+
+    if (load_row_map(root, config) != 0) {
+        fprintf(stderr, "Failed to load 'row_map'\n");
+        json_object_put(root);
+        return -1;
+    }
+
+    // Optional publish rate limit; the defaults match the old 250 ms batch spacing
+    config->publish.rate = PUBLISH_QUEUE_DEFAULT_RATE;
+    config->publish.burst = PUBLISH_QUEUE_DEFAULT_BURST;
+    config->publish.depth = PUBLISH_QUEUE_DEFAULT_DEPTH;
+    if (json_object_object_get_ex(root, "publish", &publish_obj)) {
+        if (json_object_object_get_ex(publish_obj, "rate_per_second", &temp_obj)) {
+            config->publish.rate = json_object_get_double(temp_obj);
+        }
+        if (json_object_object_get_ex(publish_obj, "burst", &temp_obj)) {
+            config->publish.burst = json_object_get_int(temp_obj);
+        }
+        if (json_object_object_get_ex(publish_obj, "queue_depth", &temp_obj)) {
+            config->publish.depth = json_object_get_int(temp_obj);
+        }
+    }
+
+    // Optional reconnect backoff, for the Blynk client and, from the first
+    // device, the local broker client
+    config->reconnect.initial_ms = RECONNECT_DEFAULT_INITIAL_MS;
+    config->reconnect.max_ms = RECONNECT_DEFAULT_MAX_MS;
+    config->reconnect.multiplier = RECONNECT_DEFAULT_MULTIPLIER;
+    config->reconnect.jitter = RECONNECT_DEFAULT_JITTER;
+    if (json_object_object_get_ex(root, "reconnect", &reconnect_obj)) {
+        if (json_object_object_get_ex(reconnect_obj, "initial_ms", &temp_obj)) {
+            config->reconnect.initial_ms = json_object_get_int(temp_obj);
+        }
+        if (json_object_object_get_ex(reconnect_obj, "max_ms", &temp_obj)) {
+            config->reconnect.max_ms = json_object_get_int(temp_obj);
+        }
+        if (json_object_object_get_ex(reconnect_obj, "multiplier", &temp_obj)) {
+            config->reconnect.multiplier = json_object_get_double(temp_obj);
+        }
+        if (json_object_object_get_ex(reconnect_obj, "jitter", &temp_obj)) {
+            config->reconnect.jitter = json_object_get_double(temp_obj);
+        }
+    }
+
+    // Optional change-only publishing thresholds
+    config->delta.epsilon = DELTA_CACHE_DEFAULT_EPSILON;
+    config->delta.full_refresh_seconds = DELTA_CACHE_DEFAULT_REFRESH_SECS;
+    if (json_object_object_get_ex(root, "delta", &delta_obj)) {
+        if (json_object_object_get_ex(delta_obj, "epsilon", &temp_obj)) {
+            config->delta.epsilon = json_object_get_double(temp_obj);
+        }
+        if (json_object_object_get_ex(delta_obj, "full_refresh_seconds", &temp_obj)) {
+            config->delta.full_refresh_seconds = json_object_get_int(temp_obj);
+        }
+    }
+
+    // Optional TimeWindow query debounce; the local connection is shared, so
+    // blynkLog takes this from the first device config
+    config->query.debounce_ms = QUERY_DEBOUNCER_DEFAULT_DEBOUNCE_MS;
+    config->query.result_timeout_ms = QUERY_DEBOUNCER_DEFAULT_RESULT_TIMEOUT_MS;
+    if (json_object_object_get_ex(root, "query", &query_obj)) {
+        if (json_object_object_get_ex(query_obj, "debounce_ms", &temp_obj)) {
+            config->query.debounce_ms = json_object_get_int(temp_obj);
+        }
+        if (json_object_object_get_ex(query_obj, "result_timeout_seconds", &temp_obj)) {
+            config->query.result_timeout_ms = json_object_get_int(temp_obj) * 1000;
+        }
+        if (json_object_object_get_ex(query_obj, "encoding", &temp_obj)) {
+            const char* encoding = json_object_get_string(temp_obj);
+            if (strcmp(encoding, "binary") == 0) {
+                config->binary_results = 1;
+            } else if (strcmp(encoding, "json") != 0) {
+                fprintf(stderr, "Unknown query encoding '%s', using json\n", encoding);
+            }
+        }
+    }
+
+    // Optional per time window cache TTLs, e.g. "ttl_seconds": {"1h": 30, "7d": 600}
+    config->window_cache.default_ttl_seconds = WINDOW_CACHE_DEFAULT_TTL_SECONDS;
+    if (json_object_object_get_ex(root, "window_cache", &window_cache_obj)) {
+        if (json_object_object_get_ex(window_cache_obj, "default_ttl_seconds", &temp_obj)) {
+            config->window_cache.default_ttl_seconds = json_object_get_int(temp_obj);
+        }
+        if (json_object_object_get_ex(window_cache_obj, "ttl_seconds", &temp_obj) &&
+            json_object_is_type(temp_obj, json_type_object)) {
+            int count = json_object_object_length(temp_obj);
+            config->window_cache.ranges = calloc(count > 0 ? count : 1, sizeof(char*));
+            config->window_cache.ttl_seconds = calloc(count > 0 ? count : 1, sizeof(int));
+            json_object_object_foreach(temp_obj, range, ttl_obj) {
+                config->window_cache.ranges[config->window_cache.count] = strdup(range);
+                config->window_cache.ttl_seconds[config->window_cache.count] = json_object_get_int(ttl_obj);
+                config->window_cache.count++;
+            }
+        }
+    }
 
     json_object_put(root);
     return 0;
 }
 
+int config_select_rows(Config* config) {
+    int skipped = 0;
+
+    free(config->data_filter.rows);
+    config->data_filter.rows_count = 0;
+    config->data_filter.rows = malloc((config->row_map.count > 0 ? config->row_map.count : 1) * sizeof(int));
+    if (config->data_filter.rows == NULL) {
+        fprintf(stderr, "Failed to allocate data filter rows\n");
+        return -1;
+    }
+    for (int i = 0; i < config->row_map.count; i++) {
+        const ConfigRow* row = &config->row_map.rows[i];
+        if (!config_filter_allows(config, row->controller, row->zone)) {
+            continue;
+        }
+        if (config->pin_config.max_rows > 0 && config->data_filter.rows_count == config->pin_config.max_rows) {
+            skipped++;
+            continue;
+        }
+        config->data_filter.rows[config->data_filter.rows_count++] = i;
+    }
+    if (skipped > 0) {
+        fprintf(stderr, "pin_config.max_rows is %d; %d more display rows are left out\n",
+                config->pin_config.max_rows, skipped);
+    }
+    return 0;
+}
+
 void free_config(Config* config) {
     if (config == NULL) {
         return;
@@ -129,6 +389,16 @@ void free_config(Config* config) {
     if (config->data_filter.zones != NULL) {
         free(config->data_filter.zones);
     }
+    free(config->data_filter.controller_bits);
+    free(config->data_filter.zone_bits);
+    free(config->data_filter.rows);
+    free(config->row_map.rows);
+
+    for (int i = 0; i < config->window_cache.count; i++) {
+        free(config->window_cache.ranges[i]);
+    }
+    free(config->window_cache.ranges);
+    free(config->window_cache.ttl_seconds);
 
     // Free pin configuration
     memset(config, 0, sizeof(Config));
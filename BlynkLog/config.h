@@ -1,7 +1,19 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+#include <stdint.h>
 #include <json-c/json.h>
+#include "publish_queue.h"
+#include "query_debouncer.h"
+#include "reconnect.h"
+
+// One display row: the watertable controller/zone it shows, and the zone
+// number displayed for it
+typedef struct {
+    int controller;
+    int zone;
+    int display_zone;
+} ConfigRow;
 
 // Configuration structure
 typedef struct {
@@ -20,15 +32,63 @@ typedef struct {
         int controllers_count;
         int* zones;
         int zones_count;
+
+        // Compiled by load_config(): bit n set when n is in the list above
+        uint64_t* controller_bits;
+        int controller_bits_words;
+        uint64_t* zone_bits;
+        int zone_bits_words;
+
+        // row_map rows that pass the filter, in map order (config_select_rows)
+        int* rows;
+        int rows_count;
     } data_filter;
+
+    // Optional "row_map" section, the built-in dashboard layout otherwise
+    struct {
+        ConfigRow* rows;
+        int count;
+    } row_map;
     
     struct {
         int base_offset;
+        int max_rows;               // Optional; display rows past this are left out, 0 for no limit
     } pin_config;
+
+    PublishQueueConfig publish;     // Optional "publish" section, defaults otherwise
+    ReconnectConfig reconnect;      // Optional "reconnect" backoff, defaults otherwise
+
+    struct {
+        double epsilon;             // Smallest change that is republished
+        int full_refresh_seconds;   // Resend everything this often, 0 to disable
+    } delta;                        // Optional "delta" section
+
+    QueryDebounceConfig query;      // Optional "query" section, defaults otherwise
+    int binary_results;             // "query": {"encoding": "binary"}; JSON otherwise
+
+    struct {
+        int default_ttl_seconds;    // Open time windows; closed months and past years never expire
+        char** ranges;              // Windows given their own TTL
+        int* ttl_seconds;           // Negative: never expires
+        int count;
+    } window_cache;                 // Optional "window_cache" section
 } Config;
 
 // Function declarations
 int load_config(const char* config_file, Config* config);
 void free_config(Config* config);
 
+// Filters row_map down to the rows the data filter allows, up to
+// pin_config.max_rows, storing their indices in data_filter.rows.
+int config_select_rows(Config* config);
+
+static inline int config_bit_set(const uint64_t* bits, int words, int n) {
+    return n >= 0 && n / 64 < words && (bits[n / 64] >> (n % 64)) & 1;
+}
+
+static inline int config_filter_allows(const Config* config, int controller, int zone) {
+    return config_bit_set(config->data_filter.controller_bits, config->data_filter.controller_bits_words, controller) &&
+           config_bit_set(config->data_filter.zone_bits, config->data_filter.zone_bits_words, zone);
+}
+
 #endif // CONFIG_H 
\ No newline at end of file
@@ -0,0 +1,57 @@
+#include "delta_cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+int delta_cache_init(DeltaCache* cache, int pin_count, double epsilon, int refresh_seconds) {
+    memset(cache, 0, sizeof(DeltaCache));
+    cache->values = calloc(pin_count, sizeof(double));
+    cache->sent = calloc(pin_count, sizeof(uint8_t));
+    if (cache->values == NULL || cache->sent == NULL) {
+        fprintf(stderr, "DeltaCache: failed to allocate %d pins\n", pin_count);
+        delta_cache_free(cache);
+        return -1;
+    }
+    cache->pin_count = pin_count;
+    cache->epsilon = epsilon >= 0 ? epsilon : 0;
+    cache->refresh_seconds = refresh_seconds > 0 ? refresh_seconds : 0;
+    return 0;
+}
+
+void delta_cache_free(DeltaCache* cache) {
+    free(cache->values);
+    free(cache->sent);
+    cache->values = NULL;
+    cache->sent = NULL;
+    cache->pin_count = 0;
+}
+
+int delta_cache_begin(DeltaCache* cache, time_t now) {
+    cache->full = 0;
+    if (cache->full_requested ||
+        (cache->refresh_seconds > 0 && now - cache->last_full >= cache->refresh_seconds)) {
+        cache->full_requested = 0;
+        cache->full = 1;
+        cache->last_full = now;
+    }
+    return cache->full;
+}
+
+int delta_cache_update(DeltaCache* cache, int pin, double value) {
+    if (pin < 0 || pin >= cache->pin_count) {
+        return 1;
+    }
+    cache->checked++;
+    if (!cache->full && cache->sent[pin] && fabs(value - cache->values[pin]) <= cache->epsilon) {
+        cache->skipped++;
+        return 0;
+    }
+    cache->values[pin] = value;
+    cache->sent[pin] = 1;
+    return 1;
+}
+
+void delta_cache_request_full(DeltaCache* cache) {
+    cache->full_requested = 1;
+}
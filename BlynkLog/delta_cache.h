@@ -0,0 +1,37 @@
+#ifndef DELTA_CACHE_H
+#define DELTA_CACHE_H
+
+#include <stdint.h>
+#include <time.h>
+
+#define DELTA_CACHE_DEFAULT_EPSILON      0.01
+#define DELTA_CACHE_DEFAULT_REFRESH_SECS 300
+
+// Last value sent on each virtual pin, so unchanged datastreams can be skipped
+typedef struct {
+    double* values;
+    uint8_t* sent;              // values[pin] is meaningful
+    int pin_count;
+    double epsilon;             // Changes at or below this are not resent
+    int refresh_seconds;        // Full resend interval, 0 to disable
+    time_t last_full;
+    volatile int full_requested; // Set from other threads, e.g. after a reconnect
+    int full;                   // The current update resends everything
+    uint64_t checked;
+    uint64_t skipped;
+} DeltaCache;
+
+int delta_cache_init(DeltaCache* cache, int pin_count, double epsilon, int refresh_seconds);
+void delta_cache_free(DeltaCache* cache);
+
+// Starts one table update. Returns 1 when it is a full refresh, either
+// because the interval ran out or one was requested.
+int delta_cache_begin(DeltaCache* cache, time_t now);
+
+// Returns 1 and records 'value' if the pin has to be sent in this update
+int delta_cache_update(DeltaCache* cache, int pin, double value);
+
+// Makes the next update a full refresh. Safe to call from any thread.
+void delta_cache_request_full(DeltaCache* cache);
+
+#endif // DELTA_CACHE_H
@@ -0,0 +1,208 @@
+#include "latency_trace.h"
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+
+static const char* stage_names[LATENCY_STAGE_COUNT] = {
+    "debounce",
+    "to_service",
+    "service_queue",
+    "query",
+    "build",
+    "to_blynklog",
+    "parse",
+    "fan_out",
+    "publish",
+    "total",
+};
+
+void latency_histogram_record(LatencyHistogram* histogram, uint64_t us) {
+    int bucket = 0;
+
+    while (bucket < LATENCY_HISTOGRAM_BUCKETS - 1 && us >= (1ULL << bucket)) {
+        bucket++;
+    }
+    histogram->count++;
+    histogram->sum_us += us;
+    if (us > histogram->max_us) {
+        histogram->max_us = us;
+    }
+    histogram->buckets[bucket]++;
+}
+
+// Clock skew between the processes can make a stage look negative
+static void record(LatencyTrace* trace, LatencyStage stage, int64_t from_us, int64_t to_us) {
+    latency_histogram_record(&trace->stages[stage], to_us > from_us ? (uint64_t)(to_us - from_us) : 0);
+}
+
+// snprintf()s onto the end of 'buffer'; returns 0 once it no longer fits
+static int append(char* buffer, size_t size, size_t* used, const char* format, ...) {
+    va_list args;
+    int n;
+
+    if (*used >= size) {
+        return 0;
+    }
+    va_start(args, format);
+    n = vsnprintf(buffer + *used, size - *used, format, args);
+    va_end(args);
+    if (n < 0 || (size_t)n >= size - *used) {
+        return 0;
+    }
+    *used += n;
+    return 1;
+}
+
+int latency_histogram_append_json(const LatencyHistogram* histogram, char* buffer, size_t size, size_t* used) {
+    int ok = append(buffer, size, used, "{\"count\":%llu,\"sumUs\":%llu,\"maxUs\":%llu,\"buckets\":[",
+                    (unsigned long long)histogram->count, (unsigned long long)histogram->sum_us,
+                    (unsigned long long)histogram->max_us);
+
+    for (int b = 0; ok && b < LATENCY_HISTOGRAM_BUCKETS; b++) {
+        ok = append(buffer, size, used, "%s%llu", b > 0 ? "," : "", (unsigned long long)histogram->buckets[b]);
+    }
+    return ok && append(buffer, size, used, "]}");
+}
+
+// Records the last two stages once the result is out everywhere. Lock held.
+static void finish_if_done(LatencyTrace* trace, int64_t now_us) {
+    if (trace->request_id == 0 || trace->fanned_out_us == 0 || trace->fanning_out || trace->pending > 0) {
+        return;
+    }
+    record(trace, LATENCY_STAGE_PUBLISH, trace->fanned_out_us, now_us);
+    record(trace, LATENCY_STAGE_TOTAL, trace->start_us, now_us);
+    trace->completed++;
+    trace->request_id = 0;
+}
+
+void latency_trace_init(LatencyTrace* trace) {
+    memset(trace, 0, sizeof(LatencyTrace));
+    pthread_mutex_init(&trace->lock, NULL);
+}
+
+void latency_trace_destroy(LatencyTrace* trace) {
+    pthread_mutex_destroy(&trace->lock);
+}
+
+int64_t latency_trace_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+void latency_trace_selected(LatencyTrace* trace) {
+    int64_t now_us = latency_trace_now_us();
+
+    pthread_mutex_lock(&trace->lock);
+    trace->selected_us = now_us;
+    pthread_mutex_unlock(&trace->lock);
+}
+
+void latency_trace_sent(LatencyTrace* trace, uint32_t request_id) {
+    int64_t now_us = latency_trace_now_us();
+
+    pthread_mutex_lock(&trace->lock);
+    if (trace->request_id != 0) {
+        trace->abandoned++;
+    }
+    trace->request_id = request_id;
+    trace->start_us = trace->selected_us != 0 ? trace->selected_us : now_us;
+    trace->selected_us = 0;
+    trace->sent_us = now_us;
+    trace->fanned_out_us = 0;
+    trace->fanning_out = 0;
+    trace->pending = 0;
+    record(trace, LATENCY_STAGE_DEBOUNCE, trace->start_us, now_us);
+    pthread_mutex_unlock(&trace->lock);
+}
+
+int latency_trace_result(LatencyTrace* trace, const WatertableTrace* echo, int64_t arrived_us, int64_t parsed_us) {
+    pthread_mutex_lock(&trace->lock);
+    if (echo->request_id == 0 || echo->request_id != trace->request_id || trace->fanning_out || trace->fanned_out_us != 0) {
+        pthread_mutex_unlock(&trace->lock);
+        return 0;
+    }
+    // A service that does not report a stage leaves it out of the histograms
+    if (echo->received_us != 0 && echo->query_start_us != 0 && echo->query_end_us != 0 && echo->encode_start_us != 0) {
+        record(trace, LATENCY_STAGE_TO_SERVICE, trace->sent_us, echo->received_us);
+        record(trace, LATENCY_STAGE_SERVICE_QUEUE, echo->received_us, echo->query_start_us);
+        record(trace, LATENCY_STAGE_QUERY, echo->query_start_us, echo->query_end_us);
+        record(trace, LATENCY_STAGE_BUILD, echo->query_end_us, echo->encode_start_us);
+        record(trace, LATENCY_STAGE_TO_BLYNKLOG, echo->encode_start_us, arrived_us);
+    }
+    record(trace, LATENCY_STAGE_PARSE, arrived_us, parsed_us);
+    trace->parsed_us = parsed_us;
+    trace->fanning_out = 1;
+    pthread_mutex_unlock(&trace->lock);
+    return 1;
+}
+
+void latency_trace_queued(LatencyTrace* trace, uint32_t request_id) {
+    pthread_mutex_lock(&trace->lock);
+    if (request_id == trace->request_id) {
+        trace->pending++;
+    }
+    pthread_mutex_unlock(&trace->lock);
+}
+
+void latency_trace_published(LatencyTrace* trace, uint32_t request_id) {
+    int64_t now_us = latency_trace_now_us();
+
+    pthread_mutex_lock(&trace->lock);
+    if (request_id == trace->request_id && trace->pending > 0) {
+        trace->pending--;
+        finish_if_done(trace, now_us);
+    }
+    pthread_mutex_unlock(&trace->lock);
+}
+
+void latency_trace_fanned_out(LatencyTrace* trace, uint32_t request_id) {
+    int64_t now_us = latency_trace_now_us();
+
+    pthread_mutex_lock(&trace->lock);
+    if (request_id == trace->request_id && trace->fanning_out) {
+        record(trace, LATENCY_STAGE_FAN_OUT, trace->parsed_us, now_us);
+        trace->fanned_out_us = now_us;
+        trace->fanning_out = 0;
+        finish_if_done(trace, now_us);
+    }
+    pthread_mutex_unlock(&trace->lock);
+}
+
+uint64_t latency_trace_completed(LatencyTrace* trace) {
+    uint64_t completed;
+
+    pthread_mutex_lock(&trace->lock);
+    completed = trace->completed;
+    pthread_mutex_unlock(&trace->lock);
+    return completed;
+}
+
+size_t latency_trace_format_json(LatencyTrace* trace, char* buffer, size_t size) {
+    size_t used = 0;
+    int ok;
+
+    pthread_mutex_lock(&trace->lock);
+    ok = append(buffer, size, &used, "{\"stages\":{");
+    for (int s = 0; ok && s < LATENCY_STAGE_COUNT; s++) {
+        ok = append(buffer, size, &used, "%s\"%s\":", s > 0 ? "," : "", stage_names[s]) &&
+             latency_histogram_append_json(&trace->stages[s], buffer, size, &used);
+    }
+    ok = ok && append(buffer, size, &used, "},\"completed\":%llu,\"abandoned\":%llu}",
+                      (unsigned long long)trace->completed, (unsigned long long)trace->abandoned);
+    pthread_mutex_unlock(&trace->lock);
+    return ok ? used : 0;
+}
+
+void latency_trace_print_summary(LatencyTrace* trace, FILE* out) {
+    pthread_mutex_lock(&trace->lock);
+    fprintf(out, "LatencyTrace: completed=%llu abandoned=%llu\n",
+            (unsigned long long)trace->completed, (unsigned long long)trace->abandoned);
+    for (int s = 0; s < LATENCY_STAGE_COUNT; s++) {
+        const LatencyHistogram* histogram = &trace->stages[s];
+        uint64_t avg_us = histogram->count > 0 ? histogram->sum_us / histogram->count : 0;
+        fprintf(out, "  %-14s count=%llu avg=%.1fms max=%.1fms\n", stage_names[s],
+                (unsigned long long)histogram->count, avg_us / 1000.0, histogram->max_us / 1000.0);
+    }
+    pthread_mutex_unlock(&trace->lock);
+}
@@ -0,0 +1,98 @@
+#ifndef LATENCY_TRACE_H
+#define LATENCY_TRACE_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "watertable.h"
+
+// Power-of-two microsecond buckets, as in mwp_data_service's metrics package:
+// bucket i holds durations below 2^i us that did not fit bucket i-1, and the
+// last one everything slower
+#define LATENCY_HISTOGRAM_BUCKETS 27
+
+// Stages of one TimeWindow selection, from the dashboard to the last batch
+// handed to Blynk. The service stages come from the timestamps it echoes,
+// so they assume both processes share a clock (the same host, or NTP).
+typedef enum {
+    LATENCY_STAGE_DEBOUNCE = 0,     // Last selection to query request sent
+    LATENCY_STAGE_TO_SERVICE,       // Request sent to mwp_data_service receiving it
+    LATENCY_STAGE_SERVICE_QUEUE,    // Received to InfluxDB query start
+    LATENCY_STAGE_QUERY,            // InfluxDB query
+    LATENCY_STAGE_BUILD,            // Table update in the service
+    LATENCY_STAGE_TO_BLYNKLOG,      // Result encoding start to arrival here
+    LATENCY_STAGE_PARSE,            // watertable_extract()
+    LATENCY_STAGE_FAN_OUT,          // Every device's batches queued
+    LATENCY_STAGE_PUBLISH,          // Fan-out done to the last batch published
+    LATENCY_STAGE_TOTAL,            // Selection to the last batch published
+    LATENCY_STAGE_COUNT
+} LatencyStage;
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum_us;
+    uint64_t max_us;
+    uint64_t buckets[LATENCY_HISTOGRAM_BUCKETS];
+} LatencyHistogram;
+
+// Adds one duration to 'histogram'
+void latency_histogram_record(LatencyHistogram* histogram, uint64_t us);
+
+// Writes {"count":..,"sumUs":..,"maxUs":..,"buckets":[..]} at buffer + *used,
+// advancing *used. Returns 0 if it did not fit.
+int latency_histogram_append_json(const LatencyHistogram* histogram, char* buffer, size_t size, size_t* used);
+
+// Follows the newest query request through both processes and keeps a
+// histogram per stage. Only one request is traced at a time; a newer one
+// abandons it, the way the debouncer drops its result.
+typedef struct {
+    pthread_mutex_t lock;
+    LatencyHistogram stages[LATENCY_STAGE_COUNT];
+    uint64_t completed;         // Traces that reached Blynk
+    uint64_t abandoned;         // Superseded or lost on the way
+
+    int64_t selected_us;        // Latest selection, not yet sent
+    uint32_t request_id;        // Traced request, 0 when none
+    int64_t start_us;           // Its selection
+    int64_t sent_us;
+    int64_t parsed_us;
+    int64_t fanned_out_us;      // 0 until every device has queued its batches
+    int fanning_out;            // Result is being fanned out to the devices
+    int pending;                // Tagged batches queued but not yet published
+} LatencyTrace;
+
+void latency_trace_init(LatencyTrace* trace);
+void latency_trace_destroy(LatencyTrace* trace);
+
+// Unix time in microseconds, the clock every timestamp here uses
+int64_t latency_trace_now_us(void);
+
+// A TimeWindow was picked on a dashboard
+void latency_trace_selected(LatencyTrace* trace);
+
+// The query request for the latest selection went out as 'request_id'
+void latency_trace_sent(LatencyTrace* trace, uint32_t request_id);
+
+// A result echoing 'echo' arrived at 'arrived_us' and was parsed by
+// 'parsed_us'. Returns 1 if it answers the traced request; its batches
+// should then be tagged with the request ID until latency_trace_fanned_out().
+int latency_trace_result(LatencyTrace* trace, const WatertableTrace* echo, int64_t arrived_us, int64_t parsed_us);
+
+// A batch tagged 'request_id' was queued, or handed to Blynk (or failed)
+void latency_trace_queued(LatencyTrace* trace, uint32_t request_id);
+void latency_trace_published(LatencyTrace* trace, uint32_t request_id);
+
+// Every device has queued its batches for 'request_id'
+void latency_trace_fanned_out(LatencyTrace* trace, uint32_t request_id);
+
+uint64_t latency_trace_completed(LatencyTrace* trace);
+
+// Writes {"stages": {"<stage>": {"count":..,"sumUs":..,"maxUs":..,"buckets":[..]}, ..},
+// "completed":.., "abandoned":..}. Returns its length, or 0 if it did not fit.
+size_t latency_trace_format_json(LatencyTrace* trace, char* buffer, size_t size);
+
+// One line per stage with its count, average and maximum
+void latency_trace_print_summary(LatencyTrace* trace, FILE* out);
+
+#endif // LATENCY_TRACE_H
@@ -0,0 +1,61 @@
+#include "offline_store.h"
+#include <stdlib.h>
+#include <string.h>
+
+int offline_store_init(OfflineStore* store, int pin_count) {
+    memset(store, 0, sizeof(OfflineStore));
+    store->values = calloc(pin_count, sizeof(double));
+    store->pending = calloc(pin_count, sizeof(uint8_t));
+    if (store->values == NULL || store->pending == NULL) {
+        fprintf(stderr, "OfflineStore: failed to allocate %d pins\n", pin_count);
+        offline_store_free(store);
+        return -1;
+    }
+    store->pin_count = pin_count;
+    return 0;
+}
+
+void offline_store_free(OfflineStore* store) {
+    free(store->values);
+    free(store->pending);
+    store->values = NULL;
+    store->pending = NULL;
+    store->pin_count = 0;
+    store->count = 0;
+}
+
+void offline_store_put(OfflineStore* store, int pin, double value) {
+    if (pin < 0 || pin >= store->pin_count) {
+        return;
+    }
+    store->stored++;
+    if (store->pending[pin]) {
+        store->coalesced++;
+    } else {
+        store->pending[pin] = 1;
+        store->count++;
+    }
+    store->values[pin] = value;
+}
+
+int offline_store_take(OfflineStore* store, int pin, double* value) {
+    if (pin < 0) {
+        pin = 0;
+    }
+    for (; store->count > 0 && pin < store->pin_count; pin++) {
+        if (store->pending[pin]) {
+            store->pending[pin] = 0;
+            store->count--;
+            store->flushed++;
+            *value = store->values[pin];
+            return pin;
+        }
+    }
+    return -1;
+}
+
+void offline_store_print_stats(const OfflineStore* store, const char* name, FILE* out) {
+    fprintf(out, "OfflineStore %s: pending=%d stored=%llu coalesced=%llu flushed=%llu\n",
+            name, store->count, (unsigned long long)store->stored,
+            (unsigned long long)store->coalesced, (unsigned long long)store->flushed);
+}
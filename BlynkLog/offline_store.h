@@ -0,0 +1,37 @@
+#ifndef OFFLINE_STORE_H
+#define OFFLINE_STORE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+// Newest value per virtual pin while a device cannot publish. Updates to a
+// pin that is already pending replace its value, so after a reconnect each
+// datastream goes out once instead of every missed update being replayed.
+// Its size is fixed by the pin count, however long the outage lasts.
+typedef struct {
+    double* values;
+    uint8_t* pending;           // values[pin] still has to be sent
+    int pin_count;
+    int count;                  // Pins pending
+    uint64_t stored;
+    uint64_t coalesced;         // Stores that replaced a pending value
+    uint64_t flushed;
+} OfflineStore;
+
+int offline_store_init(OfflineStore* store, int pin_count);
+void offline_store_free(OfflineStore* store);
+
+// Makes 'value' the one to send for 'pin'. Pins out of range are ignored.
+void offline_store_put(OfflineStore* store, int pin, double value);
+
+// Returns the first pending pin at or after 'pin', or -1 if there is none,
+// and removes it from the store, setting 'value'
+int offline_store_take(OfflineStore* store, int pin, double* value);
+
+static inline int offline_store_count(const OfflineStore* store) {
+    return store->count;
+}
+
+void offline_store_print_stats(const OfflineStore* store, const char* name, FILE* out);
+
+#endif // OFFLINE_STORE_H
@@ -0,0 +1,230 @@
+#include "publish_queue.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// How long to wait before asking a disconnected transport again
+#define PUBLISH_RETRY_MS 500
+
+struct PublishItem {
+    char topic[PUBLISH_QUEUE_TOPIC_MAX];
+    char payload[PUBLISH_QUEUE_PAYLOAD_MAX];
+    int len;
+    uint32_t tag;
+    uint64_t seq;
+    int64_t enqueued_ns;
+};
+
+static int64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Waits on the queue's condvar until 'deadline_ns', or a push/stop. Lock held.
+static void wait_until(PublishQueue* queue, int64_t deadline_ns) {
+    struct timespec ts;
+    ts.tv_sec = deadline_ns / 1000000000LL;
+    ts.tv_nsec = deadline_ns % 1000000000LL;
+    pthread_cond_timedwait(&queue->cond, &queue->lock, &ts);
+}
+
+static void refill(PublishQueue* queue, int64_t now_ns) {
+    queue->tokens += (now_ns - queue->refill_ns) * queue->config.rate / 1e9;
+    if (queue->tokens > queue->config.burst) {
+        queue->tokens = queue->config.burst;
+    }
+    queue->refill_ns = now_ns;
+}
+
+static void* sender_main(void* arg) {
+    PublishQueue* queue = arg;
+    PublishItem item;
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->running) {
+        if (queue->count == 0) {
+            pthread_cond_wait(&queue->cond, &queue->lock);
+            continue;
+        }
+
+        // Token bucket: sleep until the next token is due
+        int64_t now_ns = monotonic_ns();
+        refill(queue, now_ns);
+        if (queue->tokens < 1.0) {
+            wait_until(queue, now_ns + (int64_t)((1.0 - queue->tokens) * 1e9 / queue->config.rate) + 1);
+            continue;
+        }
+
+        // Publish a copy so producers can keep pushing meanwhile
+        item = queue->items[queue->head];
+        pthread_mutex_unlock(&queue->lock);
+        PublishResult result = queue->publish(queue->context, item.topic, item.payload, item.len, item.tag);
+        int64_t done_ns = monotonic_ns();
+        pthread_mutex_lock(&queue->lock);
+
+        if (result == PUBLISH_RETRY) {
+            // Leave it at the head; it may have been dropped for space meanwhile, which is fine
+            queue->stats.retries++;
+            wait_until(queue, done_ns + PUBLISH_RETRY_MS * 1000000LL);
+            continue;
+        }
+        // The head may have moved if the queue overflowed while unlocked
+        if (queue->count > 0 && queue->items[queue->head].seq == item.seq) {
+            queue->head = (queue->head + 1) % queue->capacity;
+            queue->count--;
+        }
+        queue->tokens -= 1.0;
+        if (result == PUBLISH_OK) {
+            uint64_t latency_us = (done_ns - item.enqueued_ns) / 1000;
+            queue->stats.published++;
+            queue->stats.latency_count++;
+            queue->stats.latency_sum_us += latency_us;
+            if (latency_us > queue->stats.latency_max_us) {
+                queue->stats.latency_max_us = latency_us;
+            }
+        } else {
+            queue->stats.failed++;
+        }
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return NULL;
+}
+
+int publish_queue_start(PublishQueue* queue, const PublishQueueConfig* config, PublishFn publish, void* context) {
+    pthread_condattr_t attr;
+
+    memset(queue, 0, sizeof(PublishQueue));
+    if (config != NULL) {
+        queue->config = *config;
+    } else {
+        queue->config.rate = PUBLISH_QUEUE_DEFAULT_RATE;
+        queue->config.burst = PUBLISH_QUEUE_DEFAULT_BURST;
+        queue->config.depth = PUBLISH_QUEUE_DEFAULT_DEPTH;
+    }
+    if (queue->config.rate <= 0) {
+        queue->config.rate = PUBLISH_QUEUE_DEFAULT_RATE;
+    }
+    if (queue->config.burst < 1) {
+        queue->config.burst = 1;
+    }
+    if (queue->config.depth < 1) {
+        queue->config.depth = PUBLISH_QUEUE_DEFAULT_DEPTH;
+    }
+
+    queue->items = calloc(queue->config.depth, sizeof(PublishItem));
+    if (queue->items == NULL) {
+        fprintf(stderr, "PublishQueue: failed to allocate %d entries\n", queue->config.depth);
+        return -1;
+    }
+    queue->capacity = queue->config.depth;
+    queue->publish = publish;
+    queue->context = context;
+    queue->tokens = queue->config.burst;
+    queue->refill_ns = monotonic_ns();
+
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&queue->cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    queue->running = 1;
+    if (pthread_create(&queue->thread, NULL, sender_main, queue) != 0) {
+        fprintf(stderr, "PublishQueue: failed to start sender thread\n");
+        queue->running = 0;
+        free(queue->items);
+        queue->items = NULL;
+        pthread_cond_destroy(&queue->cond);
+        pthread_mutex_destroy(&queue->lock);
+        return -1;
+    }
+    return 0;
+}
+
+int publish_queue_push(PublishQueue* queue, const char* topic, const void* payload, int len, uint32_t tag) {
+    PublishItem* item;
+    int evicted = 0;
+
+    pthread_mutex_lock(&queue->lock);
+    if (!queue->running || len < 0 || len > PUBLISH_QUEUE_PAYLOAD_MAX || strlen(topic) >= PUBLISH_QUEUE_TOPIC_MAX) {
+        queue->stats.dropped++;
+        pthread_mutex_unlock(&queue->lock);
+        return -1;
+    }
+    if (queue->count == queue->capacity) {
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+        queue->stats.dropped++;
+        evicted = 1;
+    }
+    item = &queue->items[(queue->head + queue->count) % queue->capacity];
+    strcpy(item->topic, topic);
+    memcpy(item->payload, payload, len);
+    item->len = len;
+    item->tag = tag;
+    item->seq = queue->next_seq++;
+    item->enqueued_ns = monotonic_ns();
+    queue->count++;
+    queue->stats.enqueued++;
+    if (queue->count > queue->stats.max_depth) {
+        queue->stats.max_depth = queue->count;
+    }
+    pthread_cond_signal(&queue->cond);
+    pthread_mutex_unlock(&queue->lock);
+    return evicted;
+}
+
+int publish_queue_discard(PublishQueue* queue) {
+    int discarded;
+
+    // A message the sender is publishing right now is not affected; it
+    // checks the head's sequence number before removing it
+    pthread_mutex_lock(&queue->lock);
+    discarded = queue->count;
+    queue->head = (queue->head + queue->count) % queue->capacity;
+    queue->count = 0;
+    queue->stats.dropped += discarded;
+    pthread_mutex_unlock(&queue->lock);
+    return discarded;
+}
+
+void publish_queue_get_stats(PublishQueue* queue, PublishQueueStats* stats) {
+    pthread_mutex_lock(&queue->lock);
+    *stats = queue->stats;
+    stats->depth = queue->count;
+    pthread_mutex_unlock(&queue->lock);
+}
+
+void publish_queue_print_stats(PublishQueue* queue, const char* name, FILE* out) {
+    PublishQueueStats stats;
+
+    publish_queue_get_stats(queue, &stats);
+    fprintf(out, "PublishQueue %s: depth=%d max_depth=%d enqueued=%llu published=%llu failed=%llu dropped=%llu retries=%llu\n",
+            name, stats.depth, stats.max_depth, (unsigned long long)stats.enqueued,
+            (unsigned long long)stats.published, (unsigned long long)stats.failed,
+            (unsigned long long)stats.dropped, (unsigned long long)stats.retries);
+    if (stats.latency_count > 0) {
+        fprintf(out, "  publish latency: avg=%lluus max=%lluus\n",
+                (unsigned long long)(stats.latency_sum_us / stats.latency_count),
+                (unsigned long long)stats.latency_max_us);
+    }
+}
+
+void publish_queue_stop(PublishQueue* queue) {
+    pthread_mutex_lock(&queue->lock);
+    if (!queue->running) {
+        pthread_mutex_unlock(&queue->lock);
+        return;
+    }
+    queue->running = 0;
+    queue->stats.dropped += queue->count;
+    queue->count = 0;
+    pthread_cond_signal(&queue->cond);
+    pthread_mutex_unlock(&queue->lock);
+    pthread_join(queue->thread, NULL);
+
+    free(queue->items);
+    queue->items = NULL;
+    pthread_cond_destroy(&queue->cond);
+}
@@ -0,0 +1,93 @@
+#ifndef PUBLISH_QUEUE_H
+#define PUBLISH_QUEUE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define PUBLISH_QUEUE_TOPIC_MAX   128
+#define PUBLISH_QUEUE_PAYLOAD_MAX 2048
+
+#define PUBLISH_QUEUE_DEFAULT_RATE  4.0  // Messages per second, the old 250 ms spacing
+#define PUBLISH_QUEUE_DEFAULT_BURST 2    // Messages that may go out back to back
+#define PUBLISH_QUEUE_DEFAULT_DEPTH 32
+
+// Result of a PublishFn call
+typedef enum {
+    PUBLISH_OK = 0,
+    PUBLISH_RETRY,      // Not connected right now, keep the message and try again
+    PUBLISH_FAILED      // Give up on this message
+} PublishResult;
+
+// Hands one message to the transport, along with the tag it was pushed
+// with. Called on the sender thread only.
+typedef PublishResult (*PublishFn)(void* context, const char* topic, const void* payload, int len, uint32_t tag);
+
+typedef struct {
+    double rate;            // Token refill per second
+    int burst;              // Bucket size
+    int depth;              // Queued messages before the oldest is dropped
+} PublishQueueConfig;
+
+typedef struct {
+    uint64_t enqueued;
+    uint64_t published;
+    uint64_t failed;        // Transport rejected the message
+    uint64_t dropped;       // Overflowed the queue or too large to queue
+    uint64_t retries;       // Waits for the transport to come back
+    int depth;              // Currently queued
+    int max_depth;
+    uint64_t latency_count; // Enqueue to hand-off, published messages only
+    uint64_t latency_sum_us;
+    uint64_t latency_max_us;
+} PublishQueueStats;
+
+typedef struct PublishItem PublishItem;
+
+// One rate limited sender. Each Blynk device gets its own, since Blynk
+// enforces its limits per device.
+typedef struct {
+    PublishItem* items;
+    int capacity;
+    int head;               // Next item to send
+    int count;
+    uint64_t next_seq;
+
+    PublishQueueConfig config;
+    PublishFn publish;
+    void* context;
+
+    double tokens;
+    int64_t refill_ns;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int running;
+
+    PublishQueueStats stats;
+} PublishQueue;
+
+// Starts the sender thread. 'publish' is called for every message in order,
+// no faster than config->rate allows. A NULL config uses the defaults above.
+int publish_queue_start(PublishQueue* queue, const PublishQueueConfig* config, PublishFn publish, void* context);
+
+// Copies the message into the queue and returns without waiting. When the
+// queue is full the oldest message is dropped to make room, since a newer
+// table update supersedes it. 'tag' is passed through to the PublishFn
+// untouched, e.g. to tell when a traced update is out; 0 for none.
+// Returns 0 once queued, 1 if queued but the oldest message was dropped for
+// it, or -1 if the message cannot be queued.
+int publish_queue_push(PublishQueue* queue, const char* topic, const void* payload, int len, uint32_t tag);
+
+// Drops every queued message, e.g. batches held across a disconnect that
+// newer values supersede. Returns how many were dropped.
+int publish_queue_discard(PublishQueue* queue);
+
+void publish_queue_get_stats(PublishQueue* queue, PublishQueueStats* stats);
+void publish_queue_print_stats(PublishQueue* queue, const char* name, FILE* out);
+
+// Stops the sender; messages still queued are discarded
+void publish_queue_stop(PublishQueue* queue);
+
+#endif // PUBLISH_QUEUE_H
@@ -0,0 +1,185 @@
+#include "query_debouncer.h"
+#include <string.h>
+#include <time.h>
+
+static int64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void* debouncer_main(void* arg) {
+    QueryDebouncer* debouncer = arg;
+    char range[QUERY_DEBOUNCER_RANGE_MAX];
+    uint32_t request_id;
+
+    pthread_mutex_lock(&debouncer->lock);
+    while (debouncer->running) {
+        if (!debouncer->has_pending) {
+            pthread_cond_wait(&debouncer->cond, &debouncer->lock);
+            continue;
+        }
+
+        // Every new selection pushes the deadline back, so wait it out again
+        int64_t now_ns = monotonic_ns();
+        if (now_ns < debouncer->pending_due_ns) {
+            struct timespec ts;
+            ts.tv_sec = debouncer->pending_due_ns / 1000000000LL;
+            ts.tv_nsec = debouncer->pending_due_ns % 1000000000LL;
+            pthread_cond_timedwait(&debouncer->cond, &debouncer->lock, &ts);
+            continue;
+        }
+
+        strcpy(range, debouncer->pending);
+        debouncer->has_pending = 0;
+        request_id = debouncer->next_id++;
+        if (debouncer->next_id == 0) {
+            debouncer->next_id = 1;
+        }
+        pthread_mutex_unlock(&debouncer->lock);
+        int rc = debouncer->send(debouncer->context, range, request_id);
+        pthread_mutex_lock(&debouncer->lock);
+
+        if (rc == 0) {
+            debouncer->in_flight++;
+            debouncer->sent_ns = monotonic_ns();
+            debouncer->sent_id = request_id;
+            strcpy(debouncer->sent_range, range);
+            debouncer->want_sent = 1;
+            debouncer->stats.sent++;
+        }
+    }
+    pthread_mutex_unlock(&debouncer->lock);
+    return NULL;
+}
+
+int query_debouncer_start(QueryDebouncer* debouncer, const QueryDebounceConfig* config, QuerySendFn send, void* context) {
+    pthread_condattr_t attr;
+
+    memset(debouncer, 0, sizeof(QueryDebouncer));
+    if (config != NULL) {
+        debouncer->config = *config;
+    } else {
+        debouncer->config.debounce_ms = QUERY_DEBOUNCER_DEFAULT_DEBOUNCE_MS;
+        debouncer->config.result_timeout_ms = QUERY_DEBOUNCER_DEFAULT_RESULT_TIMEOUT_MS;
+    }
+    if (debouncer->config.debounce_ms < 0) {
+        debouncer->config.debounce_ms = 0;
+    }
+    if (debouncer->config.result_timeout_ms <= 0) {
+        debouncer->config.result_timeout_ms = QUERY_DEBOUNCER_DEFAULT_RESULT_TIMEOUT_MS;
+    }
+    debouncer->send = send;
+    debouncer->context = context;
+    debouncer->next_id = 1;
+
+    pthread_mutex_init(&debouncer->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&debouncer->cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    debouncer->running = 1;
+    if (pthread_create(&debouncer->thread, NULL, debouncer_main, debouncer) != 0) {
+        fprintf(stderr, "QueryDebouncer: failed to start thread\n");
+        debouncer->running = 0;
+        pthread_cond_destroy(&debouncer->cond);
+        pthread_mutex_destroy(&debouncer->lock);
+        return -1;
+    }
+    return 0;
+}
+
+void query_debouncer_select(QueryDebouncer* debouncer, const char* range) {
+    pthread_mutex_lock(&debouncer->lock);
+    debouncer->stats.selections++;
+    if (debouncer->has_pending) {
+        debouncer->stats.coalesced++;
+    }
+    snprintf(debouncer->pending, sizeof(debouncer->pending), "%s", range);
+    debouncer->has_pending = 1;
+    debouncer->pending_due_ns = monotonic_ns() + debouncer->config.debounce_ms * 1000000LL;
+    pthread_cond_signal(&debouncer->cond);
+    pthread_mutex_unlock(&debouncer->lock);
+}
+
+void query_debouncer_settle(QueryDebouncer* debouncer) {
+    pthread_mutex_lock(&debouncer->lock);
+    if (debouncer->has_pending) {
+        debouncer->stats.coalesced++;
+        debouncer->has_pending = 0;
+    }
+    debouncer->want_sent = 0;
+    pthread_mutex_unlock(&debouncer->lock);
+}
+
+int query_debouncer_accept_result(QueryDebouncer* debouncer, uint32_t request_id, char* range, size_t range_size) {
+    int accept;
+
+    range[0] = '\0';
+    pthread_mutex_lock(&debouncer->lock);
+    if (debouncer->in_flight > 0 &&
+        monotonic_ns() - debouncer->sent_ns > debouncer->config.result_timeout_ms * 1000000LL) {
+        debouncer->stats.timeouts += debouncer->in_flight;
+        debouncer->in_flight = 0;
+    }
+    if (request_id != 0) {
+        if (request_id == debouncer->sent_id) {
+            // The newest query's result, possibly after it timed out; older
+            // queries still counted will not be answered after it
+            debouncer->in_flight = 0;
+            accept = debouncer->want_sent && !debouncer->has_pending;
+            snprintf(range, range_size, "%s", debouncer->sent_range);
+        } else {
+            // Echoes an older query, or one already given up on
+            if (debouncer->in_flight > 0) {
+                debouncer->in_flight--;
+            }
+            accept = 0;
+        }
+    } else if (debouncer->in_flight > 1) {
+        // The data service answers in order, so this is an older query's result
+        debouncer->in_flight--;
+        accept = 0;
+    } else if (debouncer->in_flight == 1) {
+        debouncer->in_flight = 0;
+        // A selection about to go out, or one answered without a query,
+        // makes this result stale too
+        accept = debouncer->want_sent && !debouncer->has_pending;
+        snprintf(range, range_size, "%s", debouncer->sent_range);
+    } else {
+        // Not asked for, e.g. the service's startup or "now" mode updates
+        accept = !debouncer->has_pending;
+    }
+    if (!accept) {
+        debouncer->stats.superseded++;
+    }
+    pthread_mutex_unlock(&debouncer->lock);
+    return accept;
+}
+
+void query_debouncer_print_stats(QueryDebouncer* debouncer, FILE* out) {
+    QueryDebouncerStats stats;
+
+    pthread_mutex_lock(&debouncer->lock);
+    stats = debouncer->stats;
+    pthread_mutex_unlock(&debouncer->lock);
+    fprintf(out, "QueryDebouncer: selections=%llu sent=%llu coalesced=%llu superseded=%llu timeouts=%llu\n",
+            (unsigned long long)stats.selections, (unsigned long long)stats.sent,
+            (unsigned long long)stats.coalesced, (unsigned long long)stats.superseded,
+            (unsigned long long)stats.timeouts);
+}
+
+void query_debouncer_stop(QueryDebouncer* debouncer) {
+    pthread_mutex_lock(&debouncer->lock);
+    if (!debouncer->running) {
+        pthread_mutex_unlock(&debouncer->lock);
+        return;
+    }
+    debouncer->running = 0;
+    debouncer->has_pending = 0;
+    pthread_cond_signal(&debouncer->cond);
+    pthread_mutex_unlock(&debouncer->lock);
+    pthread_join(debouncer->thread, NULL);
+    pthread_cond_destroy(&debouncer->cond);
+}
@@ -0,0 +1,81 @@
+#ifndef QUERY_DEBOUNCER_H
+#define QUERY_DEBOUNCER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define QUERY_DEBOUNCER_RANGE_MAX 32
+
+#define QUERY_DEBOUNCER_DEFAULT_DEBOUNCE_MS 400      // Quiet time after the last menu change
+#define QUERY_DEBOUNCER_DEFAULT_RESULT_TIMEOUT_MS 30000
+
+// Sends one query request for 'range', tagged with 'request_id' for the
+// service to echo in its result. Called on the debouncer thread only.
+// Returns 0 once the request is on its way.
+typedef int (*QuerySendFn)(void* context, const char* range, uint32_t request_id);
+
+typedef struct {
+    int debounce_ms;        // Selections closer together than this collapse into the last one
+    int result_timeout_ms;  // A sent query whose result takes longer is no longer waited for
+} QueryDebounceConfig;
+
+typedef struct {
+    uint64_t selections;    // Time windows picked on a dashboard
+    uint64_t sent;          // Query requests that went out
+    uint64_t coalesced;     // Selections replaced by a later one before being sent
+    uint64_t superseded;    // Results dropped because a newer query was sent or pending
+    uint64_t timeouts;      // Sent queries given up on
+} QueryDebouncerStats;
+
+// Collapses bursts of time window selections into one query request, and
+// keeps track of the requests still waiting for a result.
+typedef struct {
+    QueryDebounceConfig config;
+    QuerySendFn send;
+    void* context;
+
+    char pending[QUERY_DEBOUNCER_RANGE_MAX];
+    int has_pending;
+    int64_t pending_due_ns;     // When the pending selection goes out
+
+    int in_flight;              // Sent queries whose results have not arrived
+    int64_t sent_ns;            // When the newest of them was sent
+    uint32_t next_id;           // Request ID for the next query; never 0
+    uint32_t sent_id;           // Request ID of the newest query sent
+    char sent_range[QUERY_DEBOUNCER_RANGE_MAX];
+    int want_sent;              // The newest query's result is still wanted
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int running;
+
+    QueryDebouncerStats stats;
+} QueryDebouncer;
+
+// Starts the debouncer thread. A NULL config uses the defaults above.
+int query_debouncer_start(QueryDebouncer* debouncer, const QueryDebounceConfig* config, QuerySendFn send, void* context);
+
+// Records a selection. It is sent once no other selection has followed for
+// debounce_ms; an earlier selection still waiting is replaced.
+void query_debouncer_select(QueryDebouncer* debouncer, const char* range);
+
+// Drops any selection still waiting, and the results of queries already
+// sent, for when the latest selection was answered without a query
+void query_debouncer_settle(QueryDebouncer* debouncer);
+
+// Call for every query result that arrives, with the request ID it echoes
+// or 0 if it has none. Returns 1 if it should be published, or 0 if it
+// answers a query that a newer one supersedes. When it answers the newest
+// query sent, wanted or not, that query's range is copied to 'range',
+// otherwise 'range' is set empty. Results without an ID are matched to
+// queries by arrival order.
+int query_debouncer_accept_result(QueryDebouncer* debouncer, uint32_t request_id, char* range, size_t range_size);
+
+void query_debouncer_print_stats(QueryDebouncer* debouncer, FILE* out);
+
+// Stops the thread; a selection still waiting is discarded
+void query_debouncer_stop(QueryDebouncer* debouncer);
+
+#endif // QUERY_DEBOUNCER_H
@@ -0,0 +1,158 @@
+#include "reconnect.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+int64_t reconnect_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+// Schedules the next attempt 'delay_ms' out, less a random share. Lock held.
+static void schedule(ReconnectState* state, int64_t now_us) {
+    double r = rand_r(&state->seed) / ((double)RAND_MAX + 1.0);
+    double delay_us = state->delay_ms * 1000.0 * (1.0 - state->config.jitter * r);
+
+    state->next_attempt_us = now_us + (int64_t)delay_us;
+}
+
+void reconnect_init(ReconnectState* state, const ReconnectConfig* config, unsigned int seed) {
+    memset(state, 0, sizeof(ReconnectState));
+    if (config != NULL) {
+        state->config = *config;
+    } else {
+        state->config.initial_ms = RECONNECT_DEFAULT_INITIAL_MS;
+        state->config.max_ms = RECONNECT_DEFAULT_MAX_MS;
+        state->config.multiplier = RECONNECT_DEFAULT_MULTIPLIER;
+        state->config.jitter = RECONNECT_DEFAULT_JITTER;
+    }
+    if (state->config.initial_ms < 1) {
+        state->config.initial_ms = RECONNECT_DEFAULT_INITIAL_MS;
+    }
+    if (state->config.max_ms < state->config.initial_ms) {
+        state->config.max_ms = state->config.initial_ms;
+    }
+    if (state->config.multiplier < 1.0) {
+        state->config.multiplier = 1.0;
+    }
+    if (state->config.jitter < 0.0 || state->config.jitter > 1.0) {
+        state->config.jitter = RECONNECT_DEFAULT_JITTER;
+    }
+    state->delay_ms = state->config.initial_ms;
+    state->seed = seed;
+    pthread_mutex_init(&state->lock, NULL);
+}
+
+void reconnect_destroy(ReconnectState* state) {
+    pthread_mutex_destroy(&state->lock);
+}
+
+void reconnect_lost(ReconnectState* state, int64_t now_us) {
+    pthread_mutex_lock(&state->lock);
+    if (state->connected) {
+        state->connected = 0;
+        state->outages++;
+        state->lost_us = now_us;
+        state->delay_ms = state->config.initial_ms;
+        schedule(state, now_us);
+    }
+    pthread_mutex_unlock(&state->lock);
+}
+
+int reconnect_due(ReconnectState* state, int64_t now_us) {
+    int due;
+
+    pthread_mutex_lock(&state->lock);
+    due = !state->connected && now_us >= state->next_attempt_us;
+    pthread_mutex_unlock(&state->lock);
+    return due;
+}
+
+int64_t reconnect_next_attempt(ReconnectState* state) {
+    int64_t next_us;
+
+    pthread_mutex_lock(&state->lock);
+    next_us = state->connected ? 0 : state->next_attempt_us;
+    pthread_mutex_unlock(&state->lock);
+    return next_us;
+}
+
+void reconnect_failed(ReconnectState* state, int64_t now_us) {
+    pthread_mutex_lock(&state->lock);
+    state->attempts++;
+    state->failures++;
+    schedule(state, now_us);
+    // Grown after scheduling, so the first retry waits the initial delay
+    if (state->delay_ms < state->config.max_ms) {
+        double next_ms = state->delay_ms * state->config.multiplier;
+        state->delay_ms = next_ms < state->config.max_ms ? (int)next_ms : state->config.max_ms;
+    }
+    pthread_mutex_unlock(&state->lock);
+}
+
+void reconnect_succeeded(ReconnectState* state, int64_t started_us, int64_t now_us) {
+    pthread_mutex_lock(&state->lock);
+    state->attempts++;
+    latency_histogram_record(&state->connect, now_us > started_us ? (uint64_t)(now_us - started_us) : 0);
+    if (state->lost_us != 0) {
+        latency_histogram_record(&state->outage, now_us > state->lost_us ? (uint64_t)(now_us - state->lost_us) : 0);
+    }
+    state->connected = 1;
+    state->lost_us = 0;
+    state->delay_ms = state->config.initial_ms;
+    pthread_mutex_unlock(&state->lock);
+}
+
+uint64_t reconnect_attempts(ReconnectState* state) {
+    uint64_t attempts;
+
+    pthread_mutex_lock(&state->lock);
+    attempts = state->attempts;
+    pthread_mutex_unlock(&state->lock);
+    return attempts;
+}
+
+size_t reconnect_format_json(ReconnectState* state, char* buffer, size_t size) {
+    size_t used;
+    int n, ok;
+
+    pthread_mutex_lock(&state->lock);
+    n = snprintf(buffer, size, "{\"connected\":%d,\"outages\":%llu,\"attempts\":%llu,\"failures\":%llu,\"outage\":",
+                 state->connected, (unsigned long long)state->outages,
+                 (unsigned long long)state->attempts, (unsigned long long)state->failures);
+    ok = n > 0 && (size_t)n < size;
+    used = ok ? (size_t)n : 0;
+    ok = ok && latency_histogram_append_json(&state->outage, buffer, size, &used);
+    if (ok && used + sizeof(",\"connect\":") <= size) {
+        memcpy(buffer + used, ",\"connect\":", sizeof(",\"connect\":"));
+        used += sizeof(",\"connect\":") - 1;
+    } else {
+        ok = 0;
+    }
+    ok = ok && latency_histogram_append_json(&state->connect, buffer, size, &used);
+    if (ok && used + 2 <= size) {
+        buffer[used++] = '}';
+        buffer[used] = '\0';
+    } else {
+        ok = 0;
+    }
+    pthread_mutex_unlock(&state->lock);
+    return ok ? used : 0;
+}
+
+void reconnect_print_stats(ReconnectState* state, const char* name, FILE* out) {
+    pthread_mutex_lock(&state->lock);
+    fprintf(out, "Reconnect %s: connected=%d outages=%llu attempts=%llu failures=%llu\n",
+            name, state->connected, (unsigned long long)state->outages,
+            (unsigned long long)state->attempts, (unsigned long long)state->failures);
+    if (state->outage.count > 0) {
+        fprintf(out, "  outage: avg=%.1fs max=%.1fs\n",
+                state->outage.sum_us / state->outage.count / 1e6, state->outage.max_us / 1e6);
+    }
+    if (state->connect.count > 0) {
+        fprintf(out, "  connect: avg=%.1fms max=%.1fms\n",
+                state->connect.sum_us / state->connect.count / 1e3, state->connect.max_us / 1e3);
+    }
+    pthread_mutex_unlock(&state->lock);
+}
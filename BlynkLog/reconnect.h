@@ -0,0 +1,74 @@
+#ifndef RECONNECT_H
+#define RECONNECT_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "latency_trace.h"
+
+#define RECONNECT_DEFAULT_INITIAL_MS 1000
+#define RECONNECT_DEFAULT_MAX_MS     60000
+#define RECONNECT_DEFAULT_MULTIPLIER 2.0
+#define RECONNECT_DEFAULT_JITTER     0.5
+
+typedef struct {
+    int initial_ms;         // Delay before the first attempt after a loss
+    int max_ms;             // Cap on the delay between attempts
+    double multiplier;      // Growth of the delay after each failed attempt
+    double jitter;          // Up to this fraction of each delay is taken off at random
+} ReconnectConfig;
+
+// Backoff schedule and outage metrics for one connection. Losses are
+// reported from client callbacks, attempts are made by whoever reconnects,
+// so everything goes through the lock.
+typedef struct {
+    pthread_mutex_t lock;
+    ReconnectConfig config;
+    int connected;
+    int64_t lost_us;            // Start of the current outage, 0 before the first connect
+    int64_t next_attempt_us;
+    int delay_ms;               // Current delay, before jitter
+    unsigned int seed;
+
+    uint64_t outages;
+    uint64_t attempts;
+    uint64_t failures;
+    LatencyHistogram outage;    // Loss to connected again
+    LatencyHistogram connect;   // Successful connect calls, including subscribing
+} ReconnectState;
+
+// Starts out disconnected with an attempt due right away. A NULL config
+// uses the defaults above; 'seed' keeps connections from retrying in step.
+void reconnect_init(ReconnectState* state, const ReconnectConfig* config, unsigned int seed);
+void reconnect_destroy(ReconnectState* state);
+
+// Monotonic microseconds, the clock every time here uses
+int64_t reconnect_now_us(void);
+
+// The connection went down. Schedules the first attempt unless an outage
+// is already under way.
+void reconnect_lost(ReconnectState* state, int64_t now_us);
+
+// Returns 1 if disconnected and an attempt is due
+int reconnect_due(ReconnectState* state, int64_t now_us);
+
+// When the next attempt is due, or 0 while connected
+int64_t reconnect_next_attempt(ReconnectState* state);
+
+// An attempt ended at 'now_us'. A failure grows the delay before the next
+// one; a success records how long the attempt begun at 'started_us' took.
+void reconnect_failed(ReconnectState* state, int64_t now_us);
+void reconnect_succeeded(ReconnectState* state, int64_t started_us, int64_t now_us);
+
+// Attempts made so far, successful or not
+uint64_t reconnect_attempts(ReconnectState* state);
+
+// Writes {"connected":..,"outages":..,"attempts":..,"failures":..,
+// "outage":{histogram},"connect":{histogram}}. Returns its length, or 0 if
+// it did not fit.
+size_t reconnect_format_json(ReconnectState* state, char* buffer, size_t size);
+
+void reconnect_print_stats(ReconnectState* state, const char* name, FILE* out);
+
+#endif // RECONNECT_H
@@ -0,0 +1,542 @@
+#include "watertable.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <json-c/json.h>
+
+// Deepest nesting skip_value() follows before calling the payload malformed
+#define WATERTABLE_MAX_DEPTH 64
+
+typedef enum {
+    FIELD_TOTAL_FLOW = 0,
+    FIELD_TOTAL_SECONDS,
+    FIELD_AVG_PSI,
+    FIELD_GPM,
+    FIELD_COUNT,
+    FIELD_OTHER = -1
+} WatertableField;
+
+static const char* field_names[FIELD_COUNT] = {
+    "totalFlow",
+    "totalSeconds",
+    "avgPSI",
+    "gpm",
+};
+
+typedef struct {
+    const char* p;
+    const char* end;
+} Scanner;
+
+void watertable_index_init(WatertableIndex* index) {
+    memset(index->cell, 0xff, sizeof(index->cell));
+}
+
+int watertable_index_add(WatertableIndex* index, int controller, int zone, int cell) {
+    if (controller < 0 || controller >= WATERTABLE_MAX_CONTROLLERS ||
+        zone < 0 || zone >= WATERTABLE_MAX_ZONES) {
+        return -1;
+    }
+    index->cell[controller][zone] = (int16_t)cell;
+    return 0;
+}
+
+static void skip_ws(Scanner* s) {
+    while (s->p < s->end && (*s->p == ' ' || *s->p == '\n' || *s->p == '\r' || *s->p == '\t')) {
+        s->p++;
+    }
+}
+
+// Consumes 'c' after optional whitespace
+static int accept(Scanner* s, char c) {
+    skip_ws(s);
+    if (s->p < s->end && *s->p == c) {
+        s->p++;
+        return 1;
+    }
+    return 0;
+}
+
+// Scans a string and returns its raw (still escaped) contents in place
+static int scan_string(Scanner* s, const char** text, size_t* len) {
+    if (!accept(s, '"')) {
+        return -1;
+    }
+    *text = s->p;
+    while (s->p < s->end && *s->p != '"') {
+        if (*s->p == '\\') {
+            s->p++;
+        }
+        s->p++;
+    }
+    if (s->p >= s->end) {
+        return -1;
+    }
+    *len = s->p - *text;
+    s->p++;
+    return 0;
+}
+
+static int is_number_char(char c) {
+    return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E';
+}
+
+// Steps over a number without converting it
+static size_t skip_number(Scanner* s) {
+    const char* start;
+
+    skip_ws(s);
+    start = s->p;
+    while (s->p < s->end && is_number_char(*s->p)) {
+        s->p++;
+    }
+    return s->p - start;
+}
+
+static int scan_number(Scanner* s, double* value) {
+    char digits[48];
+    const char* start;
+    size_t len;
+    char* parsed_end;
+
+    skip_ws(s);
+    start = s->p;
+    len = skip_number(s);
+    if (len == 0 || len >= sizeof(digits)) {
+        return -1;
+    }
+    // strtod needs a terminator the payload does not have
+    memcpy(digits, start, len);
+    digits[len] = '\0';
+    *value = strtod(digits, &parsed_end);
+    return parsed_end == digits + len ? 0 : -1;
+}
+
+static int skip_value(Scanner* s, int depth);
+
+// Skips the members or elements of an object/array whose opener was consumed
+static int skip_container(Scanner* s, char close, int depth) {
+    const char* text;
+    size_t len;
+
+    if (accept(s, close)) {
+        return 0;
+    }
+    do {
+        if (close == '}' && (scan_string(s, &text, &len) != 0 || !accept(s, ':'))) {
+            return -1;
+        }
+        if (skip_value(s, depth + 1) != 0) {
+            return -1;
+        }
+    } while (accept(s, ','));
+    return accept(s, close) ? 0 : -1;
+}
+
+static int skip_value(Scanner* s, int depth) {
+    const char* text;
+    size_t len;
+
+    if (depth > WATERTABLE_MAX_DEPTH) {
+        return -1;
+    }
+    skip_ws(s);
+    if (s->p >= s->end) {
+        return -1;
+    }
+    switch (*s->p) {
+        case '{':
+            s->p++;
+            return skip_container(s, '}', depth);
+        case '[':
+            s->p++;
+            return skip_container(s, ']', depth);
+        case '"':
+            return scan_string(s, &text, &len);
+        case 't':
+        case 'f':
+        case 'n':
+            while (s->p < s->end && *s->p >= 'a' && *s->p <= 'z') {
+                s->p++;
+            }
+            return 0;
+        default:
+            return skip_number(s) > 0 ? 0 : -1;
+    }
+}
+
+// Parses a decimal object key such as "16"; -1 for anything else
+static int key_number(const char* text, size_t len) {
+    int value = 0;
+
+    if (len == 0 || len > 4) {
+        return -1;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (text[i] < '0' || text[i] > '9') {
+            return -1;
+        }
+        value = value * 10 + (text[i] - '0');
+    }
+    return value;
+}
+
+static WatertableField key_field(const char* text, size_t len) {
+    for (int f = 0; f < FIELD_COUNT; f++) {
+        if (strlen(field_names[f]) == len && memcmp(field_names[f], text, len) == 0) {
+            return (WatertableField)f;
+        }
+    }
+    return FIELD_OTHER;
+}
+
+static int peek(Scanner* s, char c) {
+    skip_ws(s);
+    return s->p < s->end && *s->p == c;
+}
+
+static int parse_zone(Scanner* s, WatertableCell* cell) {
+    const char* text;
+    size_t len;
+
+    cell->present = 1;
+    if (!accept(s, '{')) {
+        return -1;
+    }
+    if (accept(s, '}')) {
+        return 0;
+    }
+    do {
+        if (scan_string(s, &text, &len) != 0 || !accept(s, ':')) {
+            return -1;
+        }
+        WatertableField field = key_field(text, len);
+        double value;
+        skip_ws(s);
+        if (field == FIELD_OTHER || s->p >= s->end || (*s->p != '-' && (*s->p < '0' || *s->p > '9'))) {
+            if (skip_value(s, 3) != 0) {
+                return -1;
+            }
+            continue;
+        }
+        if (scan_number(s, &value) != 0) {
+            return -1;
+        }
+        switch (field) {
+            case FIELD_TOTAL_FLOW:    cell->total_flow = value;    break;
+            case FIELD_TOTAL_SECONDS: cell->total_seconds = value; break;
+            case FIELD_AVG_PSI:       cell->avg_psi = value;       break;
+            case FIELD_GPM:           cell->gpm = value;           break;
+            default:                                               break;
+        }
+    } while (accept(s, ','));
+    return accept(s, '}') ? 0 : -1;
+}
+
+static int parse_controller(Scanner* s, int controller, const WatertableIndex* index,
+                            WatertableCell* cells, int cell_count) {
+    const char* text;
+    size_t len;
+
+    if (!accept(s, '{')) {
+        return -1;
+    }
+    if (accept(s, '}')) {
+        return 0;
+    }
+    do {
+        if (scan_string(s, &text, &len) != 0 || !accept(s, ':')) {
+            return -1;
+        }
+        int zone = key_number(text, len);
+        int cell = (zone >= 0 && zone < WATERTABLE_MAX_ZONES) ? index->cell[controller][zone] : -1;
+        if (cell >= 0 && cell < cell_count && peek(s, '{')) {
+            if (parse_zone(s, &cells[cell]) != 0) {
+                return -1;
+            }
+        } else if (skip_value(s, 2) != 0) {
+            return -1;
+        }
+    } while (accept(s, ','));
+    return accept(s, '}') ? 0 : -1;
+}
+
+static int parse_details(Scanner* s, const WatertableIndex* index, WatertableCell* cells, int cell_count) {
+    const char* text;
+    size_t len;
+
+    if (!accept(s, '{')) {
+        return -1;
+    }
+    if (accept(s, '}')) {
+        return 0;
+    }
+    do {
+        if (scan_string(s, &text, &len) != 0 || !accept(s, ':')) {
+            return -1;
+        }
+        int controller = key_number(text, len);
+        if (controller >= 0 && controller < WATERTABLE_MAX_CONTROLLERS && peek(s, '{')) {
+            if (parse_controller(s, controller, index, cells, cell_count) != 0) {
+                return -1;
+            }
+        } else if (skip_value(s, 1) != 0) {
+            return -1;
+        }
+    } while (accept(s, ','));
+    return accept(s, '}') ? 0 : -1;
+}
+
+// Reads the "trace" object; unknown members and non-numeric values are skipped
+static int parse_trace(Scanner* s, WatertableTrace* trace) {
+    static const char* names[] = { "receivedUs", "queryStartUs", "queryEndUs", "encodeStartUs" };
+    int64_t* fields[] = { &trace->received_us, &trace->query_start_us, &trace->query_end_us, &trace->encode_start_us };
+    const char* text;
+    size_t len;
+
+    if (!accept(s, '{')) {
+        return -1;
+    }
+    if (accept(s, '}')) {
+        return 0;
+    }
+    do {
+        if (scan_string(s, &text, &len) != 0 || !accept(s, ':')) {
+            return -1;
+        }
+        int f = 0;
+        while (f < 4 && !(strlen(names[f]) == len && memcmp(names[f], text, len) == 0)) {
+            f++;
+        }
+        double value;
+        skip_ws(s);
+        if (f == 4 || s->p >= s->end || (*s->p != '-' && (*s->p < '0' || *s->p > '9'))) {
+            if (skip_value(s, 1) != 0) {
+                return -1;
+            }
+            continue;
+        }
+        // Microsecond timestamps stay below 2^53, so a double holds them exactly
+        if (scan_number(s, &value) != 0) {
+            return -1;
+        }
+        *fields[f] = (int64_t)value;
+    } while (accept(s, ','));
+    return accept(s, '}') ? 0 : -1;
+}
+
+int watertable_extract(const char* json, size_t len, const WatertableIndex* index,
+                       WatertableCell* cells, int cell_count) {
+    return watertable_extract_traced(json, len, index, cells, cell_count, NULL);
+}
+
+int watertable_extract_traced(const char* json, size_t len, const WatertableIndex* index,
+                              WatertableCell* cells, int cell_count, WatertableTrace* trace) {
+    Scanner s = { json, json + len };
+    const char* text;
+    size_t key_len;
+    int found_details = 0;
+    double value;
+
+    memset(cells, 0, sizeof(WatertableCell) * cell_count);
+    if (trace != NULL) {
+        memset(trace, 0, sizeof(WatertableTrace));
+    }
+    if (!accept(&s, '{')) {
+        return -1;
+    }
+    if (accept(&s, '}')) {
+        return -1;
+    }
+    do {
+        if (scan_string(&s, &text, &key_len) != 0 || !accept(&s, ':')) {
+            return -1;
+        }
+        if (key_len == 7 && memcmp(text, "details", 7) == 0) {
+            if (!peek(&s, '{')) {
+                fprintf(stderr, "Watertable: 'details' is not an object\n");
+                return -1;
+            }
+            if (parse_details(&s, index, cells, cell_count) != 0) {
+                return -1;
+            }
+            found_details = 1;
+        } else if (trace != NULL && key_len == 9 && memcmp(text, "requestId", 9) == 0 && !peek(&s, '"')) {
+            if (scan_number(&s, &value) != 0) {
+                return -1;
+            }
+            trace->request_id = (value > 0 && value <= UINT32_MAX) ? (uint32_t)value : 0;
+        } else if (trace != NULL && key_len == 5 && memcmp(text, "trace", 5) == 0 && peek(&s, '{')) {
+            if (parse_trace(&s, trace) != 0) {
+                return -1;
+            }
+        } else if (skip_value(&s, 0) != 0) {
+            return -1;
+        }
+    } while (accept(&s, ','));
+    if (!accept(&s, '}')) {
+        return -1;
+    }
+    if (!found_details) {
+        fprintf(stderr, "Watertable: 'details' key missing\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Fields of a zone in the binary encoding, in order
+enum {
+    BINARY_TOTAL_FLOW = 0,
+    BINARY_TOTAL_SECONDS,
+    BINARY_AVG_PSI,
+    BINARY_AVG_TEMP_F,
+    BINARY_AVG_AMPS,
+    BINARY_GPM,
+    BINARY_FIELD_COUNT
+};
+
+static uint32_t read_u32(const uint8_t* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static int64_t read_i64(const uint8_t* p) {
+    return (int64_t)((uint64_t)read_u32(p) | (uint64_t)read_u32(p + 4) << 32);
+}
+
+static double read_f32(const uint8_t* p) {
+    uint32_t bits = read_u32(p);
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static size_t pad4(size_t n) {
+    return (n + 3) & ~(size_t)3;
+}
+
+int watertable_extract_binary(const void* data, size_t len, const WatertableIndex* index,
+                              WatertableCell* cells, int cell_count, WatertableTrace* trace) {
+    const uint8_t* p = data;
+    size_t bitmap_offset, values_offset, stride, total_zones = 0;
+    int controller_count, field_count, slot = 0;
+
+    memset(cells, 0, sizeof(WatertableCell) * cell_count);
+    if (trace != NULL) {
+        memset(trace, 0, sizeof(WatertableTrace));
+    }
+    if (len < WATERTABLE_BINARY_HEADER_SIZE || memcmp(p, WATERTABLE_BINARY_MAGIC, 4) != 0) {
+        fprintf(stderr, "Watertable: not a binary watertable payload\n");
+        return -1;
+    }
+    if (p[4] != WATERTABLE_BINARY_VERSION || p[5] < BINARY_FIELD_COUNT) {
+        fprintf(stderr, "Watertable: unsupported binary version %d with %d fields\n", p[4], p[5]);
+        return -1;
+    }
+    field_count = p[5];
+    controller_count = p[6];
+    if (len < WATERTABLE_BINARY_HEADER_SIZE + (size_t)controller_count) {
+        return -1;
+    }
+    for (int c = 0; c < controller_count; c++) {
+        total_zones += p[WATERTABLE_BINARY_HEADER_SIZE + c];
+    }
+    bitmap_offset = pad4(WATERTABLE_BINARY_HEADER_SIZE + controller_count);
+    values_offset = pad4(bitmap_offset + 2 * ((total_zones + 7) / 8));
+    stride = (size_t)field_count * 4;
+    if (len < values_offset + total_zones * stride) {
+        fprintf(stderr, "Watertable: binary payload truncated\n");
+        return -1;
+    }
+
+    if (trace != NULL) {
+        trace->request_id = read_u32(p + 8);
+        if (p[7] & WATERTABLE_BINARY_FLAG_TRACE) {
+            trace->received_us = read_i64(p + 32);
+            trace->query_start_us = read_i64(p + 40);
+            trace->query_end_us = read_i64(p + 48);
+            trace->encode_start_us = read_i64(p + 56);
+        }
+    }
+
+    // Only the mapped zones are touched; slot counts every zone in order
+    for (int controller = 0; controller < controller_count; controller++) {
+        int zones = p[WATERTABLE_BINARY_HEADER_SIZE + controller];
+        for (int zone = 0; zone < zones; zone++, slot++) {
+            if (controller >= WATERTABLE_MAX_CONTROLLERS || zone >= WATERTABLE_MAX_ZONES) {
+                continue;
+            }
+            int cell = index->cell[controller][zone];
+            if (cell < 0 || cell >= cell_count || !(p[bitmap_offset + slot / 8] & (1 << (slot % 8)))) {
+                continue;
+            }
+            const uint8_t* values = p + values_offset + slot * stride;
+            cells[cell].present = 1;
+            cells[cell].total_flow = read_f32(values + BINARY_TOTAL_FLOW * 4);
+            cells[cell].total_seconds = read_f32(values + BINARY_TOTAL_SECONDS * 4);
+            cells[cell].avg_psi = read_f32(values + BINARY_AVG_PSI * 4);
+            cells[cell].gpm = read_f32(values + BINARY_GPM * 4);
+        }
+    }
+    return 0;
+}
+
+int watertable_extract_dom(const char* json, size_t len, const WatertableIndex* index,
+                           WatertableCell* cells, int cell_count) {
+    json_object *parsed_json, *details_obj;
+    char key[8];
+
+    memset(cells, 0, sizeof(WatertableCell) * cell_count);
+
+    // The DOM parser needs a NUL terminated copy of the payload
+    char* payload_copy = malloc(len + 1);
+    if (payload_copy == NULL) {
+        return -1;
+    }
+    memcpy(payload_copy, json, len);
+    payload_copy[len] = '\0';
+    parsed_json = json_tokener_parse(payload_copy);
+    free(payload_copy);
+    if (parsed_json == NULL) {
+        return -1;
+    }
+    if (!json_object_object_get_ex(parsed_json, "details", &details_obj) ||
+        json_object_get_type(details_obj) != json_type_object) {
+        json_object_put(parsed_json);
+        return -1;
+    }
+
+    for (int controller = 0; controller < WATERTABLE_MAX_CONTROLLERS; controller++) {
+        for (int zone = 0; zone < WATERTABLE_MAX_ZONES; zone++) {
+            int cell = index->cell[controller][zone];
+            json_object *controller_obj, *zone_obj, *temp_obj;
+            if (cell < 0 || cell >= cell_count) {
+                continue;
+            }
+            snprintf(key, sizeof(key), "%d", controller);
+            if (!json_object_object_get_ex(details_obj, key, &controller_obj) ||
+                json_object_get_type(controller_obj) != json_type_object) {
+                continue;
+            }
+            snprintf(key, sizeof(key), "%d", zone);
+            if (!json_object_object_get_ex(controller_obj, key, &zone_obj) ||
+                json_object_get_type(zone_obj) != json_type_object) {
+                continue;
+            }
+            cells[cell].present = 1;
+            if (json_object_object_get_ex(zone_obj, "totalFlow", &temp_obj)) {
+                cells[cell].total_flow = json_object_get_double(temp_obj);
+            }
+            if (json_object_object_get_ex(zone_obj, "totalSeconds", &temp_obj)) {
+                cells[cell].total_seconds = json_object_get_double(temp_obj);
+            }
+            if (json_object_object_get_ex(zone_obj, "avgPSI", &temp_obj)) {
+                cells[cell].avg_psi = json_object_get_double(temp_obj);
+            }
+            if (json_object_object_get_ex(zone_obj, "gpm", &temp_obj)) {
+                cells[cell].gpm = json_object_get_double(temp_obj);
+            }
+        }
+    }
+    json_object_put(parsed_json);
+    return 0;
+}
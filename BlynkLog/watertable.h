@@ -0,0 +1,79 @@
+#ifndef WATERTABLE_H
+#define WATERTABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Extraction of the controller/zone cells blynkLog displays from the
+// mwp_data_service watertable JSON:
+//
+//   { ..., "details": { "<controller>": { "<zone>": { "totalFlow": .., "totalSeconds": ..,
+//                                                     "avgPSI": .., "gpm": .., ... } } } }
+
+#define WATERTABLE_MAX_CONTROLLERS 16
+#define WATERTABLE_MAX_ZONES       64
+
+// Values of one mapped controller/zone
+typedef struct {
+    int    present;          // The zone object was in the payload
+    double total_flow;
+    double total_seconds;
+    double avg_psi;
+    double gpm;
+} WatertableCell;
+
+// Request echo and service timestamps of a traced query result:
+//
+//   { ..., "requestId": 7, "trace": { "receivedUs": .., "queryStartUs": ..,
+//                                     "queryEndUs": .., "encodeStartUs": .. } }
+//
+// Timestamps are Unix microseconds; all fields stay 0 when absent.
+typedef struct {
+    uint32_t request_id;
+    int64_t  received_us;       // Query request arrived at mwp_data_service
+    int64_t  query_start_us;
+    int64_t  query_end_us;
+    int64_t  encode_start_us;   // Table updated, result encoding started
+} WatertableTrace;
+
+// Binary encoding mwp_data_service publishes on "<response topic>/bin" when
+// asked for {"encoding": "binary"}; see its internal/service/wire_binary.go
+// for the layout. Values are little-endian float32, dense per controller.
+#define WATERTABLE_BINARY_MAGIC       "MWPW"
+#define WATERTABLE_BINARY_VERSION     1
+#define WATERTABLE_BINARY_HEADER_SIZE 64
+#define WATERTABLE_BINARY_FLAG_TRACE  0x01
+
+// Controller/zone -> cell lookup, built once from the display map
+typedef struct {
+    int16_t cell[WATERTABLE_MAX_CONTROLLERS][WATERTABLE_MAX_ZONES];  // -1 when unmapped
+} WatertableIndex;
+
+void watertable_index_init(WatertableIndex* index);
+
+// Maps controller/zone to cells[cell]. Returns -1 if either is out of range.
+int watertable_index_add(WatertableIndex* index, int controller, int zone, int cell);
+
+// Walks the payload once and fills only the mapped cells; everything else is
+// skipped without being decoded. The payload does not need to be NUL
+// terminated and is neither copied nor modified, and nothing is allocated.
+// Returns 0, or -1 if the payload is malformed or has no "details" object.
+int watertable_extract(const char* json, size_t len, const WatertableIndex* index,
+                       WatertableCell* cells, int cell_count);
+
+// watertable_extract() that also fills 'trace' in the same pass
+int watertable_extract_traced(const char* json, size_t len, const WatertableIndex* index,
+                              WatertableCell* cells, int cell_count, WatertableTrace* trace);
+
+// Same result from the binary encoding, with 'trace' filled when not NULL.
+// Values arrive as float32. Returns -1 if the payload is truncated, or its
+// magic or version is not one this reader knows.
+int watertable_extract_binary(const void* data, size_t len, const WatertableIndex* index,
+                              WatertableCell* cells, int cell_count, WatertableTrace* trace);
+
+// Same result through a full json-c DOM, the way msgarrvd() used to parse.
+// Kept as the reference for watertable_bench.
+int watertable_extract_dom(const char* json, size_t len, const WatertableIndex* index,
+                           WatertableCell* cells, int cell_count);
+
+#endif // WATERTABLE_H
@@ -0,0 +1,285 @@
+// Compares the json-c DOM parse msgarrvd() used to do against the streaming
+// watertable_extract() on recorded watertable payloads, and both against
+// watertable_extract_binary() on the same table in the binary encoding.
+//
+//   watertable_bench [-n iterations] [fixture.json ...]
+//
+// With no fixtures the ones recorded under ../output are used. For each file
+// it reports the payload sizes, the time per parse and the heap allocations
+// per parse, counted through bench_alloc.c.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <getopt.h>
+#include <json-c/json.h>
+#include "watertable.h"
+#include "bench_alloc.h"
+
+#define DEFAULT_ITERATIONS 20000
+
+static const char* default_fixtures[] = {
+    "../output/watertable_initial.json",
+    "../output/watertable_latest.json",
+    "../output/watertable_after_query.json",
+};
+
+// Same controller/zone layout as json_to_blynk_map in blynkLog.c
+static const int bench_map[][2] = {
+    {0, 0},
+    {1, 1}, {1, 2}, {1, 3}, {1, 4}, {1, 5}, {1, 6}, {1, 7}, {1, 8},
+    {1, 9}, {1, 10}, {1, 11}, {1, 12}, {1, 13}, {1, 14}, {1, 15}, {1, 16},
+    {2, 1}, {2, 2}, {2, 3}, {2, 4}, {2, 5}, {2, 6}, {2, 7}, {2, 8},
+    {2, 9}, {2, 10}, {2, 11}, {2, 12}, {2, 13},
+    {3, 1},
+};
+#define BENCH_CELLS (int)(sizeof(bench_map) / sizeof(bench_map[0]))
+
+typedef int (*ExtractFn)(const char*, size_t, const WatertableIndex*, WatertableCell*, int);
+
+static int extract_binary(const char* data, size_t len, const WatertableIndex* index,
+                          WatertableCell* cells, int cell_count) {
+    return watertable_extract_binary(data, len, index, cells, cell_count, NULL);
+}
+
+static void put_u32(unsigned char* p, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = (unsigned char)(v >> (8 * i));
+    }
+}
+
+static void put_f64(unsigned char* p, double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    put_u32(p, (uint32_t)bits);
+    put_u32(p + 4, (uint32_t)(bits >> 32));
+}
+
+static void put_f32(unsigned char* p, double value) {
+    float f = (float)value;
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    put_u32(p, bits);
+}
+
+static double get_double(json_object* obj, const char* key) {
+    json_object* value;
+    return json_object_object_get_ex(obj, key, &value) ? json_object_get_double(value) : 0.0;
+}
+
+// Encodes a JSON fixture the way mwp_data_service's EncodeBinary() does, so
+// both encodings of the same table can be compared. Returns NULL on failure.
+static char* encode_binary(const char* json, size_t json_len, size_t* len) {
+    static const char* fields[] = { "totalFlow", "totalSeconds", "avgPSI", "avgTempF", "avgAmps", "gpm" };
+    int zones[256] = { 0 };
+    int controller_count = 0, total_zones = 0, slot = 0;
+    json_object *root, *details;
+    char* copy = bench_alloc_uncounted(json_len + 1);
+
+    if (copy == NULL) {
+        return NULL;
+    }
+    memcpy(copy, json, json_len);
+    copy[json_len] = '\0';
+    root = json_tokener_parse(copy);
+    bench_free_uncounted(copy);
+    if (root == NULL || !json_object_object_get_ex(root, "details", &details)) {
+        json_object_put(root);
+        return NULL;
+    }
+    json_object_object_foreach(details, controller_key, controller_obj) {
+        int controller = atoi(controller_key);
+        if (controller < 0 || controller > 255) {
+            continue;
+        }
+        if (controller + 1 > controller_count) {
+            controller_count = controller + 1;
+        }
+        json_object_object_foreach(controller_obj, zone_key, zone_obj) {
+            int zone = atoi(zone_key);
+            (void)zone_obj;
+            if (zone >= 0 && zone < 255 && zone + 1 > zones[controller]) {
+                zones[controller] = zone + 1;
+            }
+        }
+    }
+    for (int c = 0; c < controller_count; c++) {
+        total_zones += zones[c];
+    }
+
+    size_t bitmap_size = (total_zones + 7) / 8;
+    size_t bitmap_offset = (WATERTABLE_BINARY_HEADER_SIZE + controller_count + 3) & ~(size_t)3;
+    size_t values_offset = (bitmap_offset + 2 * bitmap_size + 3) & ~(size_t)3;
+    *len = values_offset + (size_t)total_zones * 6 * 4;
+    unsigned char* out = bench_alloc_uncounted(*len);
+    if (out == NULL) {
+        json_object_put(root);
+        return NULL;
+    }
+    memset(out, 0, *len);
+    memcpy(out, WATERTABLE_BINARY_MAGIC, 4);
+    out[4] = WATERTABLE_BINARY_VERSION;
+    out[5] = 6;
+    out[6] = (unsigned char)controller_count;
+    put_f64(out + 16, get_double(root, "totalIrrigationGallons"));
+    put_f64(out + 24, get_double(root, "totalWell3Gallons"));
+
+    for (int c = 0; c < controller_count; c++) {
+        json_object* controller_obj = NULL;
+        char key[12];           // Fits any int
+
+        out[WATERTABLE_BINARY_HEADER_SIZE + c] = (unsigned char)zones[c];
+        snprintf(key, sizeof(key), "%d", c);
+        json_object_object_get_ex(details, key, &controller_obj);
+        for (int z = 0; z < zones[c]; z++, slot++) {
+            json_object *zone_obj, *updated;
+            snprintf(key, sizeof(key), "%d", z);
+            if (controller_obj == NULL || !json_object_object_get_ex(controller_obj, key, &zone_obj)) {
+                continue;
+            }
+            out[bitmap_offset + slot / 8] |= 1 << (slot % 8);
+            if (json_object_object_get_ex(zone_obj, "updatedInLastQuery", &updated) && json_object_get_boolean(updated)) {
+                out[bitmap_offset + bitmap_size + slot / 8] |= 1 << (slot % 8);
+            }
+            for (int f = 0; f < 6; f++) {
+                put_f32(out + values_offset + (size_t)slot * 24 + f * 4, get_double(zone_obj, fields[f]));
+            }
+        }
+    }
+    json_object_put(root);
+    return (char*)out;
+}
+
+// Binary values are float32, so only rounding differences are allowed
+static int close_enough(double a, double b) {
+    return fabs(a - b) <= 1e-6 * fmax(1.0, fabs(a));
+}
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static char* load_file(const char* path, size_t* len) {
+    FILE* fp = fopen(path, "rb");
+    char* data;
+    long size;
+
+    if (fp == NULL) {
+        return NULL;
+    }
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    data = bench_alloc_uncounted(size > 0 ? size : 1);
+    if (data != NULL && fread(data, 1, size, fp) != (size_t)size) {
+        bench_free_uncounted(data);
+        data = NULL;
+    }
+    fclose(fp);
+    *len = size;
+    return data;
+}
+
+static int run(const char* name, ExtractFn fn, const char* json, size_t len, const WatertableIndex* index,
+               WatertableCell* cells, int iterations) {
+    unsigned long long allocs;
+    double start, elapsed;
+
+    // Warm up, and make sure the path accepts the payload at all
+    if (fn(json, len, index, cells, BENCH_CELLS) != 0) {
+        printf("  %-9s parse failed\n", name);
+        return -1;
+    }
+    allocs = bench_alloc_count();
+    start = now_us();
+    for (int i = 0; i < iterations; i++) {
+        fn(json, len, index, cells, BENCH_CELLS);
+    }
+    elapsed = now_us() - start;
+    allocs = bench_alloc_count() - allocs;
+    printf("  %-9s %9.2f us/parse %9.1f allocs/parse\n", name, elapsed / iterations,
+           (double)allocs / iterations);
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    int iterations = DEFAULT_ITERATIONS;
+    const char** fixtures = default_fixtures;
+    int fixture_count = sizeof(default_fixtures) / sizeof(default_fixtures[0]);
+    WatertableIndex index;
+    WatertableCell dom_cells[BENCH_CELLS], stream_cells[BENCH_CELLS], binary_cells[BENCH_CELLS];
+    int opt, rc = 0;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+            case 'n':
+                iterations = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n iterations] [fixture.json ...]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (iterations < 1) {
+        iterations = 1;
+    }
+    if (optind < argc) {
+        fixtures = (const char**)&argv[optind];
+        fixture_count = argc - optind;
+    }
+
+    watertable_index_init(&index);
+    for (int i = 0; i < BENCH_CELLS; i++) {
+        watertable_index_add(&index, bench_map[i][0], bench_map[i][1], i);
+    }
+
+    for (int f = 0; f < fixture_count; f++) {
+        size_t len, binary_len;
+        char* json = load_file(fixtures[f], &len);
+        if (json == NULL) {
+            fprintf(stderr, "Failed to read %s\n", fixtures[f]);
+            rc = 1;
+            continue;
+        }
+        char* binary = encode_binary(json, len, &binary_len);
+        if (binary == NULL) {
+            fprintf(stderr, "Failed to encode %s as binary\n", fixtures[f]);
+            bench_free_uncounted(json);
+            rc = 1;
+            continue;
+        }
+        printf("%s (%zu bytes JSON, %zu bytes binary, %d iterations)\n", fixtures[f], len, binary_len, iterations);
+        if (run("json-c", watertable_extract_dom, json, len, &index, dom_cells, iterations) != 0 ||
+            run("streaming", watertable_extract, json, len, &index, stream_cells, iterations) != 0 ||
+            run("binary", extract_binary, binary, binary_len, &index, binary_cells, iterations) != 0) {
+            rc = 1;
+        } else {
+            // All paths have to agree, otherwise the timings mean nothing
+            for (int i = 0; i < BENCH_CELLS; i++) {
+                if (dom_cells[i].present != stream_cells[i].present ||
+                    dom_cells[i].total_flow != stream_cells[i].total_flow ||
+                    dom_cells[i].total_seconds != stream_cells[i].total_seconds ||
+                    dom_cells[i].avg_psi != stream_cells[i].avg_psi ||
+                    dom_cells[i].gpm != stream_cells[i].gpm) {
+                    printf("  MISMATCH at C%d Z%d\n", bench_map[i][0], bench_map[i][1]);
+                    rc = 1;
+                }
+                if (dom_cells[i].present != binary_cells[i].present ||
+                    !close_enough(dom_cells[i].total_flow, binary_cells[i].total_flow) ||
+                    !close_enough(dom_cells[i].total_seconds, binary_cells[i].total_seconds) ||
+                    !close_enough(dom_cells[i].avg_psi, binary_cells[i].avg_psi) ||
+                    !close_enough(dom_cells[i].gpm, binary_cells[i].gpm)) {
+                    printf("  BINARY MISMATCH at C%d Z%d\n", bench_map[i][0], bench_map[i][1]);
+                    rc = 1;
+                }
+            }
+        }
+        bench_free_uncounted(binary);
+        bench_free_uncounted(json);
+    }
+    return rc;
+}
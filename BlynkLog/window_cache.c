@@ -0,0 +1,148 @@
+#include "window_cache.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+// Month names as mwp_data_service accepts them; a month means that month
+// of the current year
+static const char* month_names[12] = {
+    "january", "february", "march", "april", "may", "june",
+    "july", "august", "september", "october", "november", "december"
+};
+
+static int parse_month(const char* range) {
+    for (int m = 0; m < 12; m++) {
+        if (strcasecmp(range, month_names[m]) == 0) {
+            return m;
+        }
+    }
+    return -1;
+}
+
+static int parse_year(const char* range) {
+    if (strlen(range) != 4) {
+        return -1;
+    }
+    for (int i = 0; i < 4; i++) {
+        if (!isdigit((unsigned char)range[i])) {
+            return -1;
+        }
+    }
+    return atoi(range);
+}
+
+static WindowCacheEntry* find_entry(WindowCache* cache, const char* range) {
+    for (int i = 0; i < cache->count; i++) {
+        if (strcmp(cache->entries[i].range, range) == 0) {
+            return &cache->entries[i];
+        }
+    }
+    return NULL;
+}
+
+int window_cache_init(WindowCache* cache, int cell_count, int default_ttl_seconds) {
+    memset(cache, 0, sizeof(WindowCache));
+    cache->cell_count = cell_count;
+    cache->default_ttl_seconds = default_ttl_seconds;
+    pthread_mutex_init(&cache->lock, NULL);
+    return 0;
+}
+
+void window_cache_free(WindowCache* cache) {
+    for (int i = 0; i < cache->count; i++) {
+        free(cache->entries[i].cells);
+    }
+    cache->count = 0;
+    pthread_mutex_destroy(&cache->lock);
+}
+
+int window_cache_add(WindowCache* cache, const char* range, int has_ttl, int ttl_seconds) {
+    WindowCacheEntry* entry;
+
+    if (cache->count == WINDOW_CACHE_MAX_WINDOWS || strlen(range) >= WINDOW_CACHE_RANGE_MAX) {
+        fprintf(stderr, "WindowCache: cannot add time window %s\n", range);
+        return -1;
+    }
+    entry = &cache->entries[cache->count];
+    entry->cells = calloc(cache->cell_count, sizeof(WatertableCell));
+    if (entry->cells == NULL) {
+        fprintf(stderr, "WindowCache: failed to allocate time window %s\n", range);
+        return -1;
+    }
+    strcpy(entry->range, range);
+    entry->has_ttl = has_ttl;
+    entry->ttl_seconds = ttl_seconds;
+    entry->fetched = 0;
+    cache->count++;
+    return 0;
+}
+
+WindowCacheState window_cache_lookup(WindowCache* cache, const char* range, time_t now, WatertableCell* cells) {
+    WindowCacheState state = WINDOW_CACHE_MISS;
+    WindowCacheEntry* entry;
+    struct tm now_tm, fetched_tm;
+    int ttl, month, year;
+
+    pthread_mutex_lock(&cache->lock);
+    entry = find_entry(cache, range);
+    if (entry == NULL || entry->fetched == 0) {
+        cache->stats.misses++;
+        pthread_mutex_unlock(&cache->lock);
+        return WINDOW_CACHE_MISS;
+    }
+
+    localtime_r(&now, &now_tm);
+    localtime_r(&entry->fetched, &fetched_tm);
+    month = parse_month(range);
+    year = parse_year(range);
+
+    if (month >= 0 && fetched_tm.tm_year != now_tm.tm_year) {
+        // Fetched for last year's month; the same name means another month now
+        cache->stats.misses++;
+        pthread_mutex_unlock(&cache->lock);
+        return WINDOW_CACHE_MISS;
+    }
+
+    if (entry->has_ttl) {
+        ttl = entry->ttl_seconds;
+    } else if ((month >= 0 && month < fetched_tm.tm_mon) || (year > 0 && year < fetched_tm.tm_year + 1900)) {
+        ttl = -1; // Already closed when fetched, so its totals no longer change
+    } else {
+        ttl = cache->default_ttl_seconds;
+    }
+
+    state = (ttl < 0 || now - entry->fetched < ttl) ? WINDOW_CACHE_FRESH : WINDOW_CACHE_STALE;
+    if (state == WINDOW_CACHE_FRESH) {
+        cache->stats.fresh++;
+    } else {
+        cache->stats.stale++;
+    }
+    memcpy(cells, entry->cells, cache->cell_count * sizeof(WatertableCell));
+    pthread_mutex_unlock(&cache->lock);
+    return state;
+}
+
+void window_cache_store(WindowCache* cache, const char* range, time_t now, const WatertableCell* cells) {
+    WindowCacheEntry* entry;
+
+    pthread_mutex_lock(&cache->lock);
+    entry = find_entry(cache, range);
+    if (entry != NULL) {
+        memcpy(entry->cells, cells, cache->cell_count * sizeof(WatertableCell));
+        entry->fetched = now;
+        cache->stats.stores++;
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void window_cache_print_stats(WindowCache* cache, FILE* out) {
+    WindowCacheStats stats;
+
+    pthread_mutex_lock(&cache->lock);
+    stats = cache->stats;
+    pthread_mutex_unlock(&cache->lock);
+    fprintf(out, "WindowCache: fresh=%llu stale=%llu misses=%llu stores=%llu\n",
+            (unsigned long long)stats.fresh, (unsigned long long)stats.stale,
+            (unsigned long long)stats.misses, (unsigned long long)stats.stores);
+}
@@ -0,0 +1,64 @@
+#ifndef WINDOW_CACHE_H
+#define WINDOW_CACHE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include "watertable.h"
+
+#define WINDOW_CACHE_MAX_WINDOWS 32
+#define WINDOW_CACHE_RANGE_MAX   32
+
+#define WINDOW_CACHE_DEFAULT_TTL_SECONDS 120
+
+// Result of window_cache_lookup()
+typedef enum {
+    WINDOW_CACHE_MISS = 0,  // Nothing usable cached
+    WINDOW_CACHE_STALE,     // Cached, but past its TTL; show it and refresh
+    WINDOW_CACHE_FRESH      // Cached and within its TTL
+} WindowCacheState;
+
+typedef struct {
+    char range[WINDOW_CACHE_RANGE_MAX];     // Time window as sent to mwp_data_service, e.g. "24h", "May"
+    int ttl_seconds;                        // Negative: never expires
+    int has_ttl;                            // ttl_seconds was configured for this window
+    time_t fetched;                         // 0 until a result is stored
+    WatertableCell* cells;
+} WindowCacheEntry;
+
+typedef struct {
+    uint64_t fresh;
+    uint64_t stale;
+    uint64_t misses;
+    uint64_t stores;
+} WindowCacheStats;
+
+// Last watertable cells extracted for each time window, so switching back
+// to a window can be answered without a service round trip
+typedef struct {
+    WindowCacheEntry entries[WINDOW_CACHE_MAX_WINDOWS];
+    int count;
+    int cell_count;
+    int default_ttl_seconds;
+    pthread_mutex_t lock;
+    WindowCacheStats stats;
+} WindowCache;
+
+int window_cache_init(WindowCache* cache, int cell_count, int default_ttl_seconds);
+void window_cache_free(WindowCache* cache);
+
+// Registers a window. Without 'has_ttl', a month or year that had already
+// closed when its result was fetched never expires, and everything else
+// uses the default TTL.
+int window_cache_add(WindowCache* cache, const char* range, int has_ttl, int ttl_seconds);
+
+// Copies the cells cached for 'range' into 'cells' unless it is a miss
+WindowCacheState window_cache_lookup(WindowCache* cache, const char* range, time_t now, WatertableCell* cells);
+
+// Replaces the cells cached for 'range'; unregistered windows are ignored
+void window_cache_store(WindowCache* cache, const char* range, time_t now, const WatertableCell* cells);
+
+void window_cache_print_stats(WindowCache* cache, FILE* out);
+
+#endif // WINDOW_CACHE_H
@@ -0,0 +1,277 @@
+/*
+ * Local stand-in for the InfluxDB v2 write endpoint. Accepts POSTs over
+ * HTTP/1.1 keep-alive, inflates gzip bodies and counts requests, TCP
+ * connections, bytes on the wire and line-protocol lines, so the logger's
+ * request rate and compression can be measured without a real InfluxDB.
+ *
+ *   influx_stub [-p port] [-i report_seconds] [-s status_code]
+ *
+ * Point the logger's INFLUXDB_HOST at http://127.0.0.1:<port>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <zlib.h>
+
+#define STUB_DEFAULT_PORT 8086
+#define STUB_MAX_HEADER   8192
+
+typedef struct {
+    unsigned long long connections;
+    unsigned long long requests;
+    unsigned long long gzip_requests;
+    unsigned long long header_bytes;
+    unsigned long long body_bytes;     // As received
+    unsigned long long payload_bytes;  // After inflating
+    unsigned long long lines;
+} StubStats;
+
+static volatile sig_atomic_t running = 1;
+static StubStats totals;
+static StubStats interval;
+static int report_s = 10;
+static double start_s;
+static double report_start_s;
+
+static void handle_signal(int sig) {
+    running = 0;
+}
+
+static double monotonic_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void print_stats(const char* label, const StubStats* s, double seconds) {
+    printf("%s: %.1fs requests=%llu (%.2f/s) connections=%llu gzip=%llu header_bytes=%llu "
+           "body_bytes=%llu payload_bytes=%llu (wire %.1f%%) lines=%llu\n",
+           label, seconds, s->requests, seconds > 0 ? s->requests / seconds : 0.0,
+           s->connections, s->gzip_requests, s->header_bytes, s->body_bytes, s->payload_bytes,
+           s->payload_bytes ? 100.0 * (s->header_bytes + s->body_bytes) / s->payload_bytes : 0.0,
+           s->lines);
+    fflush(stdout);
+}
+
+static void add_stats(StubStats* to, const StubStats* from) {
+    to->connections += from->connections;
+    to->requests += from->requests;
+    to->gzip_requests += from->gzip_requests;
+    to->header_bytes += from->header_bytes;
+    to->body_bytes += from->body_bytes;
+    to->payload_bytes += from->payload_bytes;
+    to->lines += from->lines;
+}
+
+// Prints and rolls the interval counters once report_s has passed
+static void maybe_report(void) {
+    double now_s = monotonic_s();
+    if (report_s > 0 && now_s - report_start_s >= report_s) {
+        print_stats("interval", &interval, now_s - report_start_s);
+        add_stats(&totals, &interval);
+        memset(&interval, 0, sizeof(interval));
+        report_start_s = now_s;
+    }
+}
+
+static unsigned long long count_lines(const unsigned char* data, size_t len) {
+    unsigned long long lines = 0;
+    for (size_t i = 0; i < len; i++) {
+        lines += data[i] == '\n';
+    }
+    return lines;
+}
+
+// Inflates a gzip body, counting the decompressed bytes and lines
+static int inflate_body(const unsigned char* body, size_t len, StubStats* s) {
+    unsigned char out[16384];
+    z_stream zs;
+    int zrc;
+
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, 15 + 16) != Z_OK) {
+        return -1;
+    }
+    zs.next_in = (Bytef*)body;
+    zs.avail_in = (uInt)len;
+    do {
+        zs.next_out = out;
+        zs.avail_out = sizeof(out);
+        zrc = inflate(&zs, Z_NO_FLUSH);
+        if (zrc != Z_OK && zrc != Z_STREAM_END) {
+            inflateEnd(&zs);
+            return -1;
+        }
+        s->payload_bytes += sizeof(out) - zs.avail_out;
+        s->lines += count_lines(out, sizeof(out) - zs.avail_out);
+    } while (zrc != Z_STREAM_END);
+    inflateEnd(&zs);
+    return 0;
+}
+
+// Reads until 'want' bytes are in buf. Returns 0, or -1 on close / error / shutdown.
+static int read_full(int fd, unsigned char* buf, size_t want, size_t* have) {
+    while (*have < want) {
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        if (!running) {
+            return -1;
+        }
+        maybe_report();
+        if (poll(&pfd, 1, 500) <= 0) {
+            continue;
+        }
+        ssize_t n = read(fd, buf + *have, want - *have);
+        if (n <= 0) {
+            return -1;
+        }
+        *have += n;
+    }
+    return 0;
+}
+
+// Serves requests on one keep-alive connection until the client closes it
+static void serve_connection(int fd, int status) {
+    unsigned char header[STUB_MAX_HEADER + 1];
+    unsigned char* body = NULL;
+    size_t body_cap = 0;
+    size_t have = 0;
+    char reply[128];
+    int reply_len = snprintf(reply, sizeof(reply),
+                             "HTTP/1.1 %d Stub\r\nContent-Length: 0\r\nConnection: keep-alive\r\n\r\n", status);
+
+    interval.connections++;
+    while (running) {
+        char* end = NULL;
+        // Read byte-wise up to the blank line so no body bytes are consumed here
+        while (running && have < STUB_MAX_HEADER) {
+            if (read_full(fd, header, have + 1, &have) != 0) {
+                free(body);
+                return;
+            }
+            header[have] = '\0';
+            if (have >= 4 && memcmp(header + have - 4, "\r\n\r\n", 4) == 0) {
+                end = (char*)header + have;
+                break;
+            }
+        }
+        if (end == NULL) {
+            fprintf(stderr, "influx_stub: request header too large\n");
+            break;
+        }
+
+        size_t content_length = 0;
+        int gzip = 0;
+        for (char* line = strstr((char*)header, "\r\n"); line != NULL && line + 2 < end;
+             line = strstr(line + 2, "\r\n")) {
+            if (strncasecmp(line + 2, "Content-Length:", 15) == 0) {
+                content_length = strtoul(line + 17, NULL, 10);
+            } else if (strncasecmp(line + 2, "Content-Encoding:", 17) == 0 && strstr(line + 19, "gzip") != NULL) {
+                gzip = 1;
+            }
+        }
+        if (content_length > body_cap) {
+            free(body);
+            body = malloc(content_length);
+            body_cap = body ? content_length : 0;
+            if (body == NULL) {
+                break;
+            }
+        }
+        size_t body_have = 0;
+        if (read_full(fd, body, content_length, &body_have) != 0) {
+            break;
+        }
+
+        interval.requests++;
+        interval.header_bytes += have;
+        interval.body_bytes += content_length;
+        if (gzip) {
+            interval.gzip_requests++;
+            if (inflate_body(body, content_length, &interval) != 0) {
+                fprintf(stderr, "influx_stub: corrupt gzip body\n");
+            }
+        } else {
+            interval.payload_bytes += content_length;
+            interval.lines += count_lines(body, content_length);
+        }
+        if (write(fd, reply, reply_len) != reply_len) {
+            break;
+        }
+        have = 0;
+    }
+    free(body);
+}
+
+int main(int argc, char* argv[]) {
+    int port = STUB_DEFAULT_PORT;
+    int status = 204;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:i:s:")) != -1) {
+        switch (opt) {
+            case 'p':
+                port = atoi(optarg);
+                break;
+            case 'i':
+                report_s = atoi(optarg);
+                break;
+            case 's':
+                status = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-p port] [-i report_seconds] [-s status_code]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (listen_fd < 0 || bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(listen_fd, 4) != 0) {
+        fprintf(stderr, "influx_stub: cannot listen on port %d: %s\n", port, strerror(errno));
+        return 1;
+    }
+    printf("influx_stub: listening on port %d, answering %d\n", port, status);
+    fflush(stdout);
+
+    start_s = monotonic_s();
+    report_start_s = start_s;
+    while (running) {
+        struct pollfd pfd = { .fd = listen_fd, .events = POLLIN };
+        // The logger keeps one connection, so connections are served one at a time
+        if (poll(&pfd, 1, 1000) > 0) {
+            int fd = accept(listen_fd, NULL, NULL);
+            if (fd >= 0) {
+                serve_connection(fd, status);
+                close(fd);
+            }
+        }
+        maybe_report();
+    }
+    add_stats(&totals, &interval);
+    print_stats("total", &totals, monotonic_s() - start_s);
+    close(listen_fd);
+    return 0;
+}
@@ -0,0 +1,551 @@
+#include "influx_writer.h"
+#include "spool.h"
+#include "lineproto.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <curl/curl.h>
+#include <zlib.h>
+
+// One batch of newline separated line-protocol records
+typedef struct {
+    char*    data;
+    size_t   len;
+    uint32_t points;
+    int64_t  oldest_ms;        // Monotonic time the first point was queued
+} WriteBuffer;
+
+static InfluxWriterConfig writer_config;
+static InfluxWriterStats writer_stats;
+static char write_url[512];
+static char auth_header[256];
+static int64_t precision_divisor = 1000000000LL;
+
+// pump_data tag sets for the pump numbers in use, encoded once at start
+#define PUMP_PREFIX_COUNT 8
+static LineProtoPrefix pump_prefixes[PUMP_PREFIX_COUNT];
+
+static const LineProtoKey pump_keys[] = {
+    LINEPROTO_KEY("param1"),
+    LINEPROTO_KEY("param2"),
+    LINEPROTO_KEY("intervalFlow"),
+    LINEPROTO_KEY("pressure"),
+    LINEPROTO_KEY("amperage"),
+    LINEPROTO_KEY("temperature"),
+};
+
+// The sampling loop appends to 'active' while the flush thread posts 'flushing'
+static WriteBuffer buffers[2];
+static WriteBuffer* active = &buffers[0];
+static WriteBuffer* flushing = &buffers[1];
+
+static pthread_mutex_t writer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_cond;
+static pthread_t flush_thread;
+static int writer_running = 0;
+
+// Replay reads spooled batches into this buffer and posts them as one body
+static char* replay_buffer = NULL;
+static size_t replay_buffer_bytes = 0;
+static int spool_enabled = 0;
+
+// One easy handle and header list for the life of the writer, so libcurl keeps
+// the TCP connection to InfluxDB open between batches. Only the flush thread
+// touches these.
+static CURL* curl_handle = NULL;
+static struct curl_slist* plain_headers = NULL;
+static struct curl_slist* gzip_headers = NULL;
+
+// gzip output for one body, sized for the largest replay post
+static z_stream gzip_stream;
+static int gzip_enabled = 0;
+static unsigned char* gzip_buffer = NULL;
+static size_t gzip_buffer_bytes = 0;
+
+static int64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// True once the active batch should be sent without waiting for its age limit
+static int batch_ready(void) {
+    return active->points >= (uint32_t)writer_config.batch_max_points ||
+           active->len >= writer_config.buffer_bytes / 4 * 3;
+}
+
+static size_t discard_response(char *ptr, size_t size, size_t nmemb, void *userdata) {
+    return size * nmemb;
+}
+
+// Compresses body into gzip_buffer. Returns the compressed length, 0 on failure.
+static size_t gzip_body(const char* body, size_t len) {
+    if (deflateReset(&gzip_stream) != Z_OK) {
+        return 0;
+    }
+    gzip_stream.next_in = (Bytef*)body;
+    gzip_stream.avail_in = (uInt)len;
+    gzip_stream.next_out = gzip_buffer;
+    gzip_stream.avail_out = (uInt)gzip_buffer_bytes;
+    if (deflate(&gzip_stream, Z_FINISH) != Z_STREAM_END) {
+        return 0;
+    }
+    return gzip_buffer_bytes - gzip_stream.avail_out;
+}
+
+// POSTs one batch body. Returns 0 when InfluxDB accepted the write, -1 on a
+// transient failure worth retrying later and -2 when the data itself was rejected.
+static int post_batch(const char* body, size_t len) {
+    CURLcode res;
+    long response_code = 0;
+    long new_connections = 0;
+    size_t wire_len = 0;
+    int rc = -1;
+
+    if (gzip_enabled && len <= gzip_buffer_bytes) {
+        wire_len = gzip_body(body, len);
+    }
+    if (wire_len > 0) {
+        curl_easy_setopt(curl_handle, CURLOPT_HTTPHEADER, gzip_headers);
+        curl_easy_setopt(curl_handle, CURLOPT_POSTFIELDS, gzip_buffer);
+    } else {
+        // Compression off or failed, the raw body is still valid
+        wire_len = len;
+        curl_easy_setopt(curl_handle, CURLOPT_HTTPHEADER, plain_headers);
+        curl_easy_setopt(curl_handle, CURLOPT_POSTFIELDS, body);
+    }
+    curl_easy_setopt(curl_handle, CURLOPT_POSTFIELDSIZE, (long)wire_len);
+
+    res = curl_easy_perform(curl_handle);
+    if (res != CURLE_OK) {
+        fprintf(stderr, "InfluxWriter: curl_easy_perform() failed: %s\n", curl_easy_strerror(res));
+    } else {
+        curl_easy_getinfo(curl_handle, CURLINFO_RESPONSE_CODE, &response_code);
+        if (response_code >= 200 && response_code < 300) {
+            rc = 0;
+        } else {
+            fprintf(stderr, "InfluxWriter: write rejected, HTTP status %ld\n", response_code);
+            if (response_code >= 400 && response_code < 500 && response_code != 401 &&
+                response_code != 403 && response_code != 429) {
+                rc = -2;
+            }
+        }
+    }
+    curl_easy_getinfo(curl_handle, CURLINFO_NUM_CONNECTS, &new_connections);
+
+    pthread_mutex_lock(&writer_mutex);
+    writer_stats.requests++;
+    writer_stats.connections += new_connections;
+    writer_stats.body_bytes += len;
+    writer_stats.wire_bytes += wire_len;
+    pthread_mutex_unlock(&writer_mutex);
+    return rc;
+}
+
+// Sets up the persistent handle, headers and gzip stream. Returns 0 on success.
+static int http_init(void) {
+    gzip_enabled = 0;
+    curl_handle = curl_easy_init();
+    if (curl_handle == NULL) {
+        fprintf(stderr, "InfluxWriter: curl_easy_init() failed\n");
+        return -1;
+    }
+    plain_headers = curl_slist_append(plain_headers, auth_header);
+    plain_headers = curl_slist_append(plain_headers, "Content-Type: text/plain; charset=utf-8");
+    // Older libcurl waits for "100 Continue" before any body over 1 KiB, a
+    // round trip per batch (and a 1 s stall against servers that never send it)
+    plain_headers = curl_slist_append(plain_headers, "Expect:");
+    gzip_headers = curl_slist_append(gzip_headers, auth_header);
+    gzip_headers = curl_slist_append(gzip_headers, "Content-Type: text/plain; charset=utf-8");
+    gzip_headers = curl_slist_append(gzip_headers, "Content-Encoding: gzip");
+    gzip_headers = curl_slist_append(gzip_headers, "Expect:");
+
+    curl_easy_setopt(curl_handle, CURLOPT_URL, write_url);
+    curl_easy_setopt(curl_handle, CURLOPT_WRITEFUNCTION, discard_response);
+    curl_easy_setopt(curl_handle, CURLOPT_TIMEOUT, 30L);
+    // Keep the idle connection alive between flushes instead of reconnecting
+    curl_easy_setopt(curl_handle, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(curl_handle, CURLOPT_TCP_KEEPIDLE, 30L);
+    curl_easy_setopt(curl_handle, CURLOPT_TCP_KEEPINTVL, 15L);
+
+    if (writer_config.gzip_level > 0) {
+        // windowBits 15 + 16 selects the gzip wrapper InfluxDB expects
+        if (deflateInit2(&gzip_stream, writer_config.gzip_level, Z_DEFLATED, 15 + 16, 8,
+                         Z_DEFAULT_STRATEGY) != Z_OK) {
+            fprintf(stderr, "InfluxWriter: deflateInit2() failed, sending uncompressed\n");
+            return 0;
+        }
+        gzip_buffer_bytes = deflateBound(&gzip_stream, (uLong)(writer_config.buffer_bytes * 4));
+        gzip_buffer = malloc(gzip_buffer_bytes);
+        if (gzip_buffer == NULL) {
+            fprintf(stderr, "InfluxWriter: failed to allocate gzip buffer, sending uncompressed\n");
+            deflateEnd(&gzip_stream);
+            return 0;
+        }
+        gzip_enabled = 1;
+    }
+    return 0;
+}
+
+static void http_cleanup(void) {
+    curl_easy_cleanup(curl_handle);
+    curl_handle = NULL;
+    curl_slist_free_all(plain_headers);
+    curl_slist_free_all(gzip_headers);
+    plain_headers = NULL;
+    gzip_headers = NULL;
+    // gzip_enabled stays set so the final stats still report it
+    if (gzip_enabled) {
+        deflateEnd(&gzip_stream);
+    }
+    free(gzip_buffer);
+    gzip_buffer = NULL;
+}
+
+// Posts 'flushing' and updates the counters. Called without the mutex held.
+// Returns the post_batch() result.
+static int flush_buffer(void) {
+    int64_t start_ms = monotonic_ms();
+    int rc = post_batch(flushing->data, flushing->len);
+    double elapsed_ms = (double)(monotonic_ms() - start_ms);
+
+    pthread_mutex_lock(&writer_mutex);
+    writer_stats.flushes++;
+    writer_stats.last_batch_points = flushing->points;
+    if (flushing->points > writer_stats.max_batch_points) {
+        writer_stats.max_batch_points = flushing->points;
+    }
+    writer_stats.last_flush_ms = elapsed_ms;
+    writer_stats.total_flush_ms += elapsed_ms;
+    if (elapsed_ms > writer_stats.max_flush_ms) {
+        writer_stats.max_flush_ms = elapsed_ms;
+    }
+    if (rc == 0) {
+        writer_stats.points_written += flushing->points;
+    } else {
+        writer_stats.flush_failures++;
+    }
+    pthread_mutex_unlock(&writer_mutex);
+
+    if (rc == -1 && spool_enabled && spool_append(flushing->data, flushing->len) == 0) {
+        pthread_mutex_lock(&writer_mutex);
+        writer_stats.points_spooled += flushing->points;
+        pthread_mutex_unlock(&writer_mutex);
+    } else if (rc != 0) {
+        pthread_mutex_lock(&writer_mutex);
+        writer_stats.points_failed += flushing->points;
+        pthread_mutex_unlock(&writer_mutex);
+    }
+
+    flushing->len = 0;
+    flushing->points = 0;
+    return rc;
+}
+
+// Posts spooled batches oldest first until the spool is empty, a post fails,
+// or live data is waiting. Called without the mutex held.
+static void replay_spool(void) {
+    while (!spool_is_empty()) {
+        uint32_t records = 0;
+        size_t len = spool_peek(replay_buffer, replay_buffer_bytes, &records);
+        if (records == 0) {
+            break;
+        }
+
+        int64_t start_ms = monotonic_ms();
+        int rc = post_batch(replay_buffer, len);
+        if (rc == -1) {
+            break; // Endpoint still unhealthy, keep the records for later
+        }
+        if (rc == -2) {
+            fprintf(stderr, "InfluxWriter: discarding %u spooled batches rejected by InfluxDB\n", records);
+        }
+        spool_consume(records, len, (double)(monotonic_ms() - start_ms));
+
+        pthread_mutex_lock(&writer_mutex);
+        int live_waiting = batch_ready() || !writer_running;
+        pthread_mutex_unlock(&writer_mutex);
+        if (live_waiting) {
+            break;
+        }
+    }
+}
+
+static void* flush_thread_main(void* arg) {
+    pthread_mutex_lock(&writer_mutex);
+    while (1) {
+        // Sleep until the batch is full, the oldest point is too old, or we are stopping
+        while (writer_running && !batch_ready()) {
+            int64_t now_ms = monotonic_ms();
+            int64_t wait_ms = writer_config.flush_interval_ms;
+            if (active->points > 0) {
+                wait_ms = active->oldest_ms + writer_config.flush_interval_ms - now_ms;
+                if (wait_ms <= 0) {
+                    break;
+                }
+            }
+            struct timespec deadline;
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+            deadline.tv_sec += wait_ms / 1000;
+            deadline.tv_nsec += (wait_ms % 1000) * 1000000;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&writer_cond, &writer_mutex, &deadline);
+        }
+
+        if (active->points > 0) {
+            WriteBuffer* full = active;
+            active = flushing;
+            flushing = full;
+            int stopping = !writer_running;
+            pthread_mutex_unlock(&writer_mutex);
+            // A successful live write means the endpoint is back, so drain the spool too
+            if (flush_buffer() == 0 && spool_enabled && !stopping) {
+                replay_spool();
+            }
+            pthread_mutex_lock(&writer_mutex);
+        } else if (!writer_running) {
+            break;
+        } else if (spool_enabled) {
+            // Idle tick: probe the endpoint with spooled data
+            pthread_mutex_unlock(&writer_mutex);
+            replay_spool();
+            pthread_mutex_lock(&writer_mutex);
+        }
+    }
+    pthread_mutex_unlock(&writer_mutex);
+    return NULL;
+}
+
+int influx_writer_start(const InfluxWriterConfig* config) {
+    writer_config = *config;
+    if (writer_config.batch_max_points <= 0) {
+        writer_config.batch_max_points = INFLUX_WRITER_DEFAULT_BATCH_POINTS;
+    }
+    if (writer_config.flush_interval_ms <= 0) {
+        writer_config.flush_interval_ms = INFLUX_WRITER_DEFAULT_FLUSH_MS;
+    }
+    if (writer_config.gzip_level > 9) {
+        writer_config.gzip_level = 9;
+    }
+    if (writer_config.buffer_bytes == 0) {
+        writer_config.buffer_bytes = INFLUX_WRITER_DEFAULT_BUFFER_BYTES;
+    }
+
+    if (strcmp(writer_config.precision, "ms") == 0) {
+        precision_divisor = 1000000LL;
+    } else if (strcmp(writer_config.precision, "us") == 0) {
+        precision_divisor = 1000LL;
+    } else if (strcmp(writer_config.precision, "ns") == 0) {
+        precision_divisor = 1LL;
+    } else {
+        precision_divisor = 1000000000LL;
+    }
+
+    snprintf(write_url, sizeof(write_url), "%s/api/v2/write?org=%s&bucket=%s&precision=%s",
+             writer_config.host, writer_config.org, writer_config.bucket, writer_config.precision);
+    snprintf(auth_header, sizeof(auth_header), "Authorization: Token %s", writer_config.token);
+
+    for (int i = 0; i < 2; i++) {
+        buffers[i].data = malloc(writer_config.buffer_bytes);
+        if (buffers[i].data == NULL) {
+            fprintf(stderr, "InfluxWriter: failed to allocate %zu byte batch buffer\n", writer_config.buffer_bytes);
+            return -1;
+        }
+        buffers[i].len = 0;
+        buffers[i].points = 0;
+    }
+    memset(&writer_stats, 0, sizeof(writer_stats));
+
+    for (int pump = 0; pump < PUMP_PREFIX_COUNT; pump++) {
+        char pump_tag[12];
+        const char* tags[] = { "pump", pump_tag };
+        snprintf(pump_tag, sizeof(pump_tag), "%d", pump);
+        lineproto_prefix_init(&pump_prefixes[pump], "pump_data", tags, 1);
+    }
+
+    if (writer_config.spool_path != NULL) {
+        if (writer_config.spool_bytes == 0) {
+            writer_config.spool_bytes = SPOOL_DEFAULT_BYTES;
+        }
+        // Replay posts are larger than live batches but must hold any single spooled batch
+        replay_buffer_bytes = writer_config.buffer_bytes * 4;
+        replay_buffer = malloc(replay_buffer_bytes);
+        if (replay_buffer != NULL && spool_open(writer_config.spool_path, writer_config.spool_bytes, writer_config.precision) == 0) {
+            spool_enabled = 1;
+        } else {
+            fprintf(stderr, "InfluxWriter: spool disabled, failed writes will be lost\n");
+            free(replay_buffer);
+            replay_buffer = NULL;
+        }
+    }
+
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    if (http_init() != 0) {
+        return -1;
+    }
+
+    // Deadlines are computed on CLOCK_MONOTONIC so wall clock steps do not stall flushes
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&writer_cond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+
+    writer_running = 1;
+    if (pthread_create(&flush_thread, NULL, flush_thread_main, NULL) != 0) {
+        fprintf(stderr, "InfluxWriter: failed to start flush thread: %s\n", strerror(errno));
+        writer_running = 0;
+        return -1;
+    }
+    return 0;
+}
+
+static const LineProtoPrefix* pump_prefix(int pump, LineProtoPrefix* other_prefix) {
+    char pump_tag[12];
+    const char* tags[] = { "pump", pump_tag };
+
+    if (pump >= 0 && pump < PUMP_PREFIX_COUNT) {
+        return &pump_prefixes[pump];
+    }
+    snprintf(pump_tag, sizeof(pump_tag), "%d", pump);
+    lineproto_prefix_init(other_prefix, "pump_data", tags, 1);
+    return other_prefix;
+}
+
+int influx_writer_add_pump_points(const InfluxPumpPoint* points, int count) {
+    LineProtoPrefix other_prefix;
+    LineProtoWriter w;
+    int queued = 0;
+
+    pthread_mutex_lock(&writer_mutex);
+    for (; queued < count; queued++) {
+        const InfluxPumpPoint* p = &points[queued];
+        // Encode straight into the batch; a point that does not fit is not copied
+        lineproto_begin(&w, active->data + active->len, writer_config.buffer_bytes - active->len,
+                        pump_prefix(p->pump, &other_prefix));
+        lineproto_field_int(&w, &pump_keys[0], p->param1);
+        lineproto_field_int(&w, &pump_keys[1], p->param2);
+        lineproto_field_float(&w, &pump_keys[2], p->intervalFlow);
+        lineproto_field_float(&w, &pump_keys[3], p->pressure);
+        lineproto_field_float(&w, &pump_keys[4], p->amperage);
+        lineproto_field_float(&w, &pump_keys[5], p->temperature);
+        int len = lineproto_end(&w, p->timestamp_ns / precision_divisor);
+        if (len < 0) {
+            active->data[active->len] = '\0';
+            break;
+        }
+        if (active->points == 0) {
+            active->oldest_ms = monotonic_ms();
+        }
+        active->len += len;
+        active->points++;
+    }
+    writer_stats.points_queued += queued;
+    writer_stats.points_dropped += count - queued;
+    if (queued < count || batch_ready()) {
+        pthread_cond_signal(&writer_cond);
+    }
+    pthread_mutex_unlock(&writer_mutex);
+    return queued == count ? 0 : -1;
+}
+
+int influx_writer_add_pump_point(int pump, int param1, int param2,
+                                 float intervalFlow, float pressure, float amperage, float temperature,
+                                 int64_t timestamp_ns) {
+    InfluxPumpPoint point = {
+        .pump = pump,
+        .param1 = param1,
+        .param2 = param2,
+        .intervalFlow = intervalFlow,
+        .pressure = pressure,
+        .amperage = amperage,
+        .temperature = temperature,
+        .timestamp_ns = timestamp_ns,
+    };
+    return influx_writer_add_pump_points(&point, 1);
+}
+
+int influx_writer_add_line(const char* line, size_t len) {
+    pthread_mutex_lock(&writer_mutex);
+    if (active->len + len + 1 > writer_config.buffer_bytes) {
+        writer_stats.points_dropped++;
+        pthread_cond_signal(&writer_cond);
+        pthread_mutex_unlock(&writer_mutex);
+        return -1;
+    }
+    if (active->points == 0) {
+        active->oldest_ms = monotonic_ms();
+    }
+    memcpy(active->data + active->len, line, len);
+    active->len += len;
+    active->data[active->len] = '\0';
+    active->points++;
+    writer_stats.points_queued++;
+    if (batch_ready()) {
+        pthread_cond_signal(&writer_cond);
+    }
+    pthread_mutex_unlock(&writer_mutex);
+    return 0;
+}
+
+int64_t influx_writer_timestamp(int64_t timestamp_ns) {
+    return timestamp_ns / precision_divisor;
+}
+
+void influx_writer_get_stats(InfluxWriterStats* stats) {
+    pthread_mutex_lock(&writer_mutex);
+    *stats = writer_stats;
+    pthread_mutex_unlock(&writer_mutex);
+}
+
+void influx_writer_print_stats(FILE* out) {
+    InfluxWriterStats s;
+    influx_writer_get_stats(&s);
+    fprintf(out, "InfluxWriter: queued=%llu written=%llu dropped=%llu failed=%llu flushes=%llu failures=%llu "
+                 "batch(last=%u max=%u) flush_ms(last=%.1f max=%.1f avg=%.1f)\n",
+            (unsigned long long)s.points_queued, (unsigned long long)s.points_written,
+            (unsigned long long)s.points_dropped, (unsigned long long)s.points_failed,
+            (unsigned long long)s.flushes, (unsigned long long)s.flush_failures,
+            s.last_batch_points, s.max_batch_points,
+            s.last_flush_ms, s.max_flush_ms, s.flushes ? s.total_flush_ms / s.flushes : 0.0);
+    fprintf(out, "InfluxWriter: requests=%llu connections=%llu body_bytes=%llu wire_bytes=%llu (%.1f%%, gzip %s)\n",
+            (unsigned long long)s.requests, (unsigned long long)s.connections,
+            (unsigned long long)s.body_bytes, (unsigned long long)s.wire_bytes,
+            s.body_bytes ? 100.0 * s.wire_bytes / s.body_bytes : 0.0, gzip_enabled ? "on" : "off");
+    if (spool_enabled) {
+        fprintf(out, "InfluxWriter: spooled=%llu ", (unsigned long long)s.points_spooled);
+        spool_print_stats(out);
+    }
+}
+
+void influx_writer_stop(void) {
+    pthread_mutex_lock(&writer_mutex);
+    if (!writer_running) {
+        pthread_mutex_unlock(&writer_mutex);
+        return;
+    }
+    writer_running = 0;
+    pthread_cond_signal(&writer_cond);
+    pthread_mutex_unlock(&writer_mutex);
+
+    pthread_join(flush_thread, NULL);
+    http_cleanup();
+    curl_global_cleanup();
+
+    for (int i = 0; i < 2; i++) {
+        free(buffers[i].data);
+        buffers[i].data = NULL;
+    }
+    if (spool_enabled) {
+        spool_close();
+        spool_enabled = 0;
+    }
+    free(replay_buffer);
+    replay_buffer = NULL;
+}
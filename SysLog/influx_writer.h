@@ -0,0 +1,90 @@
+#ifndef INFLUX_WRITER_H
+#define INFLUX_WRITER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// Default batching triggers: flush when either limit is reached
+#define INFLUX_WRITER_DEFAULT_BATCH_POINTS 5000
+#define INFLUX_WRITER_DEFAULT_FLUSH_MS     10000
+#define INFLUX_WRITER_DEFAULT_BUFFER_BYTES (1024 * 1024)
+// Low gzip levels already shrink line protocol several times over and are cheap on a Pi
+#define INFLUX_WRITER_DEFAULT_GZIP_LEVEL   3
+
+// One pump_data point
+typedef struct {
+    int pump;
+    int param1;
+    int param2;
+    float intervalFlow;
+    float pressure;
+    float amperage;
+    float temperature;
+    int64_t timestamp_ns;
+} InfluxPumpPoint;
+
+// Writer configuration
+typedef struct {
+    const char* host;          // e.g. "http://192.168.1.88:8086"
+    const char* org;
+    const char* bucket;
+    const char* token;
+    const char* precision;     // InfluxDB write precision ("s", "ms", "us", "ns")
+    int batch_max_points;      // Flush once this many points are buffered
+    int flush_interval_ms;     // Flush once the oldest buffered point is this old
+    size_t buffer_bytes;       // Capacity of each in-memory batch buffer
+    const char* spool_path;    // On-disk spool for failed batches, NULL disables it
+    size_t spool_bytes;        // Spool capacity
+    int gzip_level;            // 1-9 gzip compresses request bodies, 0 sends them as is
+} InfluxWriterConfig;
+
+// Counters exposed for tuning the batch size / flush interval
+typedef struct {
+    uint64_t points_queued;    // Points accepted into the batch buffer
+    uint64_t points_written;   // Points acknowledged by InfluxDB
+    uint64_t points_dropped;   // Points rejected because the buffer was full
+    uint64_t points_failed;    // Points lost in failed flushes
+    uint64_t points_spooled;   // Points from failed flushes saved to the spool
+    uint64_t flushes;          // Flush attempts (successful or not)
+    uint64_t flush_failures;   // Flushes that did not get a 2xx response
+    uint64_t requests;         // HTTP writes, live and replayed
+    uint64_t connections;      // TCP connections opened for those writes
+    uint64_t body_bytes;       // Line protocol bytes posted
+    uint64_t wire_bytes;       // Request body bytes after compression
+    uint32_t last_batch_points;
+    uint32_t max_batch_points;
+    double   last_flush_ms;    // Wall time of the last HTTP write
+    double   max_flush_ms;
+    double   total_flush_ms;
+} InfluxWriterStats;
+
+// Starts the background flush thread. Returns 0 on success.
+int influx_writer_start(const InfluxWriterConfig* config);
+
+// Queues one pump_data point. The timestamp is in nanoseconds since the epoch
+// and is converted to the configured precision. Never blocks on the network.
+int influx_writer_add_pump_point(int pump, int param1, int param2,
+                                 float intervalFlow, float pressure, float amperage, float temperature,
+                                 int64_t timestamp_ns);
+
+// Queues 'count' points under a single lock, so every pump sampled in one tick
+// lands in the same batch and goes out in the same request. Points that do
+// not fit are dropped and counted; returns -1 if any were.
+int influx_writer_add_pump_points(const InfluxPumpPoint* points, int count);
+
+// Queues one already encoded, newline terminated line-protocol point whose
+// timestamp came from influx_writer_timestamp(). Never blocks on the network.
+int influx_writer_add_line(const char* line, size_t len);
+
+// Converts nanoseconds since the epoch to the configured write precision
+int64_t influx_writer_timestamp(int64_t timestamp_ns);
+
+// Copies the current counters
+void influx_writer_get_stats(InfluxWriterStats* stats);
+void influx_writer_print_stats(FILE* out);
+
+// Flushes whatever is buffered and stops the flush thread
+void influx_writer_stop(void);
+
+#endif // INFLUX_WRITER_H
@@ -0,0 +1,61 @@
+#include "latency_hist.h"
+#include <string.h>
+
+void latency_hist_reset(LatencyHistogram* hist) {
+    memset(hist, 0, sizeof(LatencyHistogram));
+}
+
+void latency_hist_record(LatencyHistogram* hist, int64_t value_us) {
+    int bucket = 0;
+
+    if (value_us < 0) {
+        value_us = 0;
+    }
+    while (bucket < LATENCY_HIST_BUCKETS - 1 && value_us >= ((int64_t)1 << bucket)) {
+        bucket++;
+    }
+    hist->buckets[bucket]++;
+
+    if (hist->count == 0 || value_us < hist->min_us) {
+        hist->min_us = value_us;
+    }
+    if (value_us > hist->max_us) {
+        hist->max_us = value_us;
+    }
+    hist->count++;
+    hist->sum_us += (double)value_us;
+}
+
+int64_t latency_hist_percentile(const LatencyHistogram* hist, double percentile) {
+    uint64_t target;
+    uint64_t seen = 0;
+
+    if (hist->count == 0) {
+        return 0;
+    }
+    target = (uint64_t)(hist->count * percentile / 100.0);
+    if (target == 0) {
+        target = 1;
+    }
+    for (int i = 0; i < LATENCY_HIST_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen >= target) {
+            return ((int64_t)1 << i);
+        }
+    }
+    return hist->max_us;
+}
+
+void latency_hist_print(const LatencyHistogram* hist, const char* name, FILE* out) {
+    fprintf(out, "%s: n=%llu min=%lldus mean=%.0fus p50<%lldus p99<%lldus max=%lldus\n",
+            name, (unsigned long long)hist->count, (long long)hist->min_us,
+            hist->count ? hist->sum_us / hist->count : 0.0,
+            (long long)latency_hist_percentile(hist, 50.0),
+            (long long)latency_hist_percentile(hist, 99.0),
+            (long long)hist->max_us);
+    for (int i = 0; i < LATENCY_HIST_BUCKETS; i++) {
+        if (hist->buckets[i] > 0) {
+            fprintf(out, "    <%10lldus %llu\n", (long long)((int64_t)1 << i), (unsigned long long)hist->buckets[i]);
+        }
+    }
+}
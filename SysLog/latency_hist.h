@@ -0,0 +1,27 @@
+#ifndef LATENCY_HIST_H
+#define LATENCY_HIST_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+// Power-of-two microsecond buckets: bucket i counts values in [2^(i-1), 2^i) us
+#define LATENCY_HIST_BUCKETS 32
+
+typedef struct {
+    uint64_t buckets[LATENCY_HIST_BUCKETS];
+    uint64_t count;
+    int64_t  min_us;
+    int64_t  max_us;
+    double   sum_us;
+} LatencyHistogram;
+
+void latency_hist_reset(LatencyHistogram* hist);
+void latency_hist_record(LatencyHistogram* hist, int64_t value_us);
+
+// Upper bound (us) of the bucket containing the given percentile (0-100)
+int64_t latency_hist_percentile(const LatencyHistogram* hist, double percentile);
+
+// One line summary followed by the non-empty buckets
+void latency_hist_print(const LatencyHistogram* hist, const char* name, FILE* out);
+
+#endif // LATENCY_HIST_H
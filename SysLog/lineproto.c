@@ -0,0 +1,293 @@
+#include "lineproto.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+// Exact in a double up to 1e22
+static const double pow10_table[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9,
+    1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+};
+#define POW10_COUNT ((int)(sizeof(pow10_table) / sizeof(pow10_table[0])))
+
+// Writes the decimal digits of value to out and returns how many
+static int format_u64(char* out, uint64_t value) {
+    char tmp[20];
+    int n = 0;
+
+    do {
+        tmp[n++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+    for (int i = 0; i < n; i++) {
+        out[i] = tmp[n - 1 - i];
+    }
+    return n;
+}
+
+// Writes mantissa / 10^decimals in fixed notation
+static int format_fixed(char* out, uint64_t mantissa, int decimals) {
+    char digits[20];
+    int n = format_u64(digits, mantissa);
+    int len = 0;
+
+    if (decimals == 0) {
+        memcpy(out, digits, n);
+        return n;
+    }
+    if (n <= decimals) {
+        out[len++] = '0';
+        out[len++] = '.';
+        for (int i = n; i < decimals; i++) {
+            out[len++] = '0';
+        }
+        memcpy(out + len, digits, n);
+        return len + n;
+    }
+    memcpy(out, digits, n - decimals);
+    len = n - decimals;
+    out[len++] = '.';
+    memcpy(out + len, digits + n - decimals, decimals);
+    return len + decimals;
+}
+
+int lineproto_format_float(char* out, float value) {
+    double magnitude = fabs((double)value);
+    float target = fabsf(value);
+    int len = 0;
+
+    if (!isfinite(value)) {
+        return 0;
+    }
+    if (magnitude == 0.0) {
+        out[0] = '0';
+        return 1;
+    }
+    if (value < 0) {
+        out[len++] = '-';
+    }
+    // Fewest decimals whose rounded mantissa converts back to the same float.
+    // Sensor readings settle within two or three steps.
+    for (int decimals = 0; decimals < POW10_COUNT; decimals++) {
+        double scaled = magnitude * pow10_table[decimals];
+        if (scaled >= 9.0e18) {
+            break;
+        }
+        uint64_t mantissa = (uint64_t)(scaled + 0.5);
+        if ((float)((double)mantissa / pow10_table[decimals]) == target) {
+            return len + format_fixed(out + len, mantissa, decimals);
+        }
+    }
+    // Magnitudes far outside anything a sensor reports
+    return len + snprintf(out + len, 47, "%.9g", magnitude);
+}
+
+// Copies src escaping the characters line protocol treats as separators
+static int append_escaped(char* out, size_t cap, size_t* len, const char* src, const char* specials) {
+    for (; *src != '\0'; src++) {
+        if (strchr(specials, *src) != NULL) {
+            if (*len + 1 >= cap) {
+                return -1;
+            }
+            out[(*len)++] = '\\';
+        }
+        if (*len + 1 >= cap) {
+            return -1;
+        }
+        out[(*len)++] = *src;
+    }
+    return 0;
+}
+
+int lineproto_prefix_init(LineProtoPrefix* prefix, const char* measurement,
+                          const char* const* tags, int tag_count) {
+    size_t len = 0;
+
+    if (append_escaped(prefix->text, sizeof(prefix->text), &len, measurement, ", ") != 0) {
+        return -1;
+    }
+    for (int i = 0; i < tag_count; i++) {
+        if (len + 1 >= sizeof(prefix->text)) {
+            return -1;
+        }
+        prefix->text[len++] = ',';
+        if (append_escaped(prefix->text, sizeof(prefix->text), &len, tags[2 * i], ",= ") != 0) {
+            return -1;
+        }
+        if (len + 1 >= sizeof(prefix->text)) {
+            return -1;
+        }
+        prefix->text[len++] = '=';
+        if (append_escaped(prefix->text, sizeof(prefix->text), &len, tags[2 * i + 1], ",= ") != 0) {
+            return -1;
+        }
+    }
+    if (len + 1 >= sizeof(prefix->text)) {
+        return -1;
+    }
+    prefix->text[len++] = ' ';
+    prefix->text[len] = '\0';
+    prefix->len = len;
+    return 0;
+}
+
+void lineproto_begin(LineProtoWriter* w, char* buf, size_t cap, const LineProtoPrefix* prefix) {
+    w->buf = buf;
+    w->cap = cap;
+    w->len = 0;
+    w->fields = 0;
+    w->overflow = 0;
+    if (prefix->len > cap) {
+        w->overflow = 1;
+        return;
+    }
+    memcpy(buf, prefix->text, prefix->len);
+    w->len = prefix->len;
+}
+
+// Reserves room for ",key=" plus 'value_max' bytes. Returns NULL on overflow.
+static char* field_start(LineProtoWriter* w, const LineProtoKey* key, size_t value_max) {
+    char* p;
+
+    if (w->overflow || w->len + 1 + key->len + value_max > w->cap) {
+        w->overflow = 1;
+        return NULL;
+    }
+    p = w->buf + w->len;
+    if (w->fields > 0) {
+        *p++ = ',';
+    }
+    memcpy(p, key->text, key->len);
+    return p + key->len;
+}
+
+void lineproto_field_float(LineProtoWriter* w, const LineProtoKey* key, float value) {
+    char* p;
+
+    if (!isfinite(value)) {
+        return;
+    }
+    if ((p = field_start(w, key, 48)) == NULL) {
+        return;
+    }
+    p += lineproto_format_float(p, value);
+    w->len = p - w->buf;
+    w->fields++;
+}
+
+void lineproto_field_int(LineProtoWriter* w, const LineProtoKey* key, int64_t value) {
+    char* p;
+
+    if ((p = field_start(w, key, 21)) == NULL) {
+        return;
+    }
+    if (value < 0) {
+        *p++ = '-';
+        p += format_u64(p, (uint64_t)0 - (uint64_t)value);
+    } else {
+        p += format_u64(p, (uint64_t)value);
+    }
+    w->len = p - w->buf;
+    w->fields++;
+}
+
+int lineproto_end(LineProtoWriter* w, int64_t timestamp) {
+    char* p;
+
+    // ' ' + sign + 19 digits + '\n' + NUL
+    if (w->overflow || w->fields == 0 || w->len + 23 > w->cap) {
+        return -1;
+    }
+    p = w->buf + w->len;
+    *p++ = ' ';
+    if (timestamp < 0) {
+        *p++ = '-';
+        p += format_u64(p, (uint64_t)0 - (uint64_t)timestamp);
+    } else {
+        p += format_u64(p, (uint64_t)timestamp);
+    }
+    *p++ = '\n';
+    *p = '\0';
+    w->len = p - w->buf;
+    return (int)w->len;
+}
+
+static double elapsed_seconds(const struct timespec* start, const struct timespec* end) {
+    return (double)(end->tv_sec - start->tv_sec) + (double)(end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+void lineproto_benchmark(long points, FILE* out) {
+    static const LineProtoKey keys[] = {
+        LINEPROTO_KEY("param1"), LINEPROTO_KEY("param2"), LINEPROTO_KEY("intervalFlow"),
+        LINEPROTO_KEY("pressure"), LINEPROTO_KEY("amperage"), LINEPROTO_KEY("temperature"),
+    };
+    static const char* const tags[] = { "pump", "3" };
+    enum { SAMPLES = 1024 };
+    float samples[SAMPLES][4];
+    char buf[256];
+    char check[48];
+    LineProtoPrefix prefix;
+    LineProtoWriter w;
+    struct timespec start, end;
+    int64_t timestamp = 1700000000000LL;
+    size_t bytes = 0;
+    long mismatches = 0;
+    volatile size_t sink = 0;
+    double encoder_s, snprintf_s;
+
+    if (points <= 0) {
+        points = 1000000;
+    }
+    // Readings shaped like the monitors report: flow, psi, amps, degrees F
+    srand(1);
+    for (int i = 0; i < SAMPLES; i++) {
+        samples[i][0] = (float)(rand() % 2000) / 100.0f;
+        samples[i][1] = 40.0f + (float)(rand() % 3000) / 100.0f;
+        samples[i][2] = (float)(rand() % 1500) / 100.0f + (float)rand() / RAND_MAX / 1000.0f;
+        samples[i][3] = 32.0f + (float)rand() / RAND_MAX * 60.0f;
+    }
+    lineproto_prefix_init(&prefix, "pump_data", tags, 1);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (long i = 0; i < points; i++) {
+        const float* s = samples[i & (SAMPLES - 1)];
+        lineproto_begin(&w, buf, sizeof(buf), &prefix);
+        lineproto_field_int(&w, &keys[0], 1);
+        lineproto_field_int(&w, &keys[1], 2);
+        lineproto_field_float(&w, &keys[2], s[0]);
+        lineproto_field_float(&w, &keys[3], s[1]);
+        lineproto_field_float(&w, &keys[4], s[2]);
+        lineproto_field_float(&w, &keys[5], s[3]);
+        bytes += lineproto_end(&w, timestamp + i);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    encoder_s = elapsed_seconds(&start, &end);
+    sink += bytes;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (long i = 0; i < points; i++) {
+        const float* s = samples[i & (SAMPLES - 1)];
+        sink += snprintf(buf, sizeof(buf),
+                         "pump_data,pump=%d param1=%d,param2=%d,intervalFlow=%f,pressure=%f,amperage=%f,temperature=%f %lld\n",
+                         3, 1, 2, s[0], s[1], s[2], s[3], (long long)(timestamp + i));
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    snprintf_s = elapsed_seconds(&start, &end);
+
+    // Every formatted value must parse back to the float it came from
+    for (int i = 0; i < SAMPLES; i++) {
+        for (int f = 0; f < 4; f++) {
+            check[lineproto_format_float(check, samples[i][f])] = '\0';
+            if (strtof(check, NULL) != samples[i][f]) {
+                mismatches++;
+            }
+        }
+    }
+
+    fprintf(out, "LineProto: %ld points, %.1f bytes/point\n", points, (double)bytes / points);
+    fprintf(out, "  encoder:  %.0f points/s (%.0f ns/point)\n", points / encoder_s, encoder_s * 1e9 / points);
+    fprintf(out, "  snprintf: %.0f points/s (%.0f ns/point)\n", points / snprintf_s, snprintf_s * 1e9 / points);
+    fprintf(out, "  round-trip mismatches: %ld of %d\n", mismatches, SAMPLES * 4);
+    (void)sink;
+}
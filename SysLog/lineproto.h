@@ -0,0 +1,59 @@
+#ifndef LINEPROTO_H
+#define LINEPROTO_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Longest pre-encoded "measurement,tag=value,... " prefix
+#define LINEPROTO_PREFIX_MAX 128
+
+// Measurement and tag set escaped once, copied verbatim in front of every point
+typedef struct {
+    char   text[LINEPROTO_PREFIX_MAX];
+    size_t len;
+} LineProtoPrefix;
+
+// Field key with its '=' already appended, e.g. LINEPROTO_KEY("pressure")
+typedef struct {
+    const char* text;
+    size_t      len;
+} LineProtoKey;
+
+#define LINEPROTO_KEY(name) { name "=", sizeof(name "=") - 1 }
+
+// Encodes one point into a caller-owned buffer without allocating
+typedef struct {
+    char*  buf;
+    size_t cap;
+    size_t len;
+    int    fields;
+    int    overflow;
+} LineProtoWriter;
+
+// Builds a prefix from a measurement and 'tag_count' key/value pairs
+// (tags[0]=key, tags[1]=value, ...). Returns 0, or -1 if it does not fit.
+int lineproto_prefix_init(LineProtoPrefix* prefix, const char* measurement,
+                          const char* const* tags, int tag_count);
+
+void lineproto_begin(LineProtoWriter* w, char* buf, size_t cap, const LineProtoPrefix* prefix);
+
+// Floats use the fewest decimals that parse back to the same float. Integers
+// are written without the 'i' suffix so they stay float fields like the data
+// already in the bucket. Non-finite values are skipped, InfluxDB rejects them.
+void lineproto_field_float(LineProtoWriter* w, const LineProtoKey* key, float value);
+void lineproto_field_int(LineProtoWriter* w, const LineProtoKey* key, int64_t value);
+
+// Appends the timestamp and newline. Returns the encoded length, or -1 if the
+// buffer was too small or the point has no fields; nothing is written past cap.
+int lineproto_end(LineProtoWriter* w, int64_t timestamp);
+
+// Writes the shortest round-trip decimal for 'value' to out (at least 48
+// bytes) and returns its length, 0 for NaN or infinity
+int lineproto_format_float(char* out, float value);
+
+// Encodes 'points' pump_data points and reports points/second for the encoder
+// and for the snprintf() formatting it replaced
+void lineproto_benchmark(long points, FILE* out);
+
+#endif // LINEPROTO_H
@@ -7,10 +7,19 @@
 #include <json-c/json.h>
 #include "unistd.h"
 #include "MQTTClient.h"
-#include "influxdb.h"
+#include "influx_writer.h"
+#include "spool.h"
+#include "monitor_events.h"
+#include "latency_hist.h"
+#include "lineproto.h"
+#include "sdt.h"
+#include "pump_runs.h"
+#include "rollup.h"
+#include "tick_timer.h"
 #include "../include/water.h"
 //#include "../include/alert.h"
 #include <stdbool.h> // Required for using 'bool' type
+#include <signal.h>
 
 int verbose = FALSE;
 
@@ -18,9 +27,60 @@ int verbose = FALSE;
 #define INFLUXDB_TOKEN "RHl3fYEp8eMLtIUraVPzY4zp_hnnu2kYlR9hYrUaJLcq5mB2PvDsOi9SR0Tu_i-t_183fHb1a95BTJug-vAPVQ=="
 #define INFLUXDB_ORG "Milano"
 #define INFLUXDB_BUCKET "MWPWater"
-#define INFLUXDB_PRECISION "s"
+// Millisecond timestamps keep sub-second samples from overwriting each other
+#define INFLUXDB_PRECISION "ms"
+
+// How often the writer and sampling counters are printed
+#define STATS_INTERVAL_SECONDS 60
+
+// Pumps sampled by the logger, each fed by one monitor message
+#define PUMP_SLOT_WELL1      0
+#define PUMP_SLOT_WELL3      1
+#define PUMP_SLOT_IRRIGATION 2
+#define PUMP_SLOT_COUNT      3
+
+// Sampling timing, kept per pump so the polled and event driven modes can be compared
+typedef struct {
+   LatencyHistogram latency;   // Sample time minus arrival of the message it used
+   LatencyHistogram jitter;    // |sample interval - message interval|
+   uint64_t samples;
+   uint64_t duplicates;        // Samples that reused an already sampled message
+   uint64_t missed;            // Messages that arrived but were never sampled
+   int running;                // Pump was running at the previous sample
+   uint64_t last_seq;
+   int64_t last_arrival_ns;
+   int64_t last_sample_ns;
+} SampleTiming;
+
+static SampleTiming sample_timing[PUMP_SLOT_COUNT];
+static const char* pump_slot_names[PUMP_SLOT_COUNT] = { "well pump 1", "well pump 3", "irrigation pump" };
+static const int pump_slot_pumps[PUMP_SLOT_COUNT] = { 3, 3, 4 };
+static int event_mode = FALSE;
+
+// Swinging-door compression per pump: { deadband, deviation } for pressure (PSI),
+// amperage (A) and temperature (F), then the heartbeat in samples
+static const SdtConfig sdt_configs[PUMP_SLOT_COUNT] = {
+   { { { 0.2f, 0.5f }, { 0.05f, 0.2f }, { 0.2f, 0.5f } }, 60 },   // well pump 1
+   { { { 0.2f, 0.5f }, { 0.05f, 0.2f }, { 0.2f, 0.5f } }, 60 },   // well pump 3
+   { { { 0.2f, 0.5f }, { 0.05f, 0.2f }, { 0.2f, 0.5f } }, 60 },   // irrigation pump
+};
+static SdtStream sdt_streams[PUMP_SLOT_COUNT];
+static PumpRun pump_runs[PUMP_SLOT_COUNT];
+static int compress_points = FALSE;
+
+static volatile sig_atomic_t running = 1;
+
+static void handle_shutdown(int sig)
+{
+   running = 0;
+}
 
-s_influxdb_client *influxdb_client;
+static int64_t realtime_ns(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_REALTIME, &ts);
+   return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
 
 MQTTClient client;
 MQTTClient_connectOptions conn_opts = MQTTClient_connectOptions_initializer;
@@ -51,13 +111,207 @@ void connlost(void *context, char *cause)
    printf("     cause: %s\n", cause);
 }
 
-int main(int argc, char *argv[])
+// Arrival bookkeeping, only touched by the MQTT callback thread
+static uint64_t arrival_seq[MONITOR_COUNT];
+static int64_t arrival_time_ns[MONITOR_COUNT];
+
+/*
+ * Wraps the shared msgarrvd() so every monitor message is timestamped on
+ * arrival. Once msgarrvd() has applied the message to the monitor globals,
+ * this same thread copies the fields the logger uses into a ring slot, so
+ * the logger never reads the globals while they are being written.
+ */
+int log_msgarrvd(void *context, char *topicName, int topicLen, MQTTClient_message *message)
+{
+   int64_t arrival_ns = realtime_ns();
+   // msgarrvd() frees the topic, so classify it first
+   MonitorSource source = monitor_source_from_topic(topicName);
+   int rc = msgarrvd(context, topicName, topicLen, message);
+   MonitorSnapshot *snap;
+
+   if (source == MONITOR_UNKNOWN) {
+      return rc;
+   }
+   arrival_seq[source]++;
+   arrival_time_ns[source] = arrival_ns;
+
+   if ((snap = monitor_ring_claim()) == NULL) {
+      return rc; // Logger is behind; counted as an overflow
+   }
+   snap->source = source;
+   memcpy(snap->seq, arrival_seq, sizeof(arrival_seq));
+   memcpy(snap->arrival_ns, arrival_time_ns, sizeof(arrival_time_ns));
+   snap->well.pump_1_on = wellMon_.well.well_pump_1_on;
+   snap->well.pump_3_on = wellMon_.well.well_pump_3_on;
+   snap->well.irrigation_pump_on = wellMon_.well.irrigation_pump_on;
+   snap->well.amp_pump_1 = wellMon_.well.amp_pump_1;
+   snap->well.amp_pump_3 = wellMon_.well.amp_pump_3;
+   snap->well.amp_pump_4 = wellMon_.well.amp_pump_4;
+   snap->house.intervalFlow = houseMon_.house.intervalFlow;
+   snap->house.pressurePSI = houseMon_.house.pressurePSI;
+   snap->house.temperatureF = houseMon_.house.temperatureF;
+   snap->tank.intervalFlow = tankMon_.tank.intervalFlow;
+   snap->tank.pressurePSI = tankMon_.tank.pressurePSI;
+   snap->tank.temperatureF = tankMon_.tank.temperatureF;
+   snap->irrigation.intervalFlow = irrigationMon_.irrigation.intervalFlow;
+   snap->irrigation.pressurePSI = irrigationMon_.irrigation.pressurePSI;
+   snap->irrigation.temperatureF = irrigationMon_.irrigation.temperatureF;
+   snap->irrigation_controller = irrigationMon_.irrigation.controller;
+   snap->irrigation_zone = irrigationMon_.irrigation.zone;
+   monitor_ring_publish();
+   return rc;
+}
+
+static void record_sample_timing(int slot, const MonitorSnapshot *snap, MonitorSource source)
+{
+   SampleTiming *timing = &sample_timing[slot];
+   int64_t sample_ns = realtime_ns();
+   uint64_t seq = snap->seq[source];
+   int64_t arrival_ns = snap->arrival_ns[source];
+
+   // Messages that arrive while a pump is off are not samples we missed
+   if (timing->running) {
+      if (seq == timing->last_seq) {
+         timing->duplicates++;
+      } else if (seq > timing->last_seq + 1) {
+         timing->missed += seq - timing->last_seq - 1;
+      }
+      int64_t drift_ns = (sample_ns - timing->last_sample_ns) - (arrival_ns - timing->last_arrival_ns);
+      latency_hist_record(&timing->jitter, llabs(drift_ns) / 1000);
+   }
+   if (arrival_ns > 0) {
+      latency_hist_record(&timing->latency, (sample_ns - arrival_ns) / 1000);
+   }
+   timing->samples++;
+   timing->running = 1;
+   timing->last_seq = seq;
+   timing->last_arrival_ns = arrival_ns;
+   timing->last_sample_ns = sample_ns;
+}
+
+static void print_sample_timing(FILE *out)
+{
+   char name[64];
+
+   fprintf(out, "Sampling mode: %s, ring overflows: %llu\n", event_mode ? "event" : "polled",
+           (unsigned long long)monitor_events_overflows());
+   pump_run_print_stats(out);
+   rollup_print_stats(out);
+   for (int slot = 0; slot < PUMP_SLOT_COUNT; slot++) {
+      SampleTiming *timing = &sample_timing[slot];
+      if (timing->samples == 0) {
+         continue;
+      }
+      fprintf(out, "%s: samples=%llu duplicates=%llu missed=%llu\n", pump_slot_names[slot],
+              (unsigned long long)timing->samples, (unsigned long long)timing->duplicates,
+              (unsigned long long)timing->missed);
+      snprintf(name, sizeof(name), "  %s latency", pump_slot_names[slot]);
+      latency_hist_print(&timing->latency, name, out);
+      snprintf(name, sizeof(name), "  %s jitter", pump_slot_names[slot]);
+      latency_hist_print(&timing->jitter, name, out);
+      if (compress_points) {
+         snprintf(name, sizeof(name), "  %s compression", pump_slot_names[slot]);
+         sdt_print_stats(&sdt_streams[slot], name, out);
+      }
+   }
+}
+
+// Every point one tick produces, handed to the writer in one call so they share
+// a batch and a request. A slot yields at most two compressed points plus the
+// last reading of a run that just ended.
+#define TICK_POINTS_MAX (PUMP_SLOT_COUNT * 3)
+static InfluxPumpPoint tick_points[TICK_POINTS_MAX];
+static int tick_point_count = 0;
+
+static void collect_point(int pump, int param1, int param2, float intervalFlow, float pressure,
+                          float amperage, float temperature, int64_t timestamp_ns)
+{
+   InfluxPumpPoint *point;
+
+   if (tick_point_count == TICK_POINTS_MAX) {
+      return;
+   }
+   point = &tick_points[tick_point_count++];
+   point->pump = pump;
+   point->param1 = param1;
+   point->param2 = param2;
+   point->intervalFlow = intervalFlow;
+   point->pressure = pressure;
+   point->amperage = amperage;
+   point->temperature = temperature;
+   point->timestamp_ns = timestamp_ns;
+}
+
+static void collect_sdt_point(int pump, const SdtSample *sample)
+{
+   collect_point(pump, sample->param1, sample->param2, sample->intervalFlow, sample->values[SDT_PRESSURE],
+                 sample->values[SDT_AMPERAGE], sample->values[SDT_TEMPERATURE], sample->timestamp_ns);
+}
+
+static void flush_tick_points(void)
+{
+   if (tick_point_count > 0) {
+      influx_writer_add_pump_points(tick_points, tick_point_count);
+      tick_point_count = 0;
+   }
+}
+
+// Collects a pump sample for the writer, through the compression stage if enabled,
+// and folds it into the pump's run summary. Called before record_sample_timing().
+static void queue_point(int slot, const MonitorSnapshot *snap, MonitorSource source, int pump, int param1,
+                        int param2, float intervalFlow, float pressure, float amperage, float temperature,
+                        int64_t sample_ns)
+{
+   int new_message = !sample_timing[slot].running || snap->seq[source] != sample_timing[slot].last_seq;
+   // A message's interval flow is counted once; ticks that sample it again
+   // carry 0, since the service sums intervalFlow over the points
+   float pointFlow = new_message ? intervalFlow : 0;
+   SdtSample sample = {
+      .timestamp_ns = sample_ns,
+      .param1 = param1,
+      .param2 = param2,
+      .intervalFlow = pointFlow,
+      .values = { pressure, amperage, temperature },
+   };
+   SdtSample out[2];
+   int count;
+
+   pump_run_sample(&pump_runs[slot], pump, param1, param2, intervalFlow, pressure, amperage, sample_ns, new_message);
+   if (new_message) {
+      rollup_add(pump, param1, param2, intervalFlow, pressure, amperage, temperature, sample_ns);
+   }
+   if (!compress_points) {
+      collect_point(pump, param1, param2, pointFlow, pressure, amperage, temperature, sample_ns);
+      return;
+   }
+   count = sdt_add(&sdt_streams[slot], &sample, out);
+   for (int i = 0; i < count; i++) {
+      collect_sdt_point(pump, &out[i]);
+   }
+}
+
+// The pump in 'slot' was seen stopped at 'end_ns'; closes its compressed run
+// on the last reading and writes the run summary
+static void end_pump_run(int slot, int64_t end_ns)
+{
+   SdtSample out;
+
+   sample_timing[slot].running = 0;
+   pump_run_end(&pump_runs[slot], end_ns);
+   if (compress_points && sdt_stop(&sdt_streams[slot], &out)) {
+      collect_sdt_point(pump_slot_pumps[slot], &out);
+   }
+}
+
+/*
+ * Samples every running pump whose readings come from one of the monitors in
+ * 'sources' and queues a point stamped with sample_ns. In polled mode sources
+ * is MONITOR_ALL; in event mode it is the monitor whose message just arrived.
+ * All readings come from one snapshot, so a point never mixes two messages,
+ * and every pump sampled here goes to the writer in a single call.
+ */
+static void sample_pumps(unsigned int sources, int64_t sample_ns, const MonitorSnapshot *snap)
 {
-   int i = 0;
-   int j = 0;
-   int stepcount = 0;
-   time_t t;
-   time(&t);
    int pump = 0;
    int param1 = 0;
    int param2 = 0;
@@ -65,15 +319,107 @@ int main(int argc, char *argv[])
    float pressure = 0;
    float amperage = 0;
    float temperature = 0;
+   time_t t = (time_t)(sample_ns / 1000000000LL);
+
+   if ((sources & MONITOR_BIT(MONITOR_HOUSE)) && snap->well.pump_1_on == 1 ) {
+      pump = 3;
+      param1 = 1;
+      param2 = 2;
+      intervalFlow = snap->house.intervalFlow  ;
+      pressure = snap->house.pressurePSI;
+      amperage = snap->well.amp_pump_1;
+      temperature = snap->house.temperatureF;
+      // Queue data for the InfluxDB writer
+      queue_point(PUMP_SLOT_WELL1, snap, MONITOR_HOUSE, pump, param1, param2, intervalFlow, pressure, amperage, temperature, sample_ns);
+      record_sample_timing(PUMP_SLOT_WELL1, snap, MONITOR_HOUSE);
+   }
+   else if (sources & MONITOR_BIT(MONITOR_HOUSE)) {
+      end_pump_run(PUMP_SLOT_WELL1, sample_ns);
+   }
+   if ((sources & MONITOR_BIT(MONITOR_TANK)) && snap->well.pump_3_on == 1 ) {
+      pump = 3;
+      param1 = 1;
+      param2 = 2;
+      intervalFlow = snap->tank.intervalFlow;
+      pressure = snap->tank.pressurePSI;
+      amperage = snap->well.amp_pump_3;
+      temperature = snap->tank.temperatureF;
+      // Every sample at up to 10 Hz, too much for the nohup log
+      if (verbose) {
+         printf("pump: %d, param1: %d, param2: %d, intervalFlow: %f, pressure: %f, amperage: %f, temperature: %f ", pump, param1, param2, intervalFlow, pressure, amperage, temperature);
+         printf("%s", ctime(&t));
+      }
+      // Queue data for the InfluxDB writer
+      queue_point(PUMP_SLOT_WELL3, snap, MONITOR_TANK, pump, param1, param2, intervalFlow, pressure, amperage, temperature, sample_ns);
+      record_sample_timing(PUMP_SLOT_WELL3, snap, MONITOR_TANK);
+   }
+   else if (sources & MONITOR_BIT(MONITOR_TANK)) {
+      end_pump_run(PUMP_SLOT_WELL3, sample_ns);
+   }
+   if ((sources & MONITOR_BIT(MONITOR_IRRIGATION)) && snap->well.irrigation_pump_on == 1 ) {
+      pump = 4;
+      if ( snap->irrigation_controller == 1 ) {
+         param1 = 1;
+         param2 = snap->irrigation_zone;
+      }
+      else if ( snap->irrigation_controller == 2 ) {
+         param1 = 2;
+         param2 = snap->irrigation_zone;
+      }
+      else {
+         param1 = 0;
+         param2 = 0;
+      }
+      intervalFlow = snap->irrigation.intervalFlow;
+      pressure = snap->irrigation.pressurePSI;
+      amperage = snap->well.amp_pump_4;
+      temperature = snap->irrigation.temperatureF;
+      // Every sample at up to 10 Hz, too much for the nohup log
+      if (verbose) {
+         printf("pump: %d, param1: %d, param2: %d intervalFlow: %f, pressure: %f, amperage: %f, temperature: %f ", pump, param1, param2, intervalFlow, pressure, amperage, temperature);
+         printf("%s", ctime(&t));
+      }
+      // Queue data for the InfluxDB writer
+      queue_point(PUMP_SLOT_IRRIGATION, snap, MONITOR_IRRIGATION, pump, param1, param2, intervalFlow, pressure, amperage, temperature, sample_ns);
+      record_sample_timing(PUMP_SLOT_IRRIGATION, snap, MONITOR_IRRIGATION);
+   }
+   else if (sources & MONITOR_BIT(MONITOR_IRRIGATION)) {
+      end_pump_run(PUMP_SLOT_IRRIGATION, sample_ns);
+   }
+   flush_tick_points();
+}
+
+int main(int argc, char *argv[])
+{
+   int i = 0;
+   int j = 0;
+   const MonitorSnapshot *snap;
 
    log_message("Log: Started\n");
 
    int rc;
    int opt;
    const char *mqtt_ip;
+   const char *rollup_path = ROLLUP_DEFAULT_PATH;
+   int sample_hz = 1;
    int mqtt_port;
-
-   while ((opt = getopt(argc, argv, "vPD")) != -1) {
+   int64_t now_ns;
+   int64_t last_stats_ns;
+   InfluxWriterConfig writer_config = {
+      .host = INFLUXDB_HOST,
+      .org = INFLUXDB_ORG,
+      .bucket = INFLUXDB_BUCKET,
+      .token = INFLUXDB_TOKEN,
+      .precision = INFLUXDB_PRECISION,
+      .batch_max_points = INFLUX_WRITER_DEFAULT_BATCH_POINTS,
+      .flush_interval_ms = INFLUX_WRITER_DEFAULT_FLUSH_MS,
+      .buffer_bytes = INFLUX_WRITER_DEFAULT_BUFFER_BYTES,
+      .spool_path = SPOOL_DEFAULT_PATH,
+      .spool_bytes = SPOOL_DEFAULT_BYTES,
+      .gzip_level = INFLUX_WRITER_DEFAULT_GZIP_LEVEL,
+   };
+
+   while ((opt = getopt(argc, argv, "vPDecr:b:f:S:M:z:R:B:")) != -1) {
       switch (opt) {
          case 'v':
                verbose = TRUE;
@@ -86,8 +432,39 @@ int main(int argc, char *argv[])
                mqtt_ip = DEV_MQTT_IP;
                mqtt_port = DEV_MQTT_PORT;
                break;
+         case 'e':
+               event_mode = TRUE;
+               break;
+         case 'c':
+               compress_points = TRUE;
+               break;
+         case 'r':
+               sample_hz = atoi(optarg);
+               break;
+         case 'b':
+               writer_config.batch_max_points = atoi(optarg);
+               break;
+         case 'f':
+               writer_config.flush_interval_ms = atoi(optarg) * 1000;
+               break;
+         case 'S':
+               writer_config.spool_path = optarg;
+               break;
+         case 'M':
+               writer_config.spool_bytes = (size_t)atol(optarg) * 1024 * 1024;
+               break;
+         case 'z':
+               writer_config.gzip_level = atoi(optarg);
+               break;
+         case 'R':
+               rollup_path = optarg;
+               break;
+         case 'B':
+               // Encoder microbenchmark, no broker or InfluxDB needed
+               lineproto_benchmark(atol(optarg), stdout);
+               return 0;
          default:
-               fprintf(stderr, "Usage: %s [-v] [-P | -D]\n", argv[0]);
+               fprintf(stderr, "Usage: %s [-v] [-P | -D] [-e] [-c] [-r sample_hz] [-b batch_points] [-f flush_seconds] [-S spool_file] [-M spool_mb] [-z gzip_level] [-R rollup_file] [-B bench_points]\n", argv[0]);
                return 1;
       }
    }
@@ -115,7 +492,11 @@ int main(int argc, char *argv[])
       exit(EXIT_FAILURE);
    }
 
-   if ((rc = MQTTClient_setCallbacks(client, NULL, connlost, msgarrvd, delivered)) != MQTTCLIENT_SUCCESS)
+   if (monitor_events_init() != 0) {
+      exit(EXIT_FAILURE);
+   }
+
+   if ((rc = MQTTClient_setCallbacks(client, NULL, connlost, log_msgarrvd, delivered)) != MQTTCLIENT_SUCCESS)
    {
       log_message("Log: Error == Failed to Set Callbacks. Return Code: %d\n", rc);
       printf("Failed to set callbacks, return code %d\n", rc);
@@ -139,7 +520,28 @@ int main(int argc, char *argv[])
    log_message("Log: Subscribing to topic: %s for client: %s\n", "mwp/data/monitor/#", LOG_CLIENTID);
    MQTTClient_subscribe(client, "mwp/data/monitor/#", QOS);
 
-   init_influxdb();
+   if (influx_writer_start(&writer_config) != 0) {
+      log_message("Log: Error == Failed to Start InfluxDB Writer\n");
+      printf("Failed to start InfluxDB writer\n");
+      exit(EXIT_FAILURE);
+   }
+   printf("InfluxDB writer: batch %d points / %d ms\n", writer_config.batch_max_points, writer_config.flush_interval_ms);
+   for (int slot = 0; slot < PUMP_SLOT_COUNT; slot++) {
+      sdt_init(&sdt_streams[slot], &sdt_configs[slot]);
+   }
+   if (rollup_open(rollup_path) != 0) {
+      fprintf(stderr, "Rollups disabled\n");
+   }
+
+   signal(SIGINT, handle_shutdown);
+   signal(SIGTERM, handle_shutdown);
+
+   if (!event_mode) {
+      if (tick_timer_start(sample_hz) != 0) {
+         exit(EXIT_FAILURE);
+      }
+      printf("Sampling at %d Hz\n", sample_hz);
+   }
 
    /*
     * Main Loop
@@ -147,75 +549,63 @@ int main(int argc, char *argv[])
 
    log_message("Log: Entering Main Loop\n");
 
-   while (1)
+   last_stats_ns = realtime_ns();
+   while (running)
    {
-      if (wellMon_.well.well_pump_1_on == 1 ) {
-         pump = 3;
-        param1 = 1;
-        param2 = 2;
-        intervalFlow = houseMon_.house.intervalFlow  ;
-        pressure = houseMon_.house.pressurePSI;
-        amperage = wellMon_.well.amp_pump_1;
-        temperature = houseMon_.house.temperatureF;
-        // Write data to InfluxDB
-        write_to_influxdb(pump, param1, param2, intervalFlow, pressure, amperage, temperature);
-      }
-      if (wellMon_.well.well_pump_3_on == 1 ) {
-        pump = 3;
-        param1 = 1;
-        param2 = 2;
-        intervalFlow = tankMon_.tank.intervalFlow;
-        pressure = tankMon_.tank.pressurePSI;
-        amperage = wellMon_.well.amp_pump_3;
-        temperature = tankMon_.tank.temperatureF;
-         //if (verbose) {
-         printf("pump: %d, param1: %d, param2: %d, intervalFlow: %f, pressure: %f, amperage: %f, temperature: %f ", pump, param1, param2, intervalFlow, pressure, amperage, temperature);
-         printf("%s", ctime(&t));
-        //}
-        // Write data to InfluxDB
-        write_to_influxdb(pump, param1, param2, intervalFlow, pressure, amperage, temperature);
-      }
-      if (wellMon_.well.irrigation_pump_on == 1 ) {
-        pump = 4;
-        if ( irrigationMon_.irrigation.controller == 1 ) {
-           param1 = 1;
-           param2 = irrigationMon_.irrigation.zone;
-        }
-        else if ( irrigationMon_.irrigation.controller == 2 ) {
-           param1 = 2;
-           param2 = irrigationMon_.irrigation.zone;
-        }
-        else {
-           param1 = 0;
-           param2 = 0;
-        }
-        intervalFlow = irrigationMon_.irrigation.intervalFlow;
-        pressure = irrigationMon_.irrigation.pressurePSI;
-        amperage = wellMon_.well.amp_pump_4;
-        temperature = irrigationMon_.irrigation.temperatureF;
-         //if (verbose) {
-         printf("pump: %d, param1: %d, param2: %d intervalFlow: %f, pressure: %f, amperage: %f, temperature: %f ", pump, param1, param2, intervalFlow, pressure, amperage, temperature);
-         printf("%s", ctime(&t));
-        //}
-        // Write data to InfluxDB
-      write_to_influxdb(pump, param1, param2, intervalFlow, pressure, amperage, temperature);
+      if (event_mode) {
+         // One sample per monitor message, stamped with its arrival time
+         monitor_ring_wait(1000);
+         while ((snap = monitor_ring_next()) != NULL) {
+            sample_pumps(MONITOR_BIT(snap->source), snap->arrival_ns[snap->source], snap);
+            monitor_ring_release();
+         }
+         now_ns = realtime_ns();
+      } else {
+         // Sample on the timer's grid; HTTP work happens on the writer thread
+         if ((now_ns = tick_timer_wait()) < 0) {
+            if (running) {
+               sleep(1);
+            }
+            continue;
+         }
+         // Newest consistent snapshot; older ones in the ring are skipped
+         if ((snap = monitor_ring_latest()) != NULL) {
+            sample_pumps(MONITOR_ALL, now_ns, snap);
+         }
       }
 
-      //MyMQTTPublish() ;
+      rollup_tick(now_ns);
 
-      /*
-       * Run at this interval
-       */
+      if (now_ns - last_stats_ns >= STATS_INTERVAL_SECONDS * 1000000000LL) {
+         influx_writer_print_stats(stdout);
+         print_sample_timing(stdout);
+         if (!event_mode) {
+            tick_timer_print_stats(stdout);
+         }
+         last_stats_ns = now_ns;
+      }
 
-      sleep(1);
+      //MyMQTTPublish() ;
    }
    log_message("Log: Exiting Main Loop\n");
    MQTTClient_unsubscribe(client, "mwp/data/monitor/#");
    MQTTClient_disconnect(client, 10000);
    MQTTClient_destroy(&client);
 
-   // Don't forget to free the InfluxDB client when you're done
-    influxdb_client_free(influxdb_client);
+   // Close compressed runs and flush anything still buffered before exiting
+   now_ns = realtime_ns();
+   for (int slot = 0; slot < PUMP_SLOT_COUNT; slot++) {
+      end_pump_run(slot, now_ns);
+   }
+   flush_tick_points();
+   rollup_close();
+   influx_writer_stop();
+   influx_writer_print_stats(stdout);
+   print_sample_timing(stdout);
+   if (!event_mode) {
+      tick_timer_print_stats(stdout);
+      tick_timer_stop();
+   }
 
    return rc;
 }
@@ -0,0 +1,124 @@
+#define _GNU_SOURCE // strcasestr
+#include "monitor_events.h"
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+
+#define CACHE_LINE 64
+
+// Topic fragments identifying each monitor under mwp/data/monitor/#
+static const char* monitor_topic_keys[MONITOR_COUNT] = {
+    "well",        // MONITOR_WELL
+    "house",       // MONITOR_HOUSE
+    "tank",        // MONITOR_TANK
+    "irrigation",  // MONITOR_IRRIGATION
+};
+
+// Single producer / single consumer ring. head is only written by the
+// callback thread and tail only by the logger, each on its own cache line.
+static MonitorSnapshot ring[MONITOR_RING_SIZE];
+static _Alignas(CACHE_LINE) atomic_uint_fast64_t ring_head = 0;
+static _Alignas(CACHE_LINE) atomic_uint_fast64_t ring_tail = 0;
+static _Alignas(CACHE_LINE) atomic_uint_fast64_t overflows = 0;
+
+// Consumer-private: slot held by monitor_ring_latest()
+static int holding_latest = 0;
+
+static int wake_fd = -1;
+
+int monitor_events_init(void) {
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd < 0) {
+        fprintf(stderr, "MonitorEvents: eventfd failed: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+MonitorSource monitor_source_from_topic(const char* topic) {
+    for (int i = 0; i < MONITOR_COUNT; i++) {
+        if (strcasestr(topic, monitor_topic_keys[i]) != NULL) {
+            return (MonitorSource)i;
+        }
+    }
+    return MONITOR_UNKNOWN;
+}
+
+MonitorSnapshot* monitor_ring_claim(void) {
+    uint_fast64_t head = atomic_load_explicit(&ring_head, memory_order_relaxed);
+    uint_fast64_t tail = atomic_load_explicit(&ring_tail, memory_order_acquire);
+
+    if (head - tail >= MONITOR_RING_SIZE) {
+        atomic_fetch_add_explicit(&overflows, 1, memory_order_relaxed);
+        return NULL;
+    }
+    return &ring[head & (MONITOR_RING_SIZE - 1)];
+}
+
+void monitor_ring_publish(void) {
+    uint64_t one = 1;
+    uint_fast64_t head = atomic_load_explicit(&ring_head, memory_order_relaxed);
+
+    atomic_store_explicit(&ring_head, head + 1, memory_order_release);
+    // eventfd write is a counter increment in the kernel, no user space lock
+    if (wake_fd >= 0 && write(wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        fprintf(stderr, "MonitorEvents: eventfd write failed: %s\n", strerror(errno));
+    }
+}
+
+const MonitorSnapshot* monitor_ring_next(void) {
+    uint_fast64_t tail = atomic_load_explicit(&ring_tail, memory_order_relaxed);
+    uint_fast64_t head = atomic_load_explicit(&ring_head, memory_order_acquire);
+
+    if (holding_latest) {
+        // Drop the slot kept by monitor_ring_latest() before moving on
+        holding_latest = 0;
+        atomic_store_explicit(&ring_tail, ++tail, memory_order_release);
+    }
+    if (tail == head) {
+        return NULL;
+    }
+    return &ring[tail & (MONITOR_RING_SIZE - 1)];
+}
+
+void monitor_ring_release(void) {
+    uint_fast64_t tail = atomic_load_explicit(&ring_tail, memory_order_relaxed);
+    atomic_store_explicit(&ring_tail, tail + 1, memory_order_release);
+}
+
+const MonitorSnapshot* monitor_ring_latest(void) {
+    uint_fast64_t tail = atomic_load_explicit(&ring_tail, memory_order_relaxed);
+    uint_fast64_t head = atomic_load_explicit(&ring_head, memory_order_acquire);
+
+    if (tail == head) {
+        return NULL;
+    }
+    holding_latest = 1;
+    if (head - tail > 1) {
+        atomic_store_explicit(&ring_tail, head - 1, memory_order_release);
+    }
+    return &ring[(head - 1) & (MONITOR_RING_SIZE - 1)];
+}
+
+int monitor_ring_wait(int timeout_ms) {
+    struct pollfd pfd = { .fd = wake_fd, .events = POLLIN };
+    uint64_t count;
+
+    if (poll(&pfd, 1, timeout_ms) <= 0) {
+        return 0;
+    }
+    // Reset the counter; the ring itself says how much work is pending
+    if (read(wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        fprintf(stderr, "MonitorEvents: eventfd read failed: %s\n", strerror(errno));
+    }
+    return 1;
+}
+
+uint64_t monitor_events_overflows(void) {
+    return atomic_load_explicit(&overflows, memory_order_relaxed);
+}
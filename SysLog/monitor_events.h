@@ -0,0 +1,77 @@
+#ifndef MONITOR_EVENTS_H
+#define MONITOR_EVENTS_H
+
+#include <stdint.h>
+
+// Monitor messages the logger samples from
+typedef enum {
+    MONITOR_WELL = 0,
+    MONITOR_HOUSE,
+    MONITOR_TANK,
+    MONITOR_IRRIGATION,
+    MONITOR_COUNT,
+    MONITOR_UNKNOWN = -1
+} MonitorSource;
+
+#define MONITOR_BIT(source) (1u << (source))
+#define MONITOR_ALL ((1u << MONITOR_COUNT) - 1)
+
+// Slots in the callback -> logger ring, must be a power of two
+#define MONITOR_RING_SIZE 256
+
+typedef struct {
+    float intervalFlow;
+    float pressurePSI;
+    float temperatureF;
+} MonitorReading;
+
+// Consistent copy of every monitor field the logger uses, taken by the MQTT
+// callback thread right after a message has been applied to the globals
+typedef struct {
+    MonitorSource source;              // Monitor whose message produced this snapshot
+    uint64_t seq[MONITOR_COUNT];       // Per-source arrival counters
+    int64_t arrival_ns[MONITOR_COUNT]; // CLOCK_REALTIME of each source's latest message
+    struct {
+        int pump_1_on;
+        int pump_3_on;
+        int irrigation_pump_on;
+        float amp_pump_1;
+        float amp_pump_3;
+        float amp_pump_4;
+    } well;
+    MonitorReading house;
+    MonitorReading tank;
+    MonitorReading irrigation;
+    int irrigation_controller;
+    int irrigation_zone;
+} MonitorSnapshot;
+
+// Creates the wakeup eventfd. Returns 0 on success.
+int monitor_events_init(void);
+
+// Maps a monitor topic to its source, MONITOR_UNKNOWN if it is not one we sample
+MonitorSource monitor_source_from_topic(const char* topic);
+
+// Producer (MQTT callback thread) side. claim returns the next free slot or
+// NULL when the logger has fallen behind; publish makes it visible and wakes
+// the logger. Neither call takes a lock.
+MonitorSnapshot* monitor_ring_claim(void);
+void monitor_ring_publish(void);
+
+// Consumer (logger thread) side. next returns the oldest unread snapshot in
+// place, or NULL; release hands its slot back to the producer.
+const MonitorSnapshot* monitor_ring_next(void);
+void monitor_ring_release(void);
+
+// Releases everything but the newest snapshot and returns it in place. The
+// slot stays owned by the logger until the next call, so it may be read
+// across a whole polling tick. NULL until the first message arrives.
+const MonitorSnapshot* monitor_ring_latest(void);
+
+// Blocks until the producer publishes or timeout_ms passes. Returns 1 if woken.
+int monitor_ring_wait(int timeout_ms);
+
+// Snapshots that could not be queued because the logger fell behind
+uint64_t monitor_events_overflows(void);
+
+#endif // MONITOR_EVENTS_H
@@ -0,0 +1,86 @@
+#include "pump_runs.h"
+#include "influx_writer.h"
+#include "lineproto.h"
+#include <string.h>
+
+static PumpRunStats run_stats;
+
+static const LineProtoKey run_keys[] = {
+    LINEPROTO_KEY("end"),
+    LINEPROTO_KEY("seconds"),
+    LINEPROTO_KEY("gallons"),
+    LINEPROTO_KEY("avgPSI"),
+    LINEPROTO_KEY("avgAmps"),
+    LINEPROTO_KEY("samples"),
+};
+
+void pump_run_sample(PumpRun* run, int pump, int controller, int zone, float intervalFlow,
+                     float pressure, float amperage, int64_t sample_ns, int new_message) {
+    // A zone change on the same pump is a new run, the old one lasting until now
+    if (run->active && (run->pump != pump || run->controller != controller || run->zone != zone)) {
+        pump_run_end(run, sample_ns);
+    }
+    if (!run->active) {
+        memset(run, 0, sizeof(PumpRun));
+        run->active = 1;
+        run->pump = pump;
+        run->controller = controller;
+        run->zone = zone;
+        run->start_ns = sample_ns;
+    }
+    run->end_ns = sample_ns;
+    if (new_message) {
+        run->gallons += intervalFlow;
+        run->psi_sum += pressure;
+        run->amps_sum += amperage;
+        run->samples++;
+    }
+}
+
+void pump_run_end(PumpRun* run, int64_t end_ns) {
+    char pump_tag[12], controller_tag[12], zone_tag[12];
+    const char* tags[] = { "pump", pump_tag, "controller", controller_tag, "zone", zone_tag };
+    LineProtoPrefix prefix;
+    LineProtoWriter w;
+    char line[256];
+    int len;
+
+    if (!run->active) {
+        return;
+    }
+    run->active = 0;
+    if (run->samples == 0) {
+        return;
+    }
+    // Never before the last sample, should the clock have stepped back
+    if (end_ns > run->end_ns) {
+        run->end_ns = end_ns;
+    }
+
+    snprintf(pump_tag, sizeof(pump_tag), "%d", run->pump);
+    snprintf(controller_tag, sizeof(controller_tag), "%d", run->controller);
+    snprintf(zone_tag, sizeof(zone_tag), "%d", run->zone);
+    lineproto_prefix_init(&prefix, "pump_runs", tags, 3);
+
+    lineproto_begin(&w, line, sizeof(line), &prefix);
+    // Always Unix seconds, whatever precision the point timestamps use
+    lineproto_field_int(&w, &run_keys[0], run->end_ns / 1000000000LL);
+    lineproto_field_float(&w, &run_keys[1], (float)((run->end_ns - run->start_ns) / 1e9));
+    lineproto_field_float(&w, &run_keys[2], (float)run->gallons);
+    lineproto_field_float(&w, &run_keys[3], (float)(run->psi_sum / run->samples));
+    lineproto_field_float(&w, &run_keys[4], (float)(run->amps_sum / run->samples));
+    lineproto_field_int(&w, &run_keys[5], run->samples);
+    len = lineproto_end(&w, influx_writer_timestamp(run->start_ns));
+    if (len < 0 || influx_writer_add_line(line, len) != 0) {
+        fprintf(stderr, "PumpRuns: failed to queue run record for pump %d\n", run->pump);
+        return;
+    }
+    run_stats.runs++;
+    run_stats.samples += run->samples;
+}
+
+void pump_run_print_stats(FILE* out) {
+    fprintf(out, "PumpRuns: runs=%llu samples=%llu (%.1f samples/run)\n",
+            (unsigned long long)run_stats.runs, (unsigned long long)run_stats.samples,
+            run_stats.runs ? (double)run_stats.samples / run_stats.runs : 0.0);
+}
@@ -0,0 +1,45 @@
+#ifndef PUMP_RUNS_H
+#define PUMP_RUNS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+// One pump run in progress. A run starts with the first sample of a running
+// pump and ends at the first sample that sees it off or on another
+// controller/zone, so its length covers the last sample's period too. It is
+// then written as a single pump_runs point:
+//
+//   pump_runs,pump=4,controller=1,zone=3 end=..,seconds=..,gallons=..,
+//             avgPSI=..,avgAmps=..,samples=.. <start>
+//
+// 'end' is in Unix seconds regardless of the writer's precision.
+typedef struct {
+    int active;
+    int pump;
+    int controller;        // param1 of the pump_data points
+    int zone;              // param2
+    int64_t start_ns;
+    int64_t end_ns;        // Latest sample of the run, then when it ended
+    double gallons;        // Sum of intervalFlow over distinct monitor messages
+    double psi_sum;
+    double amps_sum;
+    uint32_t samples;      // Distinct monitor messages averaged
+} PumpRun;
+
+typedef struct {
+    uint64_t runs;         // Run records queued
+    uint64_t samples;      // Samples folded into them
+} PumpRunStats;
+
+// Folds one sample of a running pump into its run. 'new_message' is 0 when the
+// sample reused a monitor message already counted, so flow is not summed twice.
+void pump_run_sample(PumpRun* run, int pump, int controller, int zone, float intervalFlow,
+                     float pressure, float amperage, int64_t sample_ns, int new_message);
+
+// Closes the run, if one is open, as of 'end_ns' (when the pump was first seen
+// off) and queues its record with the InfluxDB writer
+void pump_run_end(PumpRun* run, int64_t end_ns);
+
+void pump_run_print_stats(FILE* out);
+
+#endif // PUMP_RUNS_H
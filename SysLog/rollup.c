@@ -0,0 +1,318 @@
+#include "rollup.h"
+#include "influx_writer.h"
+#include "lineproto.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define ROLLUP_MAGIC   0x524C5550U  // "PULR"
+#define ROLLUP_VERSION 1
+#define ROLLUP_SYNC_SECONDS 60
+
+enum { FIELD_PSI = 0, FIELD_AMPS, FIELD_TEMP, FIELD_COUNT };
+
+typedef struct {
+    double sum;
+    float min;
+    float max;
+} RollupField;
+
+typedef struct {
+    int64_t start_s;            // 0 while unused
+    uint32_t count;
+    uint8_t dirty;              // Holds data InfluxDB has not seen
+    uint8_t written;            // Has been written at least once
+    double flow_sum;
+    RollupField fields[FIELD_COUNT];
+} RollupBucket;
+
+typedef struct {
+    int used;
+    int pump;
+    int controller;
+    int zone;
+    int64_t newest_s;           // Latest sample, bounds the retained window
+    RollupBucket minutes[ROLLUP_MINUTES];
+    RollupBucket hours[ROLLUP_HOURS];
+} RollupSeries;
+
+// Layout of the state file
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t max_series;
+    uint32_t minutes;
+    uint32_t hours;
+    RollupSeries series[ROLLUP_MAX_SERIES];
+} RollupState;
+
+typedef struct {
+    const char* measurement;
+    int width_s;
+    int buckets;
+} RollupLevel;
+
+static const RollupLevel levels[2] = {
+    { "pump_data_1m", 60, ROLLUP_MINUTES },
+    { "pump_data_1h", 3600, ROLLUP_HOURS },
+};
+
+static const LineProtoKey bucket_keys[] = {
+    LINEPROTO_KEY("count"),
+    LINEPROTO_KEY("flowSum"),
+    LINEPROTO_KEY("psiSum"), LINEPROTO_KEY("psiMin"), LINEPROTO_KEY("psiMax"),
+    LINEPROTO_KEY("ampsSum"), LINEPROTO_KEY("ampsMin"), LINEPROTO_KEY("ampsMax"),
+    LINEPROTO_KEY("tempSum"), LINEPROTO_KEY("tempMin"), LINEPROTO_KEY("tempMax"),
+};
+
+static RollupState* state = NULL;
+static int state_fd = -1;
+static int64_t last_sync_s = 0;
+static RollupStats rollup_stats;
+
+static RollupBucket* level_buckets(RollupSeries* series, int level) {
+    return level == 0 ? series->minutes : series->hours;
+}
+
+static void write_bucket(const RollupSeries* series, int level, RollupBucket* bucket) {
+    char pump_tag[12], controller_tag[12], zone_tag[12];
+    const char* tags[] = { "pump", pump_tag, "controller", controller_tag, "zone", zone_tag };
+    LineProtoPrefix prefix;
+    LineProtoWriter w;
+    char line[512];
+    int len;
+
+    snprintf(pump_tag, sizeof(pump_tag), "%d", series->pump);
+    snprintf(controller_tag, sizeof(controller_tag), "%d", series->controller);
+    snprintf(zone_tag, sizeof(zone_tag), "%d", series->zone);
+    lineproto_prefix_init(&prefix, levels[level].measurement, tags, 3);
+
+    lineproto_begin(&w, line, sizeof(line), &prefix);
+    lineproto_field_int(&w, &bucket_keys[0], bucket->count);
+    lineproto_field_float(&w, &bucket_keys[1], (float)bucket->flow_sum);
+    for (int f = 0; f < FIELD_COUNT; f++) {
+        lineproto_field_float(&w, &bucket_keys[2 + 3 * f], (float)bucket->fields[f].sum);
+        lineproto_field_float(&w, &bucket_keys[3 + 3 * f], bucket->fields[f].min);
+        lineproto_field_float(&w, &bucket_keys[4 + 3 * f], bucket->fields[f].max);
+    }
+    len = lineproto_end(&w, influx_writer_timestamp(bucket->start_s * 1000000000LL));
+    if (len < 0 || influx_writer_add_line(line, len) != 0) {
+        // Left dirty, the next tick tries again
+        return;
+    }
+    bucket->dirty = 0;
+    bucket->written = 1;
+    rollup_stats.buckets++;
+}
+
+static RollupSeries* find_series(int pump, int controller, int zone) {
+    RollupSeries* free_series = NULL;
+
+    for (int i = 0; i < ROLLUP_MAX_SERIES; i++) {
+        RollupSeries* series = &state->series[i];
+        if (!series->used) {
+            if (free_series == NULL) {
+                free_series = series;
+            }
+        } else if (series->pump == pump && series->controller == controller && series->zone == zone) {
+            return series;
+        }
+    }
+    if (free_series != NULL) {
+        memset(free_series, 0, sizeof(RollupSeries));
+        free_series->used = 1;
+        free_series->pump = pump;
+        free_series->controller = controller;
+        free_series->zone = zone;
+    }
+    return free_series;
+}
+
+static void fold(RollupBucket* bucket, float intervalFlow, const float* values) {
+    for (int f = 0; f < FIELD_COUNT; f++) {
+        RollupField* field = &bucket->fields[f];
+        if (bucket->count == 0 || values[f] < field->min) {
+            field->min = values[f];
+        }
+        if (bucket->count == 0 || values[f] > field->max) {
+            field->max = values[f];
+        }
+        field->sum += values[f];
+    }
+    bucket->flow_sum += intervalFlow;
+    bucket->count++;
+    bucket->dirty = 1;
+}
+
+static void state_init(void) {
+    memset(state, 0, sizeof(RollupState));
+    state->magic = ROLLUP_MAGIC;
+    state->version = ROLLUP_VERSION;
+    state->max_series = ROLLUP_MAX_SERIES;
+    state->minutes = ROLLUP_MINUTES;
+    state->hours = ROLLUP_HOURS;
+}
+
+int rollup_open(const char* path) {
+    struct stat st;
+
+    memset(&rollup_stats, 0, sizeof(rollup_stats));
+    if (path == NULL) {
+        state = calloc(1, sizeof(RollupState));
+        if (state == NULL) {
+            return -1;
+        }
+        state_init();
+        return 0;
+    }
+
+    state_fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (state_fd < 0) {
+        fprintf(stderr, "Rollup: failed to open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if (fstat(state_fd, &st) != 0 || (size_t)st.st_size != sizeof(RollupState)) {
+        if (ftruncate(state_fd, sizeof(RollupState)) != 0) {
+            fprintf(stderr, "Rollup: failed to size %s: %s\n", path, strerror(errno));
+            close(state_fd);
+            state_fd = -1;
+            return -1;
+        }
+    }
+    state = mmap(NULL, sizeof(RollupState), PROT_READ | PROT_WRITE, MAP_SHARED, state_fd, 0);
+    if (state == MAP_FAILED) {
+        fprintf(stderr, "Rollup: mmap of %s failed: %s\n", path, strerror(errno));
+        state = NULL;
+        close(state_fd);
+        state_fd = -1;
+        return -1;
+    }
+    if (state->magic != ROLLUP_MAGIC || state->version != ROLLUP_VERSION ||
+        state->max_series != ROLLUP_MAX_SERIES || state->minutes != ROLLUP_MINUTES ||
+        state->hours != ROLLUP_HOURS) {
+        if (state->magic == ROLLUP_MAGIC) {
+            fprintf(stderr, "Rollup: %s has a different layout, starting fresh\n", path);
+        }
+        state_init();
+    }
+    return 0;
+}
+
+void rollup_add(int pump, int controller, int zone, float intervalFlow,
+                float pressure, float amperage, float temperature, int64_t sample_ns) {
+    const float values[FIELD_COUNT] = { pressure, amperage, temperature };
+    int64_t sample_s = sample_ns / 1000000000LL;
+    RollupSeries* series;
+
+    if (state == NULL) {
+        return;
+    }
+    if ((series = find_series(pump, controller, zone)) == NULL) {
+        rollup_stats.no_series++;
+        return;
+    }
+    rollup_stats.samples++;
+    if (sample_s > series->newest_s) {
+        series->newest_s = sample_s;
+    }
+    for (int level = 0; level < 2; level++) {
+        int width = levels[level].width_s;
+        int64_t start_s = sample_s - sample_s % width;
+        RollupBucket* bucket = &level_buckets(series, level)[(start_s / width) % levels[level].buckets];
+
+        // Older than the buckets kept for this level, or the slot already moved on
+        if (start_s <= series->newest_s - (int64_t)width * levels[level].buckets || bucket->start_s > start_s) {
+            rollup_stats.too_late++;
+            continue;
+        }
+        if (bucket->start_s < start_s) {
+            if (bucket->dirty) {
+                write_bucket(series, level, bucket);
+            }
+            memset(bucket, 0, sizeof(RollupBucket));
+            bucket->start_s = start_s;
+        }
+        if (bucket->written && level == 0) {
+            rollup_stats.corrections++;
+        }
+        fold(bucket, intervalFlow, values);
+    }
+}
+
+void rollup_tick(int64_t now_ns) {
+    int64_t now_s = now_ns / 1000000000LL;
+
+    if (state == NULL) {
+        return;
+    }
+    for (int i = 0; i < ROLLUP_MAX_SERIES; i++) {
+        RollupSeries* series = &state->series[i];
+        int pending = 0;
+        if (!series->used) {
+            continue;
+        }
+        for (int level = 0; level < 2; level++) {
+            RollupBucket* buckets = level_buckets(series, level);
+            for (int b = 0; b < levels[level].buckets; b++) {
+                if (buckets[b].dirty &&
+                    now_s >= buckets[b].start_s + levels[level].width_s + ROLLUP_GRACE_SECONDS) {
+                    write_bucket(series, level, &buckets[b]);
+                }
+                pending |= buckets[b].dirty;
+            }
+        }
+        // Idle past its newest hour bucket with nothing left to write, so
+        // the slot can go to another zone
+        if (!pending && now_s >= series->newest_s - series->newest_s % levels[1].width_s + levels[1].width_s + ROLLUP_GRACE_SECONDS) {
+            series->used = 0;
+            rollup_stats.released++;
+        }
+    }
+    // Let the kernel write the state back without stalling the sampler
+    if (state_fd >= 0 && now_s - last_sync_s >= ROLLUP_SYNC_SECONDS) {
+        msync(state, sizeof(RollupState), MS_ASYNC);
+        last_sync_s = now_s;
+    }
+}
+
+void rollup_print_stats(FILE* out) {
+    int series = 0;
+
+    for (int i = 0; state != NULL && i < ROLLUP_MAX_SERIES; i++) {
+        series += state->series[i].used;
+    }
+    fprintf(out, "Rollup: series=%d samples=%llu buckets=%llu corrections=%llu too_late=%llu no_series=%llu released=%llu\n",
+            series, (unsigned long long)rollup_stats.samples, (unsigned long long)rollup_stats.buckets,
+            (unsigned long long)rollup_stats.corrections, (unsigned long long)rollup_stats.too_late,
+            (unsigned long long)rollup_stats.no_series, (unsigned long long)rollup_stats.released);
+}
+
+void rollup_close(void) {
+    if (state == NULL) {
+        return;
+    }
+    for (int i = 0; i < ROLLUP_MAX_SERIES; i++) {
+        RollupSeries* series = &state->series[i];
+        for (int level = 0; series->used && level < 2; level++) {
+            RollupBucket* buckets = level_buckets(series, level);
+            for (int b = 0; b < levels[level].buckets; b++) {
+                if (buckets[b].dirty) {
+                    write_bucket(series, level, &buckets[b]);
+                }
+            }
+        }
+    }
+    if (state_fd >= 0) {
+        msync(state, sizeof(RollupState), MS_SYNC);
+        munmap(state, sizeof(RollupState));
+        close(state_fd);
+        state_fd = -1;
+    } else {
+        free(state);
+    }
+    state = NULL;
+}
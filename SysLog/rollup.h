@@ -0,0 +1,62 @@
+#ifndef ROLLUP_H
+#define ROLLUP_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+// Running 1 minute and 1 hour rollups of the pump samples, kept per
+// pump/controller/zone and written as their own measurements:
+//
+//   pump_data_1m,pump=4,controller=1,zone=3 count=..,flowSum=..,
+//       psiSum=..,psiMin=..,psiMax=..,ampsSum=..,ampsMin=..,ampsMax=..,
+//       tempSum=..,tempMin=..,tempMax=.. <bucket start>
+//
+// and pump_data_1h with the same fields. Sums and counts rather than means
+// let a report merge any number of buckets exactly.
+//
+// A bucket is written once it has been closed for ROLLUP_GRACE_SECONDS. A
+// sample that arrives later still updates it while it is within the
+// retained window, and the bucket is written again; InfluxDB replaces the
+// point because the series and timestamp are unchanged.
+
+#define ROLLUP_DEFAULT_PATH  "log_rollup.dat"
+// Keys the logger's pumps produce: both wells report as pump 3, controller
+// 1, zone 2; the irrigation pump reports controller 0 (none) to 2 with
+// zones 0 to 16
+#define ROLLUP_WELL_SERIES            1
+#define ROLLUP_IRRIGATION_CONTROLLERS 3
+#define ROLLUP_IRRIGATION_ZONES       17
+#define ROLLUP_MAX_SERIES    (ROLLUP_WELL_SERIES + ROLLUP_IRRIGATION_CONTROLLERS * ROLLUP_IRRIGATION_ZONES)
+#define ROLLUP_MINUTES       120  // 1 minute buckets retained for late samples
+#define ROLLUP_HOURS         48   // 1 hour buckets retained
+#define ROLLUP_GRACE_SECONDS 5
+
+typedef struct {
+    uint64_t samples;      // Samples folded into buckets
+    uint64_t buckets;      // Bucket points queued, including rewrites
+    uint64_t corrections;  // Samples that landed in an already written bucket
+    uint64_t too_late;     // Samples older than the retained window
+    uint64_t no_series;    // Samples dropped because the series table was full
+    uint64_t released;     // Idle series whose slot was freed
+} RollupStats;
+
+// Maps the rollup state from 'path', keeping whatever a previous run left in
+// it, or holds it in memory only when path is NULL. Returns 0 on success.
+int rollup_open(const char* path);
+
+// Folds one sample of a running pump into its minute and hour buckets
+void rollup_add(int pump, int controller, int zone, float intervalFlow,
+                float pressure, float amperage, float temperature, int64_t sample_ns);
+
+// Writes buckets that have closed or been corrected, and frees the slot of a
+// series once its newest hour has closed and everything has been written.
+// Call about once a second.
+void rollup_tick(int64_t now_ns);
+
+void rollup_print_stats(FILE* out);
+
+// Writes every bucket with unsent data, open ones included, and unmaps the
+// state. A restarted logger carries on filling the open buckets.
+void rollup_close(void);
+
+#endif // ROLLUP_H
@@ -0,0 +1,151 @@
+#include "sdt.h"
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+static const char* sdt_field_names[SDT_FIELD_COUNT] = {
+    "pressure",
+    "amperage",
+    "temperature",
+};
+
+void sdt_init(SdtStream* stream, const SdtConfig* config) {
+    memset(stream, 0, sizeof(SdtStream));
+    stream->config = *config;
+    if (stream->config.max_gap_samples <= 0 || stream->config.max_gap_samples > SDT_MAX_HELD) {
+        stream->config.max_gap_samples = SDT_MAX_HELD;
+    }
+}
+
+static void open_door(SdtStream* stream) {
+    for (int f = 0; f < SDT_FIELD_COUNT; f++) {
+        stream->upper[f] = DBL_MAX;
+        stream->lower[f] = -DBL_MAX;
+    }
+}
+
+// Narrows the door with one sample. Returns 1 if it no longer fits any line
+// through the archive within every field's deviation.
+static int narrow_door(SdtStream* stream, const SdtSample* sample, const float* values) {
+    double dt = (double)(sample->timestamp_ns - stream->archive.timestamp_ns) / 1e9;
+    int closed = 0;
+
+    if (dt <= 0) {
+        return 0;
+    }
+    for (int f = 0; f < SDT_FIELD_COUNT; f++) {
+        double deviation = stream->config.fields[f].deviation;
+        double delta = (double)values[f] - stream->archive.values[f];
+        double upper = (delta + deviation) / dt;
+        double lower = (delta - deviation) / dt;
+        if (upper < stream->upper[f]) {
+            stream->upper[f] = upper;
+        }
+        if (lower > stream->lower[f]) {
+            stream->lower[f] = lower;
+        }
+        if (stream->lower[f] > stream->upper[f]) {
+            closed = 1;
+        }
+    }
+    return closed;
+}
+
+// Emits the newest held sample as the next vertex, scores the samples it
+// replaces against the line from the archive, and makes it the new pivot
+static void emit_held(SdtStream* stream, SdtSample* out) {
+    const SdtSample* a = &stream->archive;
+    const SdtSample* b = &stream->held[stream->held_count - 1];
+    double span = (double)(b->timestamp_ns - a->timestamp_ns);
+    float flow = 0;
+
+    for (int i = 0; i < stream->held_count; i++) {
+        const SdtSample* s = &stream->held[i];
+        flow += s->intervalFlow;
+        if (i == stream->held_count - 1 || span <= 0) {
+            continue;
+        }
+        double frac = (double)(s->timestamp_ns - a->timestamp_ns) / span;
+        for (int f = 0; f < SDT_FIELD_COUNT; f++) {
+            float error = fabsf(s->values[f] - (float)(a->values[f] + frac * (b->values[f] - a->values[f])));
+            if (error > stream->stats.max_error[f]) {
+                stream->stats.max_error[f] = error;
+            }
+        }
+    }
+    *out = *b;
+    out->intervalFlow = flow;
+    stream->archive = *b;
+    stream->held_count = 0;
+    stream->stats.points++;
+    open_door(stream);
+}
+
+static void start(SdtStream* stream, const SdtSample* sample, SdtSample* out) {
+    stream->active = 1;
+    stream->archive = *sample;
+    stream->held_count = 0;
+    memcpy(stream->accepted, sample->values, sizeof(stream->accepted));
+    stream->stats.points++;
+    open_door(stream);
+    *out = *sample;
+}
+
+int sdt_add(SdtStream* stream, const SdtSample* sample, SdtSample out[2]) {
+    float values[SDT_FIELD_COUNT];
+    int count = 0;
+
+    stream->stats.samples++;
+    if (!stream->active) {
+        start(stream, sample, &out[count++]);
+        return count;
+    }
+    // A new controller/zone starts a new line
+    if (sample->param1 != stream->archive.param1 || sample->param2 != stream->archive.param2) {
+        if (stream->held_count > 0) {
+            emit_held(stream, &out[count++]);
+        }
+        start(stream, sample, &out[count++]);
+        return count;
+    }
+
+    // Movement inside the deadband is noise, the door sees the accepted value
+    for (int f = 0; f < SDT_FIELD_COUNT; f++) {
+        if (fabsf(sample->values[f] - stream->accepted[f]) > stream->config.fields[f].deadband) {
+            stream->accepted[f] = sample->values[f];
+        }
+        values[f] = stream->accepted[f];
+    }
+
+    if (narrow_door(stream, sample, values) || stream->held_count >= stream->config.max_gap_samples) {
+        if (stream->held_count > 0) {
+            emit_held(stream, &out[count++]);
+            narrow_door(stream, sample, values);
+        }
+    }
+    stream->held[stream->held_count++] = *sample;
+    return count;
+}
+
+int sdt_stop(SdtStream* stream, SdtSample* out) {
+    int count = 0;
+
+    if (stream->active && stream->held_count > 0) {
+        emit_held(stream, out);
+        count = 1;
+    }
+    stream->active = 0;
+    return count;
+}
+
+void sdt_print_stats(const SdtStream* stream, const char* name, FILE* out) {
+    const SdtStats* s = &stream->stats;
+
+    fprintf(out, "%s: samples=%llu points=%llu ratio=%.1f:1 max_error(", name,
+            (unsigned long long)s->samples, (unsigned long long)s->points,
+            s->points ? (double)s->samples / s->points : 0.0);
+    for (int f = 0; f < SDT_FIELD_COUNT; f++) {
+        fprintf(out, "%s%s=%.3f", f ? " " : "", sdt_field_names[f], s->max_error[f]);
+    }
+    fprintf(out, ")\n");
+}
@@ -0,0 +1,73 @@
+#ifndef SDT_H
+#define SDT_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+// Swinging-door trending over one pump's samples. A point is only emitted when
+// dropping it would move the straight-line reconstruction between emitted
+// points by more than a field's deviation, on pump start/stop, when the
+// controller/zone changes, or as a heartbeat after max_gap_samples.
+
+// Fields run through the swinging door. intervalFlow is not interpolated:
+// an emitted point carries the flow summed since the previous one, so sum()
+// over any range of emitted points is unchanged.
+typedef enum {
+    SDT_PRESSURE = 0,
+    SDT_AMPERAGE,
+    SDT_TEMPERATURE,
+    SDT_FIELD_COUNT
+} SdtField;
+
+// Most samples held between emitted points, also bounds max_gap_samples
+#define SDT_MAX_HELD 1024
+
+typedef struct {
+    float deadband;   // Changes within this of the last accepted value are treated as noise
+    float deviation;  // Largest allowed distance from the reconstructed line
+} SdtFieldConfig;
+
+typedef struct {
+    SdtFieldConfig fields[SDT_FIELD_COUNT];
+    int max_gap_samples;  // Emit at least once every this many samples
+} SdtConfig;
+
+typedef struct {
+    int64_t timestamp_ns;
+    int param1;
+    int param2;
+    float intervalFlow;
+    float values[SDT_FIELD_COUNT];
+} SdtSample;
+
+typedef struct {
+    uint64_t samples;                     // Samples offered
+    uint64_t points;                      // Points emitted
+    float max_error[SDT_FIELD_COUNT];     // Worst |raw - reconstructed| seen
+} SdtStats;
+
+typedef struct {
+    SdtConfig config;
+    SdtStats stats;
+    int active;                           // Pump running, archive is valid
+    SdtSample archive;                    // Last emitted point, the door's pivot
+    float accepted[SDT_FIELD_COUNT];      // Deadband reference per field
+    double upper[SDT_FIELD_COUNT];        // Door slopes in units per second
+    double lower[SDT_FIELD_COUNT];
+    int held_count;
+    SdtSample held[SDT_MAX_HELD];         // Raw samples since the archive
+} SdtStream;
+
+void sdt_init(SdtStream* stream, const SdtConfig* config);
+
+// Offers one sample of a running pump. Points to send, oldest first, are
+// written to out; returns how many (0-2).
+int sdt_add(SdtStream* stream, const SdtSample* sample, SdtSample out[2]);
+
+// The pump stopped: emits the last held sample, if any, so the run ends on
+// its final reading. Returns 0 or 1.
+int sdt_stop(SdtStream* stream, SdtSample* out);
+
+void sdt_print_stats(const SdtStream* stream, const char* name, FILE* out);
+
+#endif // SDT_H
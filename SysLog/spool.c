@@ -0,0 +1,333 @@
+#include "spool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SPOOL_MAGIC      0x53504D4DU  // "MMPS"
+#define SPOOL_VERSION    2           // 2: precision recorded in the header
+#define SPOOL_WRAP       0xFFFFFFFFU  // Record length marking "continue at offset 0"
+#define SPOOL_ALIGN      8
+#define SPOOL_HEADER_SIZE 4096
+
+// File header, kept in its own page so it can be synced separately
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity;
+    uint64_t head;             // Next write offset in the record area
+    uint64_t tail;             // Oldest record offset
+    uint64_t used;             // Bytes between tail and head, including wrap padding
+    uint64_t records;
+    uint64_t dropped_records;
+    char precision[8];         // Write precision of the timestamps in the records
+} SpoolHeader;
+
+typedef struct {
+    uint32_t length;           // Payload length, or SPOOL_WRAP
+    uint32_t checksum;         // FNV-1a of the payload
+} RecordHeader;
+
+static int spool_fd = -1;
+static uint8_t* spool_map = NULL;
+static size_t spool_map_len = 0;
+static SpoolHeader* header = NULL;
+static uint8_t* area = NULL;
+static SpoolStats spool_stats;
+static pthread_mutex_t spool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t fnv1a(const void* data, size_t len) {
+    const uint8_t* p = data;
+    uint32_t hash = 2166136261U;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+static size_t record_size(size_t len) {
+    return (sizeof(RecordHeader) + len + SPOOL_ALIGN - 1) & ~(size_t)(SPOOL_ALIGN - 1);
+}
+
+// Syncs the page-aligned range covering [offset, offset + len) of the mapping
+static void sync_range(size_t offset, size_t len) {
+    long page = sysconf(_SC_PAGESIZE);
+    size_t start = offset & ~(size_t)(page - 1);
+    msync(spool_map + start, offset + len - start, MS_SYNC);
+}
+
+static void sync_header(void) {
+    sync_range(0, sizeof(SpoolHeader));
+}
+
+static void reset_header(uint64_t capacity, const char* precision) {
+    memset(header, 0, sizeof(SpoolHeader));
+    header->magic = SPOOL_MAGIC;
+    header->version = SPOOL_VERSION;
+    header->capacity = capacity;
+    snprintf(header->precision, sizeof(header->precision), "%s", precision);
+    sync_header();
+}
+
+// Drops the record at the tail. Caller holds the mutex.
+static void drop_oldest(void) {
+    RecordHeader* rec = (RecordHeader*)(area + header->tail);
+    if (header->capacity - header->tail < sizeof(RecordHeader) || rec->length == SPOOL_WRAP) {
+        header->used -= header->capacity - header->tail;
+        header->tail = 0;
+        rec = (RecordHeader*)area;
+    }
+    size_t size = record_size(rec->length);
+    header->tail += size;
+    header->used -= size;
+    header->records--;
+    if (header->records == 0) {
+        header->head = header->tail = header->used = 0;
+    }
+}
+
+// Walks the ring once after a restart; truncates at the first damaged record
+static void recover(void) {
+    uint64_t offset = header->tail;
+    uint64_t used = 0;
+    uint64_t records = 0;
+
+    while (records < header->records) {
+        if (header->capacity - offset < sizeof(RecordHeader) ||
+            ((RecordHeader*)(area + offset))->length == SPOOL_WRAP) {
+            used += header->capacity - offset;
+            offset = 0;
+            continue;
+        }
+        RecordHeader* rec = (RecordHeader*)(area + offset);
+        if (rec->length > header->capacity - offset - sizeof(RecordHeader) ||
+            fnv1a(area + offset + sizeof(RecordHeader), rec->length) != rec->checksum) {
+            fprintf(stderr, "Spool: damaged record at offset %llu, keeping %llu of %llu records\n",
+                    (unsigned long long)offset, (unsigned long long)records, (unsigned long long)header->records);
+            break;
+        }
+        offset += record_size(rec->length);
+        used += record_size(rec->length);
+        records++;
+    }
+
+    header->head = offset;
+    header->used = used;
+    header->records = records;
+    if (records == 0) {
+        header->head = header->tail = header->used = 0;
+    }
+    sync_header();
+}
+
+int spool_open(const char* path, size_t capacity_bytes, const char* precision) {
+    struct stat st;
+
+    capacity_bytes &= ~(size_t)(SPOOL_ALIGN - 1);
+    spool_map_len = SPOOL_HEADER_SIZE + capacity_bytes;
+
+    spool_fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (spool_fd < 0) {
+        fprintf(stderr, "Spool: failed to open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if (fstat(spool_fd, &st) != 0 || (size_t)st.st_size != spool_map_len) {
+        if (ftruncate(spool_fd, spool_map_len) != 0) {
+            fprintf(stderr, "Spool: failed to size %s: %s\n", path, strerror(errno));
+            close(spool_fd);
+            spool_fd = -1;
+            return -1;
+        }
+    }
+
+    spool_map = mmap(NULL, spool_map_len, PROT_READ | PROT_WRITE, MAP_SHARED, spool_fd, 0);
+    if (spool_map == MAP_FAILED) {
+        fprintf(stderr, "Spool: mmap of %s failed: %s\n", path, strerror(errno));
+        spool_map = NULL;
+        close(spool_fd);
+        spool_fd = -1;
+        return -1;
+    }
+    header = (SpoolHeader*)spool_map;
+    area = spool_map + SPOOL_HEADER_SIZE;
+
+    if (header->magic != SPOOL_MAGIC || header->version != SPOOL_VERSION || header->capacity != capacity_bytes ||
+        strncmp(header->precision, precision, sizeof(header->precision)) != 0) {
+        if (header->magic == SPOOL_MAGIC) {
+            fprintf(stderr, "Spool: %s has a different layout or precision, discarding its contents\n", path);
+        }
+        reset_header(capacity_bytes, precision);
+    } else {
+        recover();
+    }
+
+    memset(&spool_stats, 0, sizeof(spool_stats));
+    spool_stats.dropped_records = header->dropped_records;
+    printf("Spool: %s holds %llu records (%llu of %llu bytes)\n", path,
+           (unsigned long long)header->records, (unsigned long long)header->used,
+           (unsigned long long)header->capacity);
+    return 0;
+}
+
+int spool_append(const char* data, size_t len) {
+    size_t size = record_size(len);
+
+    if (header == NULL) {
+        return -1;
+    }
+    if (size > header->capacity / 2) {
+        fprintf(stderr, "Spool: %zu byte record is too large for the spool\n", len);
+        return -1;
+    }
+
+    pthread_mutex_lock(&spool_mutex);
+
+    // Make room for the record plus a possible wrap gap at the end of the area
+    uint64_t dropped_before = header->dropped_records;
+    while (header->records > 0) {
+        uint64_t free_bytes = header->capacity - header->used;
+        uint64_t tail_room = header->capacity - header->head;
+        uint64_t needed = (tail_room >= size) ? size : tail_room + size;
+        if (header->head < header->tail) {
+            // Writing between head and tail, no wrap possible
+            needed = size;
+            free_bytes = header->tail - header->head;
+        }
+        if (free_bytes >= needed) {
+            break;
+        }
+        drop_oldest();
+        header->dropped_records++;
+        spool_stats.dropped_records++;
+    }
+    if (header->dropped_records != dropped_before) {
+        // Move the tail on disk before the dropped bytes are overwritten
+        sync_header();
+    }
+
+    if (header->capacity - header->head < size) {
+        if (header->capacity - header->head >= sizeof(RecordHeader)) {
+            ((RecordHeader*)(area + header->head))->length = SPOOL_WRAP;
+        }
+        header->used += header->capacity - header->head;
+        header->head = 0;
+    }
+
+    RecordHeader* rec = (RecordHeader*)(area + header->head);
+    rec->length = (uint32_t)len;
+    rec->checksum = fnv1a(data, len);
+    memcpy(area + header->head + sizeof(RecordHeader), data, len);
+    sync_range(SPOOL_HEADER_SIZE + header->head, size);
+
+    // Publish the record only after its bytes are on disk
+    header->head += size;
+    header->used += size;
+    header->records++;
+    sync_header();
+
+    spool_stats.appended_records++;
+    pthread_mutex_unlock(&spool_mutex);
+    return 0;
+}
+
+size_t spool_peek(char* out, size_t max_bytes, uint32_t* records) {
+    size_t copied = 0;
+    uint32_t count = 0;
+
+    *records = 0;
+    if (header == NULL) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&spool_mutex);
+    uint64_t offset = header->tail;
+    while (count < header->records) {
+        if (header->capacity - offset < sizeof(RecordHeader) ||
+            ((RecordHeader*)(area + offset))->length == SPOOL_WRAP) {
+            offset = 0;
+            continue;
+        }
+        RecordHeader* rec = (RecordHeader*)(area + offset);
+        if (copied + rec->length > max_bytes) {
+            break;
+        }
+        memcpy(out + copied, area + offset + sizeof(RecordHeader), rec->length);
+        copied += rec->length;
+        offset += record_size(rec->length);
+        count++;
+    }
+    pthread_mutex_unlock(&spool_mutex);
+
+    *records = count;
+    return copied;
+}
+
+void spool_consume(uint32_t records, size_t bytes, double elapsed_ms) {
+    if (header == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&spool_mutex);
+    for (uint32_t i = 0; i < records && header->records > 0; i++) {
+        drop_oldest();
+    }
+    sync_header();
+    spool_stats.replayed_records += records;
+    spool_stats.replayed_bytes += bytes;
+    spool_stats.replay_ms += elapsed_ms;
+    pthread_mutex_unlock(&spool_mutex);
+}
+
+int spool_is_empty(void) {
+    int empty;
+    if (header == NULL) {
+        return 1;
+    }
+    pthread_mutex_lock(&spool_mutex);
+    empty = (header->records == 0);
+    pthread_mutex_unlock(&spool_mutex);
+    return empty;
+}
+
+void spool_get_stats(SpoolStats* stats) {
+    pthread_mutex_lock(&spool_mutex);
+    *stats = spool_stats;
+    if (header != NULL) {
+        stats->capacity_bytes = header->capacity;
+        stats->used_bytes = header->used;
+        stats->records = header->records;
+    }
+    pthread_mutex_unlock(&spool_mutex);
+}
+
+void spool_print_stats(FILE* out) {
+    SpoolStats s;
+    spool_get_stats(&s);
+    fprintf(out, "Spool: depth=%llu records / %llu of %llu bytes (%.1f%%) appended=%llu dropped=%llu "
+                 "replayed=%llu records / %llu bytes replay_rate=%.1f KB/s\n",
+            (unsigned long long)s.records, (unsigned long long)s.used_bytes,
+            (unsigned long long)s.capacity_bytes,
+            s.capacity_bytes ? 100.0 * s.used_bytes / s.capacity_bytes : 0.0,
+            (unsigned long long)s.appended_records, (unsigned long long)s.dropped_records,
+            (unsigned long long)s.replayed_records, (unsigned long long)s.replayed_bytes,
+            s.replay_ms > 0 ? (s.replayed_bytes / 1024.0) / (s.replay_ms / 1000.0) : 0.0);
+}
+
+void spool_close(void) {
+    if (spool_map != NULL) {
+        msync(spool_map, spool_map_len, MS_SYNC);
+        munmap(spool_map, spool_map_len);
+        spool_map = NULL;
+        header = NULL;
+        area = NULL;
+    }
+    if (spool_fd >= 0) {
+        close(spool_fd);
+        spool_fd = -1;
+    }
+}
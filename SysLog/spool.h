@@ -0,0 +1,45 @@
+#ifndef SPOOL_H
+#define SPOOL_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// On-disk ring of line-protocol batches that could not be delivered.
+// The file is memory mapped; each record is one batch body.
+
+#define SPOOL_DEFAULT_PATH  "log_spool.dat"
+#define SPOOL_DEFAULT_BYTES (64UL * 1024 * 1024)
+
+typedef struct {
+    uint64_t capacity_bytes;   // Size of the record area
+    uint64_t used_bytes;       // Bytes currently held (spool depth)
+    uint64_t records;          // Records currently held
+    uint64_t appended_records;
+    uint64_t dropped_records;  // Oldest records overwritten because the ring was full
+    uint64_t replayed_records;
+    uint64_t replayed_bytes;
+    double   replay_ms;        // Time spent in successful replay posts
+} SpoolStats;
+
+// Maps (creating or recovering) the spool file. Records hold finished line
+// protocol, so a spool written with another timestamp 'precision' ("s",
+// "ms", ...) is discarded rather than replayed. Returns 0 on success.
+int spool_open(const char* path, size_t capacity_bytes, const char* precision);
+
+// Appends one record and syncs it to disk. Drops the oldest records if needed.
+int spool_append(const char* data, size_t len);
+
+// Copies as many whole records as fit into 'out', oldest first.
+// Returns the number of bytes copied and sets *records.
+size_t spool_peek(char* out, size_t max_bytes, uint32_t* records);
+
+// Releases the first 'records' records after a successful replay
+void spool_consume(uint32_t records, size_t bytes, double elapsed_ms);
+
+int spool_is_empty(void);
+void spool_get_stats(SpoolStats* stats);
+void spool_print_stats(FILE* out);
+void spool_close(void);
+
+#endif // SPOOL_H
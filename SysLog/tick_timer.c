@@ -0,0 +1,107 @@
+#include "tick_timer.h"
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#define NS_PER_SEC 1000000000LL
+
+static int timer_fd = -1;
+static int64_t period_ns;
+static int64_t next_deadline_ns;
+static TickTimerStats tick_stats;
+
+static int64_t realtime_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+// Arms the timer for the next period boundary after now. CLOCK_REALTIME keeps
+// the grid on wall clock multiples; TFD_TIMER_CANCEL_ON_SET reports a clock
+// step so the grid can be rebuilt instead of firing a burst of expirations.
+static int arm(void) {
+    struct itimerspec spec;
+    int64_t now_ns = realtime_ns();
+
+    next_deadline_ns = (now_ns / period_ns + 1) * period_ns;
+    spec.it_value.tv_sec = next_deadline_ns / NS_PER_SEC;
+    spec.it_value.tv_nsec = next_deadline_ns % NS_PER_SEC;
+    spec.it_interval.tv_sec = period_ns / NS_PER_SEC;
+    spec.it_interval.tv_nsec = period_ns % NS_PER_SEC;
+    if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &spec, NULL) != 0) {
+        fprintf(stderr, "TickTimer: timerfd_settime failed: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+int tick_timer_start(int hz) {
+    if (hz < 1) {
+        hz = 1;
+    } else if (hz > TICK_TIMER_MAX_HZ) {
+        hz = TICK_TIMER_MAX_HZ;
+    }
+    memset(&tick_stats, 0, sizeof(tick_stats));
+    tick_stats.hz = hz;
+    period_ns = NS_PER_SEC / hz;
+
+    timer_fd = timerfd_create(CLOCK_REALTIME, TFD_CLOEXEC);
+    if (timer_fd < 0) {
+        fprintf(stderr, "TickTimer: timerfd_create failed: %s\n", strerror(errno));
+        return -1;
+    }
+    return arm();
+}
+
+int64_t tick_timer_wait(void) {
+    uint64_t expirations;
+    int64_t deadline_ns;
+
+    for (;;) {
+        ssize_t n = read(timer_fd, &expirations, sizeof(expirations));
+        if (n == sizeof(expirations)) {
+            break;
+        }
+        if (n < 0 && errno == ECANCELED) {
+            // Wall clock was stepped: realign to the new time
+            tick_stats.resyncs++;
+            if (arm() != 0) {
+                return -1;
+            }
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            return -1;
+        }
+        fprintf(stderr, "TickTimer: read failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    // Deadlines that expired while the loop was busy are skipped, not replayed
+    deadline_ns = next_deadline_ns + (int64_t)(expirations - 1) * period_ns;
+    next_deadline_ns = deadline_ns + period_ns;
+    tick_stats.ticks++;
+    tick_stats.overruns += expirations - 1;
+    latency_hist_record(&tick_stats.lateness, (realtime_ns() - deadline_ns) / 1000);
+    return deadline_ns;
+}
+
+void tick_timer_get_stats(TickTimerStats* stats) {
+    *stats = tick_stats;
+}
+
+void tick_timer_print_stats(FILE* out) {
+    fprintf(out, "TickTimer: %d Hz ticks=%llu overruns=%llu resyncs=%llu\n", tick_stats.hz,
+            (unsigned long long)tick_stats.ticks, (unsigned long long)tick_stats.overruns,
+            (unsigned long long)tick_stats.resyncs);
+    latency_hist_print(&tick_stats.lateness, "  tick lateness", out);
+}
+
+void tick_timer_stop(void) {
+    if (timer_fd >= 0) {
+        close(timer_fd);
+        timer_fd = -1;
+    }
+}
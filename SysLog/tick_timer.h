@@ -0,0 +1,33 @@
+#ifndef TICK_TIMER_H
+#define TICK_TIMER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "latency_hist.h"
+
+#define TICK_TIMER_MAX_HZ 10
+
+// Counters for the sampling schedule
+typedef struct {
+    int hz;
+    uint64_t ticks;            // Deadlines serviced
+    uint64_t overruns;         // Deadlines missed because the loop was still busy
+    uint64_t resyncs;          // Re-alignments after the wall clock was stepped
+    LatencyHistogram lateness; // Wake-up time minus deadline
+} TickTimerStats;
+
+// Starts a periodic timer at 'hz' (1-TICK_TIMER_MAX_HZ) whose deadlines sit on
+// whole multiples of the period in wall clock time, e.g. .0/.1/.2 s at 10 Hz.
+// Deadlines are absolute, so time spent between waits does not shift the grid.
+int tick_timer_start(int hz);
+
+// Blocks until the next deadline and returns it in CLOCK_REALTIME nanoseconds.
+// Deadlines that passed while the caller was busy are counted as overruns and
+// skipped, so the caller always gets the latest one. Returns -1 on error.
+int64_t tick_timer_wait(void);
+
+void tick_timer_get_stats(TickTimerStats* stats);
+void tick_timer_print_stats(FILE* out);
+void tick_timer_stop(void);
+
+#endif // TICK_TIMER_H
@@ -32,14 +32,9 @@ log_message "Starting MWP Data Service"
 nohup ${BIN_DIR}/mwp_data_service -P -c mwp_data_service/config/config.yaml >> "${LOG_DIR}/mwp_data_service.log" 2>&1 &
 sleep 5
 
-# Start blynkLog Controller 1
-log_message "Starting Blynk Log Controller 1 Interface"
-nohup ${BIN_DIR}/blynkLog -P -v -c "${CONFIG_DIR}/logC1_config.json" >> "${LOG_DIR}/blynkLog_C1.log" 2>&1 &
-sleep 5
-
-# Start blynkLog Controller 2
-log_message "Starting Blynk Log Controller 2 Interface"
-nohup ${BIN_DIR}/blynkLog -P -v -c "${CONFIG_DIR}/logC2_config.json" >> "${LOG_DIR}/blynkLog_C2.log" 2>&1 &
+# Start blynkLog, one process serving the Controller 1 and Controller 2 devices
+log_message "Starting Blynk Log Controller 1 and 2 Interfaces"
+nohup ${BIN_DIR}/blynkLog -P -v -c "${CONFIG_DIR}/logC1_config.json" -c "${CONFIG_DIR}/logC2_config.json" >> "${LOG_DIR}/blynkLog.log" 2>&1 &
 sleep 5
 
 log_message "### Logging Startup Complete ###" 
\ No newline at end of file
@@ -19,6 +19,7 @@ import (
 	"mwp_data_service/internal/aggregation" // Import the aggregation package
 	"mwp_data_service/internal/config"      // Import the config package
 	"mwp_data_service/internal/datastore"   // Import the datastore package
+	"mwp_data_service/internal/metrics"     // Import the metrics package
 	"mwp_data_service/internal/service"     // Import the service package
 )
 
@@ -29,6 +30,12 @@ const (
 	DefaultRangeAfterNow  = "1h" // Default query range after "now" mode times out
 	NowModeDuration       = 60 * time.Second
 	NowModeUpdateInterval = 1 * time.Second
+
+	// Result encodings a query request can ask for
+	EncodingJSON   = "json"
+	EncodingBinary = "binary"
+	// Binary results go to the response topic with this suffix
+	BinaryTopicSuffix = "/bin"
 )
 
 // Global variables (consider encapsulating in a struct for better organization later)
@@ -47,29 +54,54 @@ var (
 	isInNowMode         bool
 	nowModeTicker       *time.Ticker
 	nowModeTimeoutTimer *time.Timer
-	lastNonNowRange     string        = DefaultRangeAfterNow // Store the last explicitly requested range or default
-	nowModeControlChan  chan string                          // Used to signal changes to "now" mode (e.g., stop, new_range)
-	shutdownChan        chan struct{}                        // Used to signal goroutines to terminate
+	lastNonNowRange     string            = DefaultRangeAfterNow // Store the last explicitly requested range or default
+	nowModeControlChan  chan RangeRequest                        // Used to signal changes to "now" mode (e.g., stop, new_range)
+	shutdownChan        chan struct{}                            // Used to signal goroutines to terminate
+
+	// Encoding of published results, as asked for by the latest query request.
+	// Protected by dataMutex.
+	resultEncoding = EncodingJSON
+
+	// Per-stage latency of query requests that carried a requestId
+	requestStages = metrics.NewStages("queue", "query", "build", "encode", "publish", "total")
 )
 
 // Define a struct for MQTT request payload
 type RangeRequestPayload struct {
-	Range string `json:"range"`
+	Range     string `json:"range"`
+	RequestID uint32 `json:"requestId,omitempty"` // Echoed in the result so the requester can match and trace it
+	Encoding  string `json:"encoding,omitempty"`  // "json" (default) or "binary", for this and later results
+}
+
+// RangeRequest is a range to query, with the MQTT request that asked for it
+type RangeRequest struct {
+	Range     string
+	RequestID uint32    // 0 when the request did not carry one
+	Encoding  string    // EncodingJSON or EncodingBinary
+	Received  time.Time // When the MQTT message arrived
 }
 
 // processAndPublishData encapsulates the logic to query data, update table, and publish.
-// It's called initially and then by the MQTT message handler.
-func processAndPublishData(timeRange string) {
+// It's called initially and then by the MQTT message handler. 'request' is the
+// query request being answered, or nil for updates nobody asked for.
+func processAndPublishData(timeRange string, request *RangeRequest) {
 	dataMutex.Lock()
 	defer dataMutex.Unlock()
 
+	// Unrequested updates, like "now" mode ticks, follow the latest requester
+	if request != nil {
+		resultEncoding = request.Encoding
+	}
+
 	if influxClient == nil {
 		fmt.Println("InfluxDB client is not initialized. Skipping data processing.")
 		return
 	}
 
 	fmt.Printf("Attempting to query aggregated data for range: %s\n", timeRange)
+	queryStart := time.Now()
 	aggregatedRecords, err := aggregation.QueryAggregatedData(influxClient, timeRange, appConfig.InfluxDB)
+	queryEnd := time.Now()
 	if err != nil {
 		fmt.Fprintf(os.Stderr, "Error querying aggregated data for range '%s': %v\n", timeRange, err)
 		return // Or publish an error state via MQTT?
@@ -136,35 +168,69 @@ func processAndPublishData(timeRange string) {
 	}
 
 	// Publish to MQTT
+	encodeStart := time.Now()
 	reportData := service.ReportData{
 		TotalIrrigationGallons: totalIrrigationGallons,
 		TotalWell3Gallons:      totalWell3Gallons,
 		Details:                waterDataTable,
 	}
-	jsonData, err := json.Marshal(reportData) // Using standard Marshal, Indent is for file_writer's own use
-	if err != nil {
-		fmt.Fprintf(os.Stderr, "Error marshalling report data to JSON: %v\n", err)
-		return
+	if request != nil && request.RequestID != 0 {
+		reportData.RequestID = request.RequestID
+		reportData.Trace = &service.StageTrace{
+			ReceivedUs:    request.Received.UnixMicro(),
+			QueryStartUs:  queryStart.UnixMicro(),
+			QueryEndUs:    queryEnd.UnixMicro(),
+			EncodeStartUs: encodeStart.UnixMicro(),
+		}
 	}
+	responseTopic := mqttConfig.ResponseTopic
+	var resultData []byte
+	if resultEncoding == EncodingBinary {
+		resultData, err = service.EncodeBinary(reportData)
+		if err != nil {
+			fmt.Fprintf(os.Stderr, "Error encoding binary report data, sending JSON instead: %v\n", err)
+		} else {
+			responseTopic += BinaryTopicSuffix
+		}
+	}
+	if resultData == nil {
+		resultData, err = json.Marshal(reportData) // Using standard Marshal, Indent is for file_writer's own use
+		if err != nil {
+			fmt.Fprintf(os.Stderr, "Error marshalling report data to JSON: %v\n", err)
+			return
+		}
+	}
+	publishStart := time.Now()
 
 	if mqttClient != nil && mqttClient.IsConnected() {
-		token := mqttClient.Publish(mqttConfig.ResponseTopic, 1, false, jsonData) // QoS 1
+		token := mqttClient.Publish(responseTopic, 1, false, resultData) // QoS 1
 		// Wait for a small amount of time for the publish to complete, but don't block indefinitely.
 		if token.WaitTimeout(2*time.Second) && token.Error() != nil {
-			fmt.Fprintf(os.Stderr, "Error publishing data to MQTT topic %s: %v\n", mqttConfig.ResponseTopic, token.Error())
+			fmt.Fprintf(os.Stderr, "Error publishing data to MQTT topic %s: %v\n", responseTopic, token.Error())
 		} else if verboseMode {
 			if token.Error() == nil { // Check error again after WaitTimeout
-				fmt.Printf("Published data to MQTT topic: %s\n", mqttConfig.ResponseTopic)
+				fmt.Printf("Published %d bytes of %s data to MQTT topic: %s\n", len(resultData), resultEncoding, responseTopic)
 			} else {
 				// This case might occur if WaitTimeout returns false but token.Error() was already set.
 				// Or if an error occurred but WaitTimeout also timed out.
-				fmt.Fprintf(os.Stderr, "Failed to confirm MQTT publish to %s (timeout or error): %v\n", mqttConfig.ResponseTopic, token.Error())
+				fmt.Fprintf(os.Stderr, "Failed to confirm MQTT publish to %s (timeout or error): %v\n", responseTopic, token.Error())
 			}
 		}
 	} else {
 		fmt.Println("MQTT client not connected. Cannot publish data.")
 	}
 
+	if request != nil && request.RequestID != 0 {
+		published := time.Now()
+		requestStages.Record("queue", queryStart.Sub(request.Received))
+		requestStages.Record("query", queryEnd.Sub(queryStart))
+		requestStages.Record("build", encodeStart.Sub(queryEnd))
+		requestStages.Record("encode", publishStart.Sub(encodeStart))
+		requestStages.Record("publish", published.Sub(publishStart))
+		requestStages.Record("total", published.Sub(request.Received))
+		publishMetrics()
+	}
+
 	// Optionally, still write to local files for debugging/backup
 	if err := service.WriteDataTableToJSON(waterDataTable, totalIrrigationGallons, totalWell3Gallons, "output/watertable_latest.json"); err != nil {
 		fmt.Fprintf(os.Stderr, "Error writing latest data table to JSON: %v\n", err)
@@ -174,6 +240,19 @@ func processAndPublishData(timeRange string) {
 	}
 }
 
+// publishMetrics sends the request stage histograms to the metrics topic, if one is configured.
+func publishMetrics() {
+	if mqttConfig.MetricsTopic == "" || mqttClient == nil || !mqttClient.IsConnected() {
+		return
+	}
+	metricsData, err := json.Marshal(requestStages)
+	if err != nil {
+		fmt.Fprintf(os.Stderr, "Error marshalling latency metrics: %v\n", err)
+		return
+	}
+	mqttClient.Publish(mqttConfig.MetricsTopic, 0, false, metricsData) // Best effort, not waited for
+}
+
 // onMQTTConnect is called when the MQTT client successfully connects.
 var onMQTTConnect mqtt.OnConnectHandler = func(client mqtt.Client) {
 	fmt.Println("MQTT Connected.")
@@ -194,6 +273,7 @@ var onMQTTConnectionLost mqtt.ConnectionLostHandler = func(client mqtt.Client, e
 
 // mqttMessageHandler is called when a message arrives on a subscribed topic.
 var mqttMessageHandler mqtt.MessageHandler = func(client mqtt.Client, msg mqtt.Message) {
+	received := time.Now()
 	if verboseMode {
 		fmt.Printf("Received MQTT message on topic: %s\n", msg.Topic())
 		fmt.Printf("Payload: %s\n", string(msg.Payload()))
@@ -211,9 +291,16 @@ var mqttMessageHandler mqtt.MessageHandler = func(client mqtt.Client, msg mqtt.M
 		return
 	}
 
+	encoding := EncodingJSON
+	if payload.Encoding == EncodingBinary {
+		encoding = EncodingBinary
+	} else if payload.Encoding != "" && payload.Encoding != EncodingJSON {
+		fmt.Fprintf(os.Stderr, "Unknown result encoding %q requested, using JSON.\n", payload.Encoding)
+	}
+
 	// Signal the nowModeManager goroutine about the new request.
 	// This centralizes control over nowMode state transitions.
-	nowModeControlChan <- payload.Range
+	nowModeControlChan <- RangeRequest{Range: payload.Range, RequestID: payload.RequestID, Encoding: encoding, Received: received}
 }
 
 // stopNowMode stops the ticker and timer associated with "now" mode.
@@ -254,7 +341,8 @@ func nowModeManager() {
 loop:
 	for {
 		select {
-		case newRangeRequest := <-nowModeControlChan:
+		case request := <-nowModeControlChan:
+			newRangeRequest := request.Range
 			dataMutex.Lock() // Lock for modifying nowMode state variables
 			if verboseMode {
 				fmt.Printf("nowModeManager: Received control signal for range: %s\n", newRangeRequest)
@@ -297,14 +385,14 @@ loop:
 				nowModeTimeoutTimer = time.NewTimer(NowModeDuration)
 				dataMutex.Unlock() // Unlock before potentially long-running processAndPublishData
 
-				processAndPublishData("-1m") // Initial data publish for "now" mode
+				processAndPublishData("-1m", &request) // Initial data publish for "now" mode
 			} else {
 				fmt.Printf("Received specific range request: %s. Stopping 'now' mode if active.\n", newRangeRequest)
 				lastNonNowRange = newRangeRequest // Update the last non-"now" range
 				isInNowMode = false               // Ensure now mode is marked as off
 				dataMutex.Unlock()                // Unlock before potentially long-running processAndPublishData
 
-				processAndPublishData(newRangeRequest)
+				processAndPublishData(newRangeRequest, &request)
 			}
 
 		case <-func() <-chan time.Time { // Anonymous func to safely access potentially nil ticker
@@ -319,7 +407,7 @@ loop:
 				fmt.Println("'Now' mode tick: processing -1m data.")
 			}
 			// isInNowMode check is implicitly handled by ticker being non-nil
-			processAndPublishData("-1m") // Process data for the tick
+			processAndPublishData("-1m", nil) // Process data for the tick
 
 		case <-func() <-chan time.Time { // Anonymous func to safely access potentially nil timer
 			dataMutex.Lock()
@@ -343,7 +431,7 @@ loop:
 			dataMutex.Unlock()
 
 			fmt.Printf("Now mode finished. Processing data for default range: %s\n", currentDefaultRange)
-			processAndPublishData(currentDefaultRange)
+			processAndPublishData(currentDefaultRange, nil)
 
 		case <-shutdownChan:
 			fmt.Println("nowModeManager: Received shutdown signal.")
@@ -361,7 +449,7 @@ func main() {
 	var initialQueryRange string
 
 	// Initialize channels
-	nowModeControlChan = make(chan string, 1) // Buffer of 1 to prevent blocking sender if manager is busy
+	nowModeControlChan = make(chan RangeRequest, 1) // Buffer of 1 to prevent blocking sender if manager is busy
 	shutdownChan = make(chan struct{})
 
 	flag.StringVar(&configPath, "config", "mwp_data_service/config/config.yaml", "Path to the configuration file")
@@ -412,6 +500,7 @@ func main() {
 	fmt.Printf("  MQTT Broker: %s\n", mqttConfig.Broker)
 	fmt.Printf("  MQTT Request Topic: %s\n", mqttConfig.RequestTopic)
 	fmt.Printf("  MQTT Response Topic: %s\n", mqttConfig.ResponseTopic)
+	fmt.Printf("  MQTT Metrics Topic: %s\n", mqttConfig.MetricsTopic)
 
 	// Initialize WaterDataTable (global)
 	dataMutex.Lock()
@@ -437,7 +526,7 @@ func main() {
 	} else {
 		// Perform initial data load and publish
 		fmt.Println("--- Performing Initial Data Load ---")
-		processAndPublishData(initialQueryRange)
+		processAndPublishData(initialQueryRange, nil)
 		fmt.Println("--- Initial Data Load Complete ---")
 	}
 
@@ -489,6 +578,7 @@ func main() {
 		influxClient.Close() // Explicitly close the InfluxDB client
 		fmt.Println("InfluxDB client closed.")
 	}
+	fmt.Printf("Query request latency:\n%s", requestStages.Summary())
 	fmt.Println("Service exited.")
 }
 
@@ -50,8 +50,9 @@ type MQTTConfig struct {
 	ClientID      string `yaml:"client_id"`
 	RequestTopic  string `yaml:"request_topic"`
 	ResponseTopic string `yaml:"response_topic"`
-	Username      string `yaml:"username,omitempty"` // Optional
-	Password      string `yaml:"password,omitempty"` // Optional
+	MetricsTopic  string `yaml:"metrics_topic,omitempty"` // Optional: request latency histograms
+	Username      string `yaml:"username,omitempty"`      // Optional
+	Password      string `yaml:"password,omitempty"`      // Optional
 }
 
 // --- Loading Function ---
@@ -0,0 +1,96 @@
+package metrics
+
+import (
+	"encoding/json"
+	"fmt"
+	"strings"
+	"sync"
+	"time"
+)
+
+// HistogramBuckets is the number of power-of-two microsecond buckets; the
+// last one also holds everything slower than about 67 seconds.
+const HistogramBuckets = 27
+
+// Histogram counts durations in power-of-two microsecond buckets: bucket i
+// holds durations below 2^i microseconds that did not fit bucket i-1.
+type Histogram struct {
+	Count   uint64                   `json:"count"`
+	SumUs   uint64                   `json:"sumUs"`
+	MaxUs   uint64                   `json:"maxUs"`
+	Buckets [HistogramBuckets]uint64 `json:"buckets"`
+}
+
+// Record adds one duration to the histogram. Negative durations count as zero.
+func (h *Histogram) Record(d time.Duration) {
+	us := uint64(0)
+	if d > 0 {
+		us = uint64(d / time.Microsecond)
+	}
+	bucket := 0
+	for bucket < HistogramBuckets-1 && us >= uint64(1)<<bucket {
+		bucket++
+	}
+	h.Count++
+	h.SumUs += us
+	if us > h.MaxUs {
+		h.MaxUs = us
+	}
+	h.Buckets[bucket]++
+}
+
+// Stages keeps one histogram per named stage, in the order the stages were
+// declared. Safe for concurrent use.
+type Stages struct {
+	mu         sync.Mutex
+	names      []string
+	histograms map[string]*Histogram
+}
+
+// NewStages creates a recorder for the given stage names.
+func NewStages(names ...string) *Stages {
+	s := &Stages{names: names, histograms: make(map[string]*Histogram, len(names))}
+	for _, name := range names {
+		s.histograms[name] = &Histogram{}
+	}
+	return s
+}
+
+// Record adds a duration to the named stage. Unknown stages are ignored.
+func (s *Stages) Record(stage string, d time.Duration) {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	if h, ok := s.histograms[stage]; ok {
+		h.Record(d)
+	}
+}
+
+// MarshalJSON encodes the histograms as {"stages": {"<name>": {...}, ...}}.
+func (s *Stages) MarshalJSON() ([]byte, error) {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	snapshot := make(map[string]Histogram, len(s.histograms))
+	for name, h := range s.histograms {
+		snapshot[name] = *h
+	}
+	return json.Marshal(struct {
+		Stages map[string]Histogram `json:"stages"`
+	}{snapshot})
+}
+
+// Summary returns one line per stage with its count, average and maximum.
+func (s *Stages) Summary() string {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	var b strings.Builder
+	for _, name := range s.names {
+		h := s.histograms[name]
+		avg := uint64(0)
+		if h.Count > 0 {
+			avg = h.SumUs / h.Count
+		}
+		fmt.Fprintf(&b, "  %-12s count=%d avg=%.1fms max=%.1fms\n", name, h.Count,
+			float64(avg)/1000, float64(h.MaxUs)/1000)
+	}
+	return b.String()
+}
@@ -17,6 +17,17 @@ type ReportData struct {
 	TotalIrrigationGallons float64                  `json:"totalIrrigationGallons"`
 	TotalWell3Gallons      float64                  `json:"totalWell3Gallons"`
 	Details                datastore.WaterDataTable `json:"details"`
+	RequestID              uint32                   `json:"requestId,omitempty"` // Echo of the query request's requestId
+	Trace                  *StageTrace              `json:"trace,omitempty"`     // Set along with RequestID
+}
+
+// StageTrace records when the service reached each stage of a query request,
+// in Unix microseconds, so the requester can break down the round trip.
+type StageTrace struct {
+	ReceivedUs    int64 `json:"receivedUs"`    // Request arrived over MQTT
+	QueryStartUs  int64 `json:"queryStartUs"`  // InfluxDB query sent
+	QueryEndUs    int64 `json:"queryEndUs"`    // InfluxDB query returned
+	EncodeStartUs int64 `json:"encodeStartUs"` // Table updated, JSON encoding started
 }
 
 // WriteDataTableToJSON marshals the ReportData (including super summaries and WaterDataTable)
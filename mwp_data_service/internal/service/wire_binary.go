@@ -0,0 +1,118 @@
+package service
+
+import (
+	"encoding/binary"
+	"fmt"
+	"math"
+	"strconv"
+)
+
+// Binary watertable encoding, an alternative to the JSON ReportData for
+// consumers that only need the numbers. All values are little-endian.
+//
+//	offset  size  field
+//	     0     4  magic "MWPW"
+//	     4     1  version (BinaryVersion)
+//	     5     1  fields per zone (BinaryFieldCount in this version)
+//	     6     1  controller count C
+//	     7     1  flags (BinaryFlagTrace: the trace timestamps are set)
+//	     8     4  request ID, 0 when none
+//	    12     4  reserved, 0
+//	    16     8  totalIrrigationGallons, float64
+//	    24     8  totalWell3Gallons, float64
+//	    32    32  trace: receivedUs, queryStartUs, queryEndUs, encodeStartUs, int64
+//	    64     C  zones per controller; controller c has zones 0..zones[c]-1
+//	             then, after padding to a multiple of 4:
+//	             presence bitmap, one bit per zone in controller/zone order
+//	             updatedInLastQuery bitmap, same layout
+//	             then, after padding to a multiple of 4:
+//	             fields per zone float32 values for every zone, in controller/zone order
+//
+// Zones absent from the table have their presence bit clear and zero values.
+// Readers take the fields they know by position and step over the rest, so
+// later versions can append fields without breaking them.
+const (
+	BinaryMagic      = "MWPW"
+	BinaryVersion    = 1
+	BinaryFieldCount = 6 // totalFlow, totalSeconds, avgPSI, avgTempF, avgAmps, gpm
+	BinaryFlagTrace  = 0x01
+	BinaryHeaderSize = 64
+)
+
+func pad4(n int) int {
+	return (n + 3) &^ 3
+}
+
+// EncodeBinary encodes report in the binary watertable format. Controller
+// and zone keys have to be numbers below 256.
+func EncodeBinary(report ReportData) ([]byte, error) {
+	// Size the dense table from the largest controller and zone numbers
+	zones := make([]int, 0, 8)
+	for controllerKey, zoneMap := range report.Details {
+		controller, err := strconv.Atoi(controllerKey)
+		if err != nil || controller < 0 || controller > 255 {
+			return nil, fmt.Errorf("controller key %q does not fit the binary encoding", controllerKey)
+		}
+		for len(zones) <= controller {
+			zones = append(zones, 0)
+		}
+		for zoneKey := range zoneMap {
+			zone, err := strconv.Atoi(zoneKey)
+			if err != nil || zone < 0 || zone > 254 {
+				return nil, fmt.Errorf("zone key %q of controller %s does not fit the binary encoding", zoneKey, controllerKey)
+			}
+			if zone+1 > zones[controller] {
+				zones[controller] = zone + 1
+			}
+		}
+	}
+	if len(zones) > 255 {
+		return nil, fmt.Errorf("%d controllers do not fit the binary encoding", len(zones))
+	}
+	totalZones := 0
+	for _, n := range zones {
+		totalZones += n
+	}
+
+	bitmapSize := (totalZones + 7) / 8
+	bitmapOffset := pad4(BinaryHeaderSize + len(zones))
+	valuesOffset := pad4(bitmapOffset + 2*bitmapSize)
+	buf := make([]byte, valuesOffset+totalZones*BinaryFieldCount*4)
+
+	copy(buf[0:4], BinaryMagic)
+	buf[4] = BinaryVersion
+	buf[5] = BinaryFieldCount
+	buf[6] = byte(len(zones))
+	binary.LittleEndian.PutUint32(buf[8:], report.RequestID)
+	binary.LittleEndian.PutUint64(buf[16:], math.Float64bits(report.TotalIrrigationGallons))
+	binary.LittleEndian.PutUint64(buf[24:], math.Float64bits(report.TotalWell3Gallons))
+	if report.Trace != nil {
+		buf[7] |= BinaryFlagTrace
+		binary.LittleEndian.PutUint64(buf[32:], uint64(report.Trace.ReceivedUs))
+		binary.LittleEndian.PutUint64(buf[40:], uint64(report.Trace.QueryStartUs))
+		binary.LittleEndian.PutUint64(buf[48:], uint64(report.Trace.QueryEndUs))
+		binary.LittleEndian.PutUint64(buf[56:], uint64(report.Trace.EncodeStartUs))
+	}
+
+	slot := 0
+	for controller, n := range zones {
+		buf[BinaryHeaderSize+controller] = byte(n)
+		zoneMap := report.Details[strconv.Itoa(controller)]
+		for zone := 0; zone < n; zone++ {
+			data, ok := zoneMap[strconv.Itoa(zone)]
+			if ok {
+				buf[bitmapOffset+slot/8] |= 1 << (slot % 8)
+				if data.UpdatedInLastQuery {
+					buf[bitmapOffset+bitmapSize+slot/8] |= 1 << (slot % 8)
+				}
+				values := buf[valuesOffset+slot*BinaryFieldCount*4:]
+				for i, v := range [BinaryFieldCount]float64{data.TotalFlow, data.TotalSeconds, data.AvgPSI,
+					data.AvgTempF, data.AvgAmps, data.GPM} {
+					binary.LittleEndian.PutUint32(values[i*4:], math.Float32bits(float32(v)))
+				}
+			}
+			slot++
+		}
+	}
+	return buf, nil
+}